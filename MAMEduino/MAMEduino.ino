@@ -5,6 +5,74 @@
 //drop me an email at: bim.overbohm@googlemail.com
 
 #define PROGRAM_VERSION_STRING "MAMEduino 0.9.9.3"
+//capabilities appended to the version string on a version check. P1 = framed protocol version 1, W1 = WRITE_CONFIG command,
+//V1 = SAVE_CONFIG command. changes are only saved to EEPROM on SAVE_CONFIG
+#define PROGRAM_CAPABILITIES " P1 W1 V1"
+
+//number of buttons, shift registers, coins and keys per binding. shared with the PC code
+#include "layout.h"
+
+//----- performance counters ------------------------------------------------------------------------
+//Cheap counters for loop timing and lost or rejected input, read with the COMMAND_READ_TELEMETRY command
+
+//time spent in a function in us
+struct PerfTimer {
+  uint32_t total;
+  uint16_t max;
+};
+
+//loop period histogram buckets: < 64us, < 128us, < 256us, < 512us, < 1ms, < 2ms, < 4ms, >= 4ms
+#define PERF_HISTOGRAM_SIZE 8
+#define PERF_HISTOGRAM_SHIFT 6
+
+uint32_t perfLoops = 0;
+uint16_t perfLoopMin = 0xFFFF;
+uint16_t perfLoopMax = 0;
+uint16_t perfLoopHistogram[PERF_HISTOGRAM_SIZE];
+unsigned long perfLastLoop = 0;
+PerfTimer perfKeyboard = {0, 0}; //keyboardUpdate()
+PerfTimer perfLedShow = {0, 0}; //FastLED.show()
+PerfTimer perfSerial = {0, 0}; //serialReadCommands()
+uint16_t perfKeysQueueFull = 0; //how often keys had to wait, because the key queue was full
+uint16_t perfBadFrames = 0; //frames with wrong CRC, too long or incomplete
+uint16_t perfSerialBytesDropped = 0; //bytes thrown away by the serial command parser
+
+uint16_t perfClamp(unsigned long value)
+{
+  return value < 0xFFFF ? value : 0xFFFF;
+}
+
+void perfAdd(PerfTimer & timer, unsigned long startTime)
+{
+  const unsigned long time = micros() - startTime;
+  timer.total += time;
+  if (time > timer.max) {
+    timer.max = perfClamp(time);
+  }
+}
+
+void perfCountLoop()
+{
+  const unsigned long now = micros();
+  if (perfLoops > 0) {
+    const unsigned long period = now - perfLastLoop;
+    if (period < perfLoopMin) {
+      perfLoopMin = period;
+    }
+    if (period > perfLoopMax) {
+      perfLoopMax = perfClamp(period);
+    }
+    byte bucket = 0;
+    for (unsigned long rest = period >> PERF_HISTOGRAM_SHIFT; rest > 0 && bucket < (PERF_HISTOGRAM_SIZE - 1); rest >>= 1) {
+      bucket++;
+    }
+    if (perfLoopHistogram[bucket] < 0xFFFF) {
+      perfLoopHistogram[bucket]++;
+    }
+  }
+  perfLastLoop = now;
+  perfLoops++;
+}
 
 //----- LEDs (you simply can leave this out if you don't want LEDs) ------------------------------------------------------------
 #include <FastLED.h>
@@ -20,8 +88,32 @@ CRGB leds[NUM_LEDS];
 #define LED_INTERIOR_END (LED_INTERIOR_START + 5)
 #define LED_COIN_RECEPTOR_START (LED_INTERIOR_END + 1)
 #define LED_COIN_RECEPTOR_END (LED_COIN_RECEPTOR_START + 1)
-//current interior LED color
-CRGB interiourColor = CRGB(0, 0, 0);
+
+//LEDs are sent to the strip in frames of at most one FastLED.show(), and only if something changed
+#define LED_FRAME_INTERVAL 20
+//WS2812 output turns interrupts off, so a frame waits while inputs are changing, but not longer than this
+#define LED_FRAME_MAX_DELAY 250
+//LED regions that need to be sent with the next frame
+#define LED_REGION_INTERIOR 1
+#define LED_REGION_COIN_RECEPTOR 2
+byte ledsDirty = 0;
+unsigned long ledsLastFrame = 0;
+
+//interior colors for a full hue cycle, computed once at startup. one step every 512ms
+#define LED_HUE_STEPS 64
+#define LED_HUE_STEP_SHIFT 9
+CRGB ledHueTable[LED_HUE_STEPS];
+byte ledInteriorStep = 0xFF; //none yet
+
+//returns true while input edges are being debounced or validated. defined with the input handling below
+bool inputsBusy();
+
+void ledSetup()
+{
+    for (uint8_t i = 0; i < LED_HUE_STEPS; ++i) {
+        ledHueTable[i] = CHSV(i * (256 / LED_HUE_STEPS), 255, 255);
+    }
+}
 
 void ledShowRejectCoin(bool reject)
 {
@@ -29,97 +121,484 @@ void ledShowRejectCoin(bool reject)
     for (uint8_t i = LED_COIN_RECEPTOR_START; i <= LED_COIN_RECEPTOR_END; ++i) {
         leds[i] = newColor;
     }
-    FastLED.show();
+    ledsDirty |= LED_REGION_COIN_RECEPTOR;
 }
 
 void ledCycleInteriorColor()
 {
-    const uint8_t hue = (uint8_t)(millis() >> 7);
-    const CRGB newColor = CHSV(hue, 255, 255);
-    if (interiourColor != newColor) {
+    const uint8_t step = (uint8_t)(millis() >> LED_HUE_STEP_SHIFT) & (LED_HUE_STEPS - 1);
+    if (ledInteriorStep != step) {
+        const CRGB newColor = ledHueTable[step];
         for (uint8_t i = LED_INTERIOR_START; i <= LED_INTERIOR_END; ++i) {
             leds[i] = newColor;
         }
-        interiourColor = newColor;
-        FastLED.show();
+        ledInteriorStep = step;
+        ledsDirty |= LED_REGION_INTERIOR;
     }
 }
 
+void ledUpdate()
+{
+    const unsigned long now = millis();
+    const unsigned long sinceLastFrame = now - ledsLastFrame;
+    if (sinceLastFrame < LED_FRAME_INTERVAL) {
+        return;
+    }
+    ledCycleInteriorColor();
+    if (ledsDirty == 0) {
+        ledsLastFrame = now;
+        return;
+    }
+    //delay the frame while inputs need exact timing
+    if (inputsBusy() && sinceLastFrame < LED_FRAME_MAX_DELAY) {
+        return;
+    }
+    const unsigned long showStart = micros();
+    FastLED.show();
+    perfAdd(perfLedShow, showStart);
+    ledsDirty = 0;
+    ledsLastFrame = now;
+}
+
 //----- power/reset ------------------------------------------------------------------------
 
+//key codes and hardware function codes CHAR_PIN_POWER, CHAR_PIN_RESET, CHAR_HARDWARE_FUNCTION are shared with the PC code
+#include "keycodes.h"
+
 //pin for mainboard power switch
 #define PIN_POWER 7
-#define CHAR_PIN_POWER 255
 //pin for mainboard reset switch
 #define PIN_RESET 6
-#define CHAR_PIN_RESET (CHAR_PIN_POWER-1)
 
-//this is where the first hardware function starts
-#define CHAR_HARDWARE_FUNCTION CHAR_PIN_RESET
+//----- event bridge -------------------------------------------------------------------------------
+//In bridge mode button and coin events are sent to the serial port with a time stamp instead of as keystrokes,
+//and the host injects the keys itself without the keystroke delays. Hardware functions are still done here.
+//The host must repeat COMMAND_SET_BRIDGE within BRIDGE_TIMEOUT, else we go back to sending keystrokes.
+//An event is: BRIDGE_EVENT_START, event byte, 32-bit micros() time stamp (LSB first), check byte.
+//The event byte is BRIDGE_EVENT_* | button or coin index, the check byte is the inverted sum of event byte and time stamp.
+
+#define BRIDGE_TIMEOUT 3000
+#define BRIDGE_EVENT_START 0xE5
+#define BRIDGE_EVENT_BUTTON_DOWN 0x00
+#define BRIDGE_EVENT_BUTTON_UP 0x20
+#define BRIDGE_EVENT_COIN 0x40
+
+bool bridgeMode = false;
+unsigned long bridgeLastKeepAlive = 0;
+
+void bridgeSetMode(bool on)
+{
+  bridgeMode = on;
+  bridgeLastKeepAlive = millis();
+}
+
+bool bridgeActive()
+{
+  if (bridgeMode && (millis() - bridgeLastKeepAlive) > BRIDGE_TIMEOUT) {
+    //host went away
+    bridgeMode = false;
+  }
+  return bridgeMode;
+}
+
+void bridgeSendEvent(byte event, unsigned long time)
+{
+  const byte data[] = {BRIDGE_EVENT_START, event, (byte)time, (byte)(time >> 8), (byte)(time >> 16), (byte)(time >> 24), 0};
+  byte sum = 0;
+  for (byte i = 1; i < sizeof(data) - 1; i++) {
+    sum += data[i];
+  }
+  Serial.write(data, sizeof(data) - 1);
+  Serial.write((byte)~sum);
+}
+
+//----- macros -------------------------------------------------------------------------------------
+//The keys of all bindings are packed into one pool, so a binding only uses the bytes it needs.
+//Binding b uses macroPool[macroEnd[b - 1]] to macroPool[macroEnd[b] - 1], binding 0 starts at 0.
+//Besides keys a macro can have steps that wait, hold a key longer or repeat the previous step, see CHAR_DELAY in keycodes.h.
+
+#define MACRO_POOL_SIZE Layout::macroPool
+//maximum bytes per binding
+#define MACRO_MAX_LENGTH Layout::keys
+#define MACRO_BINDINGS_NUMBER_OF Layout::bindings
+//binding numbers of buttons and coins
+#define BINDING_BUTTON_SHORT(button) (button)
+#define BINDING_BUTTON_LONG(button) (Layout::buttons + (button))
+#define BINDING_COIN(coin) (2 * Layout::buttons + (coin))
+#define BINDING_NONE 0xFF
+
+typedef Layout::MacroOffset MacroOffset;
+
+byte macroPool[MACRO_POOL_SIZE];
+MacroOffset macroEnd[MACRO_BINDINGS_NUMBER_OF] = {0};
+
+//bindings set until stored ones are loaded or others are received: binding, length, keys
+const byte MACRO_DEFAULTS[] PROGMEM = {BINDING_BUTTON_SHORT(4), 1, CHAR_PIN_POWER};
+
+MacroOffset macroStart(byte binding)
+{
+  return binding > 0 ? macroEnd[binding - 1] : 0;
+}
+
+byte macroLength(byte binding)
+{
+  return binding < MACRO_BINDINGS_NUMBER_OF ? macroEnd[binding] - macroStart(binding) : 0;
+}
+
+const byte * macroKeys(byte binding)
+{
+  return &macroPool[macroStart(binding)];
+}
+
+MacroOffset macroUsed()
+{
+  return macroEnd[MACRO_BINDINGS_NUMBER_OF - 1];
+}
+
+//step time of a CHAR_DELAY or CHAR_HOLD operand in ms
+unsigned long macroTime(byte operand)
+{
+  return (unsigned long)(operand & ~MACRO_OPERAND) * MACRO_TIME_UNIT;
+}
+
+//check that steps have their operands and media keys their usage, so playing a macro never reads past its end
+bool macroValid(const byte * keys, byte length)
+{
+  for (byte i = 0; i < length; i++) {
+    const byte key = keys[i];
+    if (key == CHAR_DELAY || key == CHAR_HOLD || key == CHAR_REPEAT) {
+      if ((i + 1) >= length || keys[i + 1] <= MACRO_OPERAND) {
+        return false;
+      }
+      i++;
+      //a hold needs a key or pin to hold
+      if (key == CHAR_HOLD && ((i + 1) >= length || keys[i + 1] == CHAR_DELAY || keys[i + 1] == CHAR_HOLD || keys[i + 1] == CHAR_REPEAT)) {
+        return false;
+      }
+    }
+    else if (key == CHAR_MEDIA || key == CHAR_CHORD) {
+      //media keys have their usage next, chords join two keys
+      if ((i + 1) >= length) {
+        return false;
+      }
+      if (key == CHAR_MEDIA) {
+        i++;
+      }
+    }
+  }
+  return true;
+}
+
+//replace the keys of a binding. keys end at the first 0 like in the fixed-size strings of older hosts.
+//returns false if they are not valid or don't fit into the pool
+bool macroSet(byte binding, const byte * keys, byte length)
+{
+  for (byte i = 0; i < length; i++) {
+    if (keys[i] == 0) {
+      length = i;
+      break;
+    }
+  }
+  const MacroOffset start = macroStart(binding);
+  const MacroOffset oldLength = macroEnd[binding] - start;
+  const MacroOffset used = macroUsed();
+  if (length > MACRO_MAX_LENGTH || (used - oldLength + length) > MACRO_POOL_SIZE || !macroValid(keys, length)) {
+    return false;
+  }
+  //move the bindings behind this one
+  memmove(&macroPool[start + length], &macroPool[start + oldLength], used - start - oldLength);
+  memcpy(&macroPool[start], keys, length);
+  for (byte i = binding; i < MACRO_BINDINGS_NUMBER_OF; i++) {
+    macroEnd[i] = macroEnd[i] - oldLength + length;
+  }
+  return true;
+}
+
+void macroSetDefaults()
+{
+  byte keys[MACRO_MAX_LENGTH];
+  for (byte i = 0; i < sizeof(MACRO_DEFAULTS); ) {
+    const byte binding = pgm_read_byte(&MACRO_DEFAULTS[i++]);
+    const byte length = pgm_read_byte(&MACRO_DEFAULTS[i++]);
+    for (byte k = 0; k < length; k++) {
+      keys[k] = pgm_read_byte(&MACRO_DEFAULTS[i++]);
+    }
+    macroSet(binding, keys, length);
+  }
+}
 
 //----- keyboard ------------------------------------------------------------------------------------
 #include <Keyboard.h>
+#include <HID.h>
+
+//media keys are sent as HID consumer control reports. the Keyboard library uses report id 2, the Mouse library 1
+#define MEDIA_REPORT_ID 3
+
+static const uint8_t mediaReportDescriptor[] PROGMEM = {
+  0x05, 0x0C, //usage page (consumer)
+  0x09, 0x01, //usage (consumer control)
+  0xA1, 0x01, //collection (application)
+  0x85, MEDIA_REPORT_ID, //report id
+  0x15, 0x00, //logical minimum (0)
+  0x26, 0xFF, 0x00, //logical maximum (255)
+  0x19, 0x00, //usage minimum (0)
+  0x2A, 0xFF, 0x00, //usage maximum (255)
+  0x75, 0x08, //report size (8)
+  0x95, 0x01, //report count (1)
+  0x81, 0x00, //input (data, array)
+  0xC0 //end collection
+};
+HIDSubDescriptor mediaDescriptor(mediaReportDescriptor, sizeof(mediaReportDescriptor));
+
+bool mediaSetup()
+{
+  HID().AppendDescriptor(&mediaDescriptor);
+  return true;
+}
+//the descriptor must be there before USB enumeration, so add it when globals are constructed, like the Keyboard library does
+const bool mediaDescriptorAdded = mediaSetup();
+
+byte mediaPressed = 0;
+
+void mediaSend(byte usage)
+{
+  mediaPressed = usage;
+  HID().SendReport(MEDIA_REPORT_ID, &mediaPressed, 1);
+}
 
 //pin for redirecting keyboard codes to serial port instead of keyboard
 #define PIN_KEY_TO_SERIAL 0
 
-//max number of keys that can be defined
-#define KEYS_NUMBER_OF 6
-
 //How long to press a simulated key
 #define KEYS_PRESS_DELAY 100
 //How long to wait between simulated key presses
 #define KEYS_PRESS_NEXT_DELAY 200
 
-void keyboardSendString(const byte keys[KEYS_NUMBER_OF])
+//max number of bindings waiting to be sent
+#define KEYS_QUEUE_SIZE 8
+
+//states of the key sending state machine
+#define KEYS_STATE_IDLE 0 //no key active. start the next step of the macro at the start of the queue
+#define KEYS_STATE_PRESSED 1 //key or hardware pin active. wait keysHoldTime
+#define KEYS_STATE_RELEASED 2 //key released or delay step. wait keysWaitTime
+
+//bindings waiting to be sent. only the binding number is queued, the keys are read from the macro pool while sending
+byte keysQueue[KEYS_QUEUE_SIZE];
+byte keysQueueStart = 0;
+byte keysQueueCount = 0;
+//index of the current step in the macro at the start of the queue
+byte keysIndex = 0;
+//index where the last step started, for CHAR_REPEAT
+byte keysStepStart = 0;
+//index of the CHAR_REPEAT being done and the number of repeats left
+byte keysRepeatIndex = BINDING_NONE;
+byte keysRepeatLeft = 0;
+//key or hardware function pressed in the current step, so it can be released
+byte keysPressed = 0;
+byte keysState = KEYS_STATE_IDLE;
+unsigned long keysStateStart = 0;
+unsigned long keysHoldTime = KEYS_PRESS_DELAY;
+unsigned long keysWaitTime = KEYS_PRESS_NEXT_DELAY;
+
+//queue the keys of a binding for sending. returns false if the queue is full
+bool keyboardSendString(byte binding)
 {
-  int i = 0;
-  //SAFETY BELT: check for keyboard to COM redirection
-  if (digitalRead(PIN_KEY_TO_SERIAL) == LOW) {
-    //on. send to serial port
-    while ((i < KEYS_NUMBER_OF) && (keys[i] != 0)) {
-      Serial.write(keys[i]);
-      i++;
+  if (macroLength(binding) == 0) {
+    //nothing to send
+    return true;
+  }
+  if (keysQueueCount >= KEYS_QUEUE_SIZE) {
+    if (perfKeysQueueFull < 0xFFFF) {
+      perfKeysQueueFull++;
     }
-    Serial.write('\n');
+    return false;
+  }
+  keysQueue[(keysQueueStart + keysQueueCount) % KEYS_QUEUE_SIZE] = binding;
+  keysQueueCount++;
+  return true;
+}
+
+//drop queued keys of a binding that is about to change. a step that is active is still released normally
+void keyboardCancelString(byte binding)
+{
+  for (byte i = 0; i < keysQueueCount; i++) {
+    byte & entry = keysQueue[(keysQueueStart + i) % KEYS_QUEUE_SIZE];
+    if (entry == binding) {
+      entry = BINDING_NONE;
+    }
+  }
+}
+
+//true if keys of a binding are queued or being sent
+bool keyboardIsQueued(byte binding)
+{
+  for (byte i = 0; i < keysQueueCount; i++) {
+    if (keysQueue[(keysQueueStart + i) % KEYS_QUEUE_SIZE] == binding) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void keyboardNextString()
+{
+  keysQueueStart = (keysQueueStart + 1) % KEYS_QUEUE_SIZE;
+  keysQueueCount--;
+  keysIndex = 0;
+  keysStepStart = 0;
+  keysRepeatIndex = BINDING_NONE;
+}
+
+//press the key at keysIndex. keys joined by CHAR_CHORD are pressed together and media keys use two bytes.
+//keysIndex is left on the last byte used
+void keyboardPressKeys(const byte * keys, byte length)
+{
+  while (true) {
+    if (keys[keysIndex] == CHAR_MEDIA && (keysIndex + 1) < length) {
+      keysIndex++;
+      mediaSend(keys[keysIndex]);
+    }
+    else {
+      Keyboard.press(keys[keysIndex]);
+    }
+    if ((keysIndex + 2) >= length || keys[keysIndex + 1] != CHAR_CHORD) {
+      return;
+    }
+    keysIndex += 2;
+  }
+}
+
+//go back to the start of the previous step or continue after the CHAR_REPEAT at keysIndex when all repeats are done
+void keyboardRepeatStep(const byte * keys)
+{
+  if (keysRepeatIndex != keysIndex) {
+    keysRepeatIndex = keysIndex;
+    keysRepeatLeft = keys[keysIndex + 1] & ~MACRO_OPERAND;
+  }
+  if (keysRepeatLeft > 0 && keysStepStart < keysIndex) {
+    keysRepeatLeft--;
+    keysIndex = keysStepStart;
   }
   else {
-    //off. send as keystrokes
-    while ((i < KEYS_NUMBER_OF) && (keys[i] != 0)) {
-      //send ALL keys using press/release, because otherwise wrong key codes are sent
-      /*if (keys[i] < 128) {
-        Keyboard.write(keys[i]);
-        delay(KEYS_PRESS_NEXT_DELAY);
-      }
-      else*/ if (keys[i] < CHAR_HARDWARE_FUNCTION) {
-        Keyboard.press(keys[i]);
-        delay(KEYS_PRESS_DELAY);
-        Keyboard.releaseAll();
-        delay(KEYS_PRESS_NEXT_DELAY);
-      }
-      else {
-        //hardware function. yeah, I could have used a map.
-        if (keys[i] == CHAR_PIN_RESET) {
-          //activate reset pin
-          digitalWrite(PIN_RESET, HIGH);
-          delay(KEYS_PRESS_DELAY);
-          digitalWrite(PIN_RESET, LOW);
-        }
-        else if (keys[i] == CHAR_PIN_POWER) {
-          //activate power pin
-          digitalWrite(PIN_POWER, HIGH);
-          delay(KEYS_PRESS_DELAY);
-          digitalWrite(PIN_POWER, LOW);
-        }
+    keysRepeatIndex = BINDING_NONE;
+    keysIndex += 2;
+  }
+}
+
+//skip the keys of a step starting at keysIndex. used in bridge mode, where the host sends the keys
+void keyboardSkipKeys(const byte * keys, byte length)
+{
+  while (keysIndex < length && (keys[keysIndex] == CHAR_MEDIA || ((keysIndex + 1) < length && keys[keysIndex + 1] == CHAR_CHORD))) {
+    keysIndex += 2;
+  }
+  keysIndex++;
+}
+
+//advance sending queued keys by one step. never waits, so call it from every loop()
+void keyboardUpdate()
+{
+  const unsigned long now = millis();
+  if (keysState == KEYS_STATE_PRESSED) {
+    if ((now - keysStateStart) < keysHoldTime) {
+      return;
+    }
+    //hardware function. yeah, I could have used a map.
+    if (keysPressed == CHAR_PIN_RESET) {
+      digitalWrite(PIN_RESET, LOW);
+      keysState = KEYS_STATE_IDLE;
+    }
+    else if (keysPressed == CHAR_PIN_POWER) {
+      digitalWrite(PIN_POWER, LOW);
+      keysState = KEYS_STATE_IDLE;
+    }
+    else {
+      Keyboard.releaseAll();
+      if (mediaPressed != 0) {
+        mediaSend(0);
       }
-      i++;
+      keysState = KEYS_STATE_RELEASED;
+      keysStateStart = now;
+      keysWaitTime = KEYS_PRESS_NEXT_DELAY;
+      return;
+    }
+  }
+  if (keysState == KEYS_STATE_RELEASED) {
+    if ((now - keysStateStart) < keysWaitTime) {
+      return;
     }
+    keysState = KEYS_STATE_IDLE;
+  }
+  //drop macros that have been sent completely or were cancelled
+  while (keysQueueCount > 0 && keysIndex >= macroLength(keysQueue[keysQueueStart])) {
+    keyboardNextString();
   }
+  if (keysQueueCount == 0) {
+    return;
+  }
+  const byte * keys = macroKeys(keysQueue[keysQueueStart]);
+  const byte length = macroLength(keysQueue[keysQueueStart]);
+  //SAFETY BELT: check for keyboard to COM redirection
+  if (keysIndex == 0 && !bridgeActive() && digitalRead(PIN_KEY_TO_SERIAL) == LOW) {
+    //on. send to serial port
+    Serial.write(keys, length);
+    Serial.write('\n');
+    keyboardNextString();
+    return;
+  }
+  //off. do the next step
+  if (keys[keysIndex] == CHAR_REPEAT) {
+    keyboardRepeatStep(keys);
+    return;
+  }
+  keysStepStart = keysIndex;
+  if (keys[keysIndex] == CHAR_DELAY) {
+    //in bridge mode the host sends the keys, so there is nothing to wait for
+    if (!bridgeActive()) {
+      keysState = KEYS_STATE_RELEASED;
+      keysStateStart = now;
+      keysWaitTime = macroTime(keys[keysIndex + 1]);
+    }
+    keysIndex += 2;
+    return;
+  }
+  keysHoldTime = KEYS_PRESS_DELAY;
+  if (keys[keysIndex] == CHAR_HOLD) {
+    keysHoldTime = macroTime(keys[keysIndex + 1]);
+    keysIndex += 2;
+  }
+  const byte key = keys[keysIndex];
+  //send ALL keys using press/release, because otherwise wrong key codes are sent
+  if (key < CHAR_HARDWARE_FUNCTION) {
+    //in bridge mode the host sends the keys. only hardware functions are left to us
+    if (bridgeActive()) {
+      keyboardSkipKeys(keys, length);
+      return;
+    }
+    keyboardPressKeys(keys, length);
+  }
+  else if (key == CHAR_PIN_RESET) {
+    //activate reset pin
+    digitalWrite(PIN_RESET, HIGH);
+  }
+  else if (key == CHAR_PIN_POWER) {
+    //activate power pin
+    digitalWrite(PIN_POWER, HIGH);
+  }
+  keysPressed = key;
+  keysIndex++;
+  keysState = KEYS_STATE_PRESSED;
+  keysStateStart = now;
 }
 
 //----- buttons ----------------------------------------------------------------------------
+#include <SPI.h>
+
+#define BUTTONS_NUMBER_OF Layout::buttons
+#define PIN_BUTTONS_NUMBER_OF Layout::pinButtons
+#define SHIFT_REGISTERS_NUMBER_OF Layout::shiftRegisters
 
-#define BUTTONS_NUMBER_OF 5
+//bit i = button i
+typedef Layout::ButtonMask ButtonMask;
 
 #define REJECT_BUTTON 0
 #define EXIT_RESET 1
@@ -127,81 +606,131 @@ void keyboardSendString(const byte keys[KEYS_NUMBER_OF])
 #define PLAYER_1 3
 #define PLAYER_2 4
 
-//pin numbers for buttons
-const byte PIN_BUTTON[BUTTONS_NUMBER_OF] = {11, 2, 3, 4, 5};
+//pin numbers for buttons on pins. the buttons on shift registers follow them
+const byte PIN_BUTTON[PIN_BUTTONS_NUMBER_OF] = {11, 2, 3, 4, 5};
 
-//characters sent when a button is pressed. the numbers >= 250 are currently reserved for hardware functions
-//atm 254=RESET and 255=POWER pin are supported
-byte buttonShortPressedString[BUTTONS_NUMBER_OF][KEYS_NUMBER_OF] = {{0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}, {CHAR_PIN_POWER, 0, 0, 0, 0, 0}};
-byte buttonLongPressedString[BUTTONS_NUMBER_OF][KEYS_NUMBER_OF] = {{0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}};
+//shift registers are chained 74HC165s. their serial output goes to MISO, their clock to SCK and
+//their parallel load input to PIN_SHIFT_LOAD. inputs A-H of the register next to the Arduino are the first 8 buttons
+#define PIN_SHIFT_LOAD 13
+//SPI clock. 4MHz reads 4 registers in ~10us
+#define SHIFT_REGISTERS_SPI_CLOCK 4000000
+
+//characters sent when a button is pressed are in the macro pool, see BINDING_BUTTON_SHORT and BINDING_BUTTON_LONG.
+//see keycodes.h for the codes, e.g. of the hardware functions. atm 254=RESET and 255=POWER pin are supported
 
 //button press durations in ms
-#define RELEASE_DURATION 50
 #define SHORT_PRESS_DURATION 50
 #define LONG_PRESS_DURATION 4000
 
-//button state variables. PIN_REJECT_BUTTON, PIN_EXIT_RESET, PIN_PAUSE_CHEAT, PIN_PLAYER_1, PIN_PLAYER_2
-byte lastButtonPin[BUTTONS_NUMBER_OF] = {LOW, LOW, LOW, LOW, LOW};
-long int lastButtonStart[BUTTONS_NUMBER_OF] = {0, 0, 0, 0, 0};
-byte currentButtonState[BUTTONS_NUMBER_OF] = {0, 0, 0, 0, 0}; //0 = released, 1 = short pressed, 2 = long pressed
-boolean buttonWasPressedShort[BUTTONS_NUMBER_OF] = {false, false, false, false, false};
-boolean buttonWasPressedLong[BUTTONS_NUMBER_OF] = {false, false, false, false, false};
+//buttons are sampled once per BUTTONS_SCAN_INTERVAL ms. a change must be seen in 4 samples in a row to count
+#define BUTTONS_SCAN_INTERVAL 1
+
+//button pin input registers and masks, so scanning doesn't need digitalRead
+volatile uint8_t * buttonPinRegister[PIN_BUTTONS_NUMBER_OF];
+byte buttonPinMask[PIN_BUTTONS_NUMBER_OF];
+
+//button state variables. bit i = button i
+ButtonMask buttonsDebounced = 0; //debounced state. 1 = pressed
+ButtonMask buttonsCount0 = 0; //bit 0 of the vertical debounce counters
+ButtonMask buttonsCount1 = 0; //bit 1 of the vertical debounce counters
+ButtonMask buttonsPressedShort = 0; //short presses not sent as keys yet
+ButtonMask buttonsPressedLong = 0; //long presses not sent as keys yet
+uint16_t buttonPressDuration[BUTTONS_NUMBER_OF] = {0}; //how long a button has been pressed in ms
+unsigned long buttonsLastScan = 0;
+uint16_t buttonPressesRejected = 0; //number of presses shorter than SHORT_PRESS_DURATION
+
+void buttonsSetupScan()
+{
+  for (byte i = 0; i < PIN_BUTTONS_NUMBER_OF; i++) {
+    buttonPinRegister[i] = portInputRegister(digitalPinToPort(PIN_BUTTON[i]));
+    buttonPinMask[i] = digitalPinToBitMask(PIN_BUTTON[i]);
+  }
+  if (SHIFT_REGISTERS_NUMBER_OF > 0) {
+    pinMode(PIN_SHIFT_LOAD, OUTPUT);
+    digitalWrite(PIN_SHIFT_LOAD, HIGH);
+    SPI.begin();
+  }
+}
+
+uint32_t buttonsReadShiftRegisters()
+{
+  //latch all inputs, then clock them out in one burst. input H of a register comes first.
+  //buttons pull their input LOW when pressed
+  digitalWrite(PIN_SHIFT_LOAD, LOW);
+  digitalWrite(PIN_SHIFT_LOAD, HIGH);
+  SPI.beginTransaction(SPISettings(SHIFT_REGISTERS_SPI_CLOCK, MSBFIRST, SPI_MODE0));
+  uint32_t pressed = 0;
+  for (byte i = 0; i < SHIFT_REGISTERS_NUMBER_OF; i++) {
+    pressed |= (uint32_t)(byte)~SPI.transfer(0) << (8 * i);
+  }
+  SPI.endTransaction();
+  return pressed;
+}
+
+ButtonMask buttonsReadPins()
+{
+  //buttons pull their input LOW when pressed
+  ButtonMask pressed = 0;
+  for (byte i = 0; i < PIN_BUTTONS_NUMBER_OF; i++) {
+    if (!(*buttonPinRegister[i] & buttonPinMask[i])) {
+      pressed |= (ButtonMask)bit(i);
+    }
+  }
+  if (SHIFT_REGISTERS_NUMBER_OF > 0) {
+    pressed |= (ButtonMask)(buttonsReadShiftRegisters() << PIN_BUTTONS_NUMBER_OF);
+  }
+  return pressed;
+}
 
 void buttonsReadState()
 {
-  //the state must be button signal high, hold high SHORT_PRESS_DURATION, signal low, hold low RELEASE_DURATION -> valid short press
-  //the state must be button signal high, hold high LONG_PRESS_DURATION, signal low, hold low RELEASE_DURATION -> valid long press
-  int i = 0;
-  for (; i < BUTTONS_NUMBER_OF; i++) {
-    //check what state the pin is in
-    const byte state = digitalRead(PIN_BUTTON[i]);
-    //check if the state is the same as before
-    if (state == lastButtonPin[i]) {
-      //state is the same. check what it is
-      if (state == LOW) {
-        //button still pressed
-        if (currentButtonState[i] == 0) {
-          //button was released before. check if enough time has passed to get a short/long press
-          if ((millis() - lastButtonStart[i]) >= SHORT_PRESS_DURATION) {
-            //Serial.print("Short press button #"); Serial.println(i);
-            currentButtonState[i] = 1;
-          }
-        }
-        if (currentButtonState[i] == 1) {
-          //button was pressed before. check if enough time has passed to get a long press
-          if ((millis() - lastButtonStart[i]) >= LONG_PRESS_DURATION) {
-            //Serial.print("Long press button #"); Serial.println(i);
-            currentButtonState[i] = 2;
-          }
-        }
+  //the state must be button pressed for SHORT_PRESS_DURATION, then released -> valid short press
+  //the state must be button pressed for LONG_PRESS_DURATION, then released -> valid long press
+  const unsigned long now = millis();
+  const unsigned long elapsed = now - buttonsLastScan;
+  if (elapsed < BUTTONS_SCAN_INTERVAL) {
+    return;
+  }
+  buttonsLastScan = now;
+  //debounce all buttons at once with 2-bit vertical counters. counters of buttons that are the same as
+  //their debounced state are reset, the others count up and the button toggles when its counter wraps
+  const ButtonMask changed = buttonsReadPins() ^ buttonsDebounced;
+  buttonsCount1 = (buttonsCount1 ^ buttonsCount0) & changed;
+  buttonsCount0 = ~buttonsCount0 & changed;
+  const ButtonMask toggled = changed & ~(buttonsCount0 | buttonsCount1);
+  buttonsDebounced ^= toggled;
+  if (toggled != 0 && bridgeActive()) {
+    const unsigned long time = micros();
+    for (byte i = 0; i < BUTTONS_NUMBER_OF; i++) {
+      if (toggled & bit(i)) {
+        bridgeSendEvent(((buttonsDebounced & bit(i)) ? BRIDGE_EVENT_BUTTON_DOWN : BRIDGE_EVENT_BUTTON_UP) | i, time);
+      }
+    }
+  }
+  //time presses and check released buttons
+  for (byte i = 0; i < BUTTONS_NUMBER_OF; i++) {
+    if (buttonsDebounced & bit(i)) {
+      //button still pressed
+      if (toggled & bit(i)) {
+        buttonPressDuration[i] = 0;
       }
       else {
-        //button still unpressed
-        if (currentButtonState[i] == 1) {
-          //button was short pressed and released. was the release long enough
-          if ((millis() - lastButtonStart[i]) >= RELEASE_DURATION) {
-            //Serial.print("Short release button #"); Serial.println(i);
-            buttonWasPressedShort[i] = true;
-            buttonWasPressedLong[i] = false;
-            currentButtonState[i] = 0;
-          }
-        }
-        else if (currentButtonState[i] == 2) {
-          //button was pressed and released. was the release long enough
-          if ((millis() - lastButtonStart[i]) >= RELEASE_DURATION) {
-            //Serial.print("Long release button #"); Serial.println(i);
-            buttonWasPressedShort[i] = false;
-            buttonWasPressedLong[i] = true;
-            currentButtonState[i] = 0;
-          }
-        }
+        buttonPressDuration[i] = (buttonPressDuration[i] + elapsed) < 0xFFFF ? (buttonPressDuration[i] + elapsed) : 0xFFFF;
       }
     }
-    else {
-      //state changed. store time
-      lastButtonStart[i] = millis();
-      lastButtonPin[i] = state;
-      //Serial.print(i); Serial.print(" = "); Serial.println(state);
+    else if (toggled & bit(i)) {
+      //button released. was the press long enough?
+      if (buttonPressDuration[i] >= LONG_PRESS_DURATION) {
+        buttonsPressedLong |= bit(i);
+        buttonsPressedShort &= ~bit(i);
+      }
+      else if (buttonPressDuration[i] >= SHORT_PRESS_DURATION) {
+        buttonsPressedShort |= bit(i);
+        buttonsPressedLong &= ~bit(i);
+      }
+      else {
+        buttonPressesRejected++;
+      }
     }
   }
 }
@@ -210,22 +739,23 @@ void buttonsDoCommands()
 {
   int i = 0;
   for (; i < BUTTONS_NUMBER_OF; i++) {
-    if (buttonWasPressedLong[i]) {
-      keyboardSendString(buttonLongPressedString[i]);
-      buttonWasPressedLong[i] = false;
-      buttonWasPressedShort[i] = false;
+    //if the key queue is full, the press stays pending and we try again next time
+    if (buttonsPressedLong & bit(i)) {
+      if (keyboardSendString(BINDING_BUTTON_LONG(i))) {
+        buttonsPressedLong &= ~bit(i);
+      }
     }
-    else if (buttonWasPressedShort[i]) {
-      keyboardSendString(buttonShortPressedString[i]);
-      buttonWasPressedLong[i] = false;
-      buttonWasPressedShort[i] = false;
+    else if (buttonsPressedShort & bit(i)) {
+      if (keyboardSendString(BINDING_BUTTON_SHORT(i))) {
+        buttonsPressedShort &= ~bit(i);
+      }
     }
   }
 }
 
 //----- coin interface -----------------------------------------------------------------------------
 
-#define COINS_NUMBER_OF 3
+#define COINS_NUMBER_OF Layout::coins
 
 #define COIN_0 0
 #define COIN_1 1
@@ -236,265 +766,1092 @@ const byte PIN_COIN[COINS_NUMBER_OF] = {8, 9, 10};
 //pin for the signal to reject all coins
 #define PIN_REJECT_COINS 12
 
-//characters sent when a coin is inserted. Coin 1, 2, 3
-byte coinInsertedString[COINS_NUMBER_OF][KEYS_NUMBER_OF] = {{0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}};
+//characters sent when a coin is inserted are in the macro pool, see BINDING_COIN
+
+//a coin is a train of pulses that are at least COIN_PULSE_DURATION ms long, with gaps shorter than COIN_TRAIN_GAP ms.
+//coin mechanisms send one pulse per coin. validators in pulse mode send one short pulse per credit, e.g. 4 x 30ms
+//for a coin worth 4 credits, and need shorter times here. every pulse is worth COIN_CREDITS_PER_PULSE credits
+const byte COIN_PULSE_DURATION[COINS_NUMBER_OF] = {70, 70, 70};
+const byte COIN_TRAIN_GAP[COINS_NUMBER_OF] = {70, 70, 70};
+const byte COIN_CREDITS_PER_PULSE[COINS_NUMBER_OF] = {1, 1, 1};
+
+//coin pin edges are captured by the pin change interrupt with a time stamp, so no pulse is lost while loop() is busy.
+//the interrupt writes coinEventsHead, loop() writes coinEventsTail, so no locking is needed
+#define COIN_EVENTS_SIZE 16 //must be a power of two
+struct CoinEvent {
+  unsigned long time; //micros() when the edge was seen
+  byte pins; //coin pin levels. bit i = coin i
+};
+volatile CoinEvent coinEvents[COIN_EVENTS_SIZE];
+volatile byte coinEventsHead = 0;
+volatile byte coinEventsTail = 0;
+//coin pin levels last seen by the interrupt
+volatile byte coinEventsLastPins = 0;
+//number of edges lost because the ring buffer was full
+volatile uint16_t coinEventsOverflows = 0;
+//number of coin pulses shorter than COIN_PULSE_DURATION
+uint16_t coinPulsesRejected = 0;
 
-//minumum coin signal duration
-#define COIN_INSERT_DURATION 70
+//coin pin input registers and masks, so the interrupt doesn't need digitalRead
+volatile uint8_t * coinPinRegister[COINS_NUMBER_OF];
+byte coinPinMask[COINS_NUMBER_OF];
 
 //coin slot state variables. Coin 1, 2, 3
-byte lastCoinPin[COINS_NUMBER_OF] = {LOW, LOW, LOW};
-long int lastCoinStart[COINS_NUMBER_OF] = {0, 0, 0};
-byte currentCoinState[COINS_NUMBER_OF] = {0, 0, 0}; //0 = released, 1 = inserted
-boolean coinWasInserted[COINS_NUMBER_OF] = {false, false, false};
+byte lastCoinPin[COINS_NUMBER_OF]; //set in coinsSetupCapture()
+unsigned long lastCoinStart[COINS_NUMBER_OF] = {0}; //time of the last edge in us
+byte coinTrainPulses[COINS_NUMBER_OF] = {0}; //pulses of the coin being inserted. 0 = none
+uint16_t coinCreditsPending[COINS_NUMBER_OF] = {0}; //credits not sent as keys yet
+
+//audit counters, read with the COMMAND_READ_COIN_COUNTERS command
+uint32_t coinsAccepted[COINS_NUMBER_OF] = {0};
+uint32_t coinCredits[COINS_NUMBER_OF] = {0};
+uint16_t coinPulsesRejectedPerCoin[COINS_NUMBER_OF] = {0};
+
+byte coinsReadPins()
+{
+  byte pins = 0;
+  for (byte i = 0; i < COINS_NUMBER_OF; i++) {
+    if (*coinPinRegister[i] & coinPinMask[i]) {
+      pins |= bit(i);
+    }
+  }
+  return pins;
+}
+
+ISR(PCINT0_vect)
+{
+  //other pins on the port may have triggered the interrupt
+  const byte pins = coinsReadPins();
+  if (pins == coinEventsLastPins) {
+    return;
+  }
+  const byte head = coinEventsHead;
+  const byte next = (head + 1) & (COIN_EVENTS_SIZE - 1);
+  if (next == coinEventsTail) {
+    //buffer full. the edge shows up with the next event that makes it in
+    coinEventsOverflows++;
+    return;
+  }
+  coinEventsLastPins = pins;
+  coinEvents[head].time = micros();
+  coinEvents[head].pins = pins;
+  coinEventsHead = next;
+}
+
+void coinsSetupCapture()
+{
+  for (byte i = 0; i < COINS_NUMBER_OF; i++) {
+    coinPinRegister[i] = portInputRegister(digitalPinToPort(PIN_COIN[i]));
+    coinPinMask[i] = digitalPinToBitMask(PIN_COIN[i]);
+  }
+  noInterrupts();
+  coinEventsLastPins = coinsReadPins();
+  for (byte i = 0; i < COINS_NUMBER_OF; i++) {
+    lastCoinPin[i] = bitRead(coinEventsLastPins, i) ? HIGH : LOW;
+    *digitalPinToPCMSK(PIN_COIN[i]) |= bit(digitalPinToPCMSKbit(PIN_COIN[i]));
+    *digitalPinToPCICR(PIN_COIN[i]) |= bit(digitalPinToPCICRbit(PIN_COIN[i]));
+  }
+  interrupts();
+}
+
+//a pulse train is complete. add its credits
+void coinsCountInsert(byte coin, unsigned long time)
+{
+  const uint16_t credits = coinTrainPulses[coin] * COIN_CREDITS_PER_PULSE[coin];
+  coinTrainPulses[coin] = 0;
+  coinsAccepted[coin]++;
+  coinCredits[coin] += credits;
+  coinCreditsPending[coin] = perfClamp((unsigned long)coinCreditsPending[coin] + credits);
+  //the host sends the keys once per event
+  if (bridgeActive()) {
+    for (uint16_t i = 0; i < credits; i++) {
+      bridgeSendEvent(BRIDGE_EVENT_COIN | coin, time);
+    }
+  }
+}
 
 void coinsReadState()
 {
-  //the state must be insert signal on, hold on COIN_INSERT_DURATION, signal off, hold off COIN_INSERT_DURATION -> valid insertion
-  int i = 0;
-  for (; i < COINS_NUMBER_OF; i++) {
-    //check what state the pin is in
-    const byte state = digitalRead(PIN_COIN[i]);
-    //check if the state is the same as before
-    if (state == lastCoinPin[i]) {
-      //state is the same. check what it is
-      if (state == LOW) {
-        //coin insert signal still ON
-        if (currentCoinState[i] == 0) {
-          //coin insert signal was off before. check if enough time has passed to get a proper insert signal
-          if ((millis() - lastCoinStart[i]) >= COIN_INSERT_DURATION) {
-            currentCoinState[i] = 1;
-          }
-        }
+  //a pulse is signal on for COIN_PULSE_DURATION. shorter pulses are ignored as bouncing.
+  //the coin is complete when the signal stays off for COIN_TRAIN_GAP
+  //replay captured edges with their time stamps
+  while (coinEventsTail != coinEventsHead) {
+    const byte tail = coinEventsTail;
+    const unsigned long time = coinEvents[tail].time;
+    const byte pins = coinEvents[tail].pins;
+    coinEventsTail = (tail + 1) & (COIN_EVENTS_SIZE - 1);
+    for (byte i = 0; i < COINS_NUMBER_OF; i++) {
+      const byte state = bitRead(pins, i) ? HIGH : LOW;
+      if (state == lastCoinPin[i]) {
+        continue;
       }
-      else {
-        //coin insert signal still OFF
-        if (currentCoinState[i] == 1) {
-          //coin insert signal was on and now is off. was the off time long enough?
-          if ((millis() - lastCoinStart[i]) >= COIN_INSERT_DURATION) {
-            coinWasInserted[i] = true;
-            currentCoinState[i] = 0;
+      if (state == HIGH) {
+        //signal went off. was it on long enough?
+        if ((time - lastCoinStart[i]) >= COIN_PULSE_DURATION[i] * 1000UL) {
+          if (coinTrainPulses[i] < 0xFF) {
+            coinTrainPulses[i]++;
           }
         }
+        else {
+          coinPulsesRejected++;
+          coinPulsesRejectedPerCoin[i]++;
+        }
       }
-    }
-    else {
-      //state changed. store time
-      lastCoinStart[i] = millis();
+      else if (coinTrainPulses[i] > 0 && (time - lastCoinStart[i]) >= COIN_TRAIN_GAP[i] * 1000UL) {
+        //signal was off long enough before it came on again, so the last coin is done
+        coinsCountInsert(i, time);
+      }
+      lastCoinStart[i] = time;
       lastCoinPin[i] = state;
     }
   }
+  //check if the gap after the last pulse is long enough. edges arriving meanwhile have later time stamps
+  const unsigned long now = micros();
+  for (byte i = 0; i < COINS_NUMBER_OF; i++) {
+    if (coinTrainPulses[i] > 0 && lastCoinPin[i] == HIGH && (long)(now - lastCoinStart[i]) >= (long)(COIN_TRAIN_GAP[i] * 1000UL)) {
+      coinsCountInsert(i, now);
+    }
+  }
+}
+
+void coinsSetReject(bool reject)
+{
+  digitalWrite(PIN_REJECT_COINS, reject ? HIGH : LOW);
+  ledShowRejectCoin(reject);
 }
 
 void coinsDoCommands()
 {
+  //credits are queued one at a time per coin, so a burst of credits doesn't fill the key queue and keep buttons waiting
   int i = 0;
   for (; i < COINS_NUMBER_OF; i++) {
-    if (coinWasInserted[i]) {
-      keyboardSendString(coinInsertedString[i]);
-      coinWasInserted[i] = false;
+    if (coinCreditsPending[i] > 0 && !keyboardIsQueued(BINDING_COIN(i)) && keyboardSendString(BINDING_COIN(i))) {
+      coinCreditsPending[i]--;
+    }
+  }
+}
+
+void coinsResetCounters()
+{
+  for (byte i = 0; i < COINS_NUMBER_OF; i++) {
+    coinsAccepted[i] = 0;
+    coinCredits[i] = 0;
+    coinPulsesRejectedPerCoin[i] = 0;
+  }
+}
+
+//----- config storage -----------------------------------------------------------------------------
+#include <EEPROM.h>
+
+//key bindings and coin rejection are stored in EEPROM, so the device boots configured. changes are kept in RAM until
+//the host sends SAVE_CONFIG. the EEPROM is split into slots that are written in turn to spread the wear, and a save
+//never writes the slot of the newest saved config, so the old config survives a power loss while saving.
+//slot layout: CONFIG_MAGIC, CONFIG_VERSION, BUTTONS_NUMBER_OF, COINS_NUMBER_OF, MACRO_MAX_LENGTH,
+//macro length of every binding (MACRO_BINDINGS_NUMBER_OF bytes), used part of the macro pool, coin rejection on (1),
+//16-bit CRC (LSB first) over all before, sequence number (1).
+//the sequence number is written last. it makes the slot the newest, so a slot is only used once it is complete.
+//bindings saved for a different input layout are not loaded
+//the CRC is CRC-16/CCITT (polynomial 0x1021, start value 0xFFFF), the same as for frames
+#define CONFIG_MAGIC 'M'
+#define CONFIG_VERSION 4
+#define CONFIG_HEADER_SIZE 5
+#define CONFIG_EEPROM_SIZE 1024 //EEPROM bytes of the ATmega32U4
+#define CONFIG_SLOT_SIZE (CONFIG_HEADER_SIZE + MACRO_BINDINGS_NUMBER_OF + MACRO_POOL_SIZE + 4)
+#define CONFIG_SLOTS_NUMBER_OF (CONFIG_EEPROM_SIZE / CONFIG_SLOT_SIZE)
+
+static_assert(CONFIG_SLOTS_NUMBER_OF >= 2, "Two config slots must fit into the EEPROM, so saving can't destroy the saved config.");
+
+bool configChanged = false; //bindings or coin rejection differ from the saved config
+bool configSaveRequested = false; //save with the next configUpdate()
+byte configSlot = CONFIG_SLOTS_NUMBER_OF - 1; //slot of the newest saved config. the next save goes to the slot after it
+byte configSequence = 0xFF; //sequence number of the newest saved config
+int configSaveIndex = -1; //next byte to save. -1 = not saving
+uint16_t configSaveCrc = 0;
+uint16_t configBytesWritten = 0; //EEPROM bytes written since startup
+
+uint16_t crc16Update(uint16_t crc, byte data)
+{
+  crc ^= (uint16_t)data << 8;
+  for (byte i = 0; i < 8; i++) {
+    crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+  }
+  return crc;
+}
+
+int configSlotAddress(byte slot)
+{
+  return slot * CONFIG_SLOT_SIZE;
+}
+
+//size of the stored config. it grows with the keys bound
+int configSize()
+{
+  return CONFIG_HEADER_SIZE + MACRO_BINDINGS_NUMBER_OF + macroUsed() + 4;
+}
+
+//value of byte index of the config being saved, computed from the current bindings
+byte configByte(int index)
+{
+  const byte header[CONFIG_HEADER_SIZE] = {CONFIG_MAGIC, CONFIG_VERSION, BUTTONS_NUMBER_OF, COINS_NUMBER_OF, MACRO_MAX_LENGTH};
+  if (index < CONFIG_HEADER_SIZE) {
+    return header[index];
+  }
+  index -= CONFIG_HEADER_SIZE;
+  if (index < MACRO_BINDINGS_NUMBER_OF) {
+    return macroLength(index);
+  }
+  index -= MACRO_BINDINGS_NUMBER_OF;
+  if (index < macroUsed()) {
+    return macroPool[index];
+  }
+  index -= macroUsed();
+  switch (index) {
+    case 0:
+      return digitalRead(PIN_REJECT_COINS) == HIGH ? 1 : 0;
+    case 1:
+      return lowByte(configSaveCrc);
+    case 2:
+      return highByte(configSaveCrc);
+    default:
+      return configSequence + 1;
+  }
+}
+
+//check if a slot holds a complete config for this layout and get its size and sequence number
+bool configSlotValid(byte slot, int & size, byte & sequence)
+{
+  const int address = configSlotAddress(slot);
+  for (int i = 0; i < CONFIG_HEADER_SIZE; i++) {
+    if (EEPROM.read(address + i) != configByte(i)) {
+      return false;
+    }
+  }
+  int used = 0;
+  for (int i = 0; i < MACRO_BINDINGS_NUMBER_OF; i++) {
+    used += EEPROM.read(address + CONFIG_HEADER_SIZE + i);
+  }
+  if (used > MACRO_POOL_SIZE) {
+    return false;
+  }
+  size = CONFIG_HEADER_SIZE + MACRO_BINDINGS_NUMBER_OF + used + 4;
+  uint16_t crc = 0xFFFF;
+  for (int i = 0; i < size - 3; i++) {
+    crc = crc16Update(crc, EEPROM.read(address + i));
+  }
+  const uint16_t storedCrc = EEPROM.read(address + size - 3) | ((uint16_t)EEPROM.read(address + size - 2) << 8);
+  sequence = EEPROM.read(address + size - 1);
+  return crc == storedCrc;
+}
+
+//load the newest complete config. call after the coin pins are set up
+void configLoad()
+{
+  bool found = false;
+  int size = 0;
+  for (byte slot = 0; slot < CONFIG_SLOTS_NUMBER_OF; slot++) {
+    int slotSize;
+    byte sequence;
+    //sequence numbers wrap around. the newest is ahead of all others
+    if (configSlotValid(slot, slotSize, sequence) && (!found || (int8_t)(sequence - configSequence) > 0)) {
+      found = true;
+      size = slotSize;
+      configSlot = slot;
+      configSequence = sequence;
+    }
+  }
+  if (!found) {
+    return;
+  }
+  const int address = configSlotAddress(configSlot);
+  MacroOffset end = 0;
+  for (int i = 0; i < MACRO_BINDINGS_NUMBER_OF; i++) {
+    end += EEPROM.read(address + CONFIG_HEADER_SIZE + i);
+    macroEnd[i] = end;
+  }
+  for (int i = 0; i < end; i++) {
+    macroPool[i] = EEPROM.read(address + CONFIG_HEADER_SIZE + MACRO_BINDINGS_NUMBER_OF + i);
+  }
+  digitalWrite(PIN_REJECT_COINS, EEPROM.read(address + size - 4) > 0 ? HIGH : LOW);
+}
+
+//call after bindings or coin rejection were changed
+void configSetChanged()
+{
+  configChanged = true;
+  //a save in progress starts over with the new config. the slot being written is not used before it is complete
+  if (configSaveIndex >= 0) {
+    configSaveIndex = -1;
+    configSaveRequested = true;
+  }
+}
+
+//save the current config with the next configUpdate() calls
+void configSave()
+{
+  configSaveRequested = true;
+}
+
+//save the config to the slot after the newest one, one EEPROM byte per call. writing a byte takes ~3.4ms, so we
+//don't block loop() longer. only bytes that differ from what the slot holds are written to spare the EEPROM
+void configUpdate()
+{
+  if (configSaveRequested && configSaveIndex < 0) {
+    configSaveRequested = false;
+    if (configChanged) {
+      configChanged = false;
+      configSaveCrc = 0xFFFF;
+      for (int i = 0; i < configSize() - 3; i++) {
+        configSaveCrc = crc16Update(configSaveCrc, configByte(i));
+      }
+      configSaveIndex = 0;
+    }
+  }
+  if (configSaveIndex < 0) {
+    return;
+  }
+  const byte slot = (configSlot + 1) % CONFIG_SLOTS_NUMBER_OF;
+  while (configSaveIndex < configSize()) {
+    const byte value = configByte(configSaveIndex);
+    const int address = configSlotAddress(slot) + configSaveIndex++;
+    if (EEPROM.read(address) != value) {
+      EEPROM.write(address, value);
+      configBytesWritten++;
+      return;
     }
   }
+  //the sequence number is written. this slot holds the newest config now
+  configSlot = slot;
+  configSequence++;
+  configSaveIndex = -1;
 }
 
 //----- serial commands ----------------------------------------------------------------------------
 
 #define COMMAND_UNKNOWN 0
 #define COMMAND_SET_COIN_REJECT 'R' //set coin rejection to off (0b) or on (> 0b)
-#define COMMAND_SET_BUTTON_SHORT 'S' //set keys sent on short button press. followed by 1 byte button number and KEYS_NUMBER_OF bytes of key codes. unused codes must be 0!
-#define COMMAND_SET_BUTTON_LONG 'L' //set keys sent on short button press. followed by 1 byte button number and KEYS_NUMBER_OF bytes of key codes. unused codes must be 0!
-#define COMMAND_SET_COIN 'C' //set keys sent on coin insertion. followed by 1 byte coin number and KEYS_NUMBER_OF bytes of key codes. unused codes must be 0!
+#define COMMAND_SET_BUTTON_SHORT 'S' //set keys sent on short button press. followed by 1 byte button number and up to MACRO_MAX_LENGTH bytes of key codes and macro steps. keys end at the first 0.
+#define COMMAND_SET_BUTTON_LONG 'L' //set keys sent on short button press. followed by 1 byte button number and up to MACRO_MAX_LENGTH bytes of key codes and macro steps. keys end at the first 0.
+#define COMMAND_SET_COIN 'C' //set keys sent on coin insertion. followed by 1 byte coin number and up to MACRO_MAX_LENGTH bytes of key codes and macro steps. keys end at the first 0.
 #define COMMAND_DUMP_CONFIG 'D' //dump version information and all configured data to serial port after waiting for a short while. for debug purposes.
 #define COMMAND_CHECK_VERSION '?' //send version string to serial port. used by the PC side to find MAMEduino serial port.
+#define COMMAND_SET_BRIDGE 'E' //switch bridge mode off (0b) or on (> 0b). must be repeated within BRIDGE_TIMEOUT to stay on.
+#define COMMAND_READ_CONFIG 'B' //send a binary snapshot of all bindings and the coin rejection state. binary in frames, hex digits otherwise.
+#define COMMAND_READ_TELEMETRY 'T' //send performance counters. followed by 1 byte: reset counters afterwards (> 0b) or not (0b). binary in frames, hex digits otherwise.
+#define COMMAND_READ_COIN_COUNTERS 'M' //send coin audit counters. followed by 1 byte: reset counters afterwards (> 0b) or not (0b). binary in frames, hex digits otherwise.
+#define COMMAND_WRITE_CONFIG 'W' //replace all bindings and the coin rejection state at once. followed by a config image in the snapshot format of READ_CONFIG. frames only.
+#define COMMAND_SAVE_CONFIG 'V' //save bindings and coin rejection to EEPROM, so the device boots with them. saving goes on in the background.
 #define COMMAND_OK "OK\n" //Response sent when a command is detected.
 #define COMMAND_NOK "NK\n" //Response sent when the command or its arguments are not ok.
 #define COMMAND_TERMINATOR 10 //Terminate lines with LF aka '\n'
 
-void clearKeys(byte array[KEYS_NUMBER_OF])
+void commandSetCoinReject(bool reject)
 {
-  for (int i = 0; i < KEYS_NUMBER_OF; i++) {
-    array[i] = 0;
+  if (reject != (digitalRead(PIN_REJECT_COINS) == HIGH)) {
+    coinsSetReject(reject);
+    configSetChanged();
   }
 }
 
-void serialReadKeys(byte array[KEYS_NUMBER_OF])
+//set the keys of a binding. returns false if they are not valid or don't fit into the macro pool
+bool commandSetKeys(byte binding, const byte * keys, byte length)
 {
-  //clear all buttons first
-  clearKeys(array);
-  int i = 0;
-  int key;
-  do {
-    key = Serial.read();
-    if (key != COMMAND_TERMINATOR) {
-      array[i] = key;
-      i++;
-    }
-    //Keyboard.print(" "); Keyboard.print(key);
-  } while ((i < KEYS_NUMBER_OF) && (key != COMMAND_TERMINATOR));
+  if (!macroSet(binding, keys, length)) {
+    return false;
+  }
+  //keys of the old binding that are still queued are not sent anymore
+  keyboardCancelString(binding);
+  configSetChanged();
+  return true;
+}
+
+void serialDumpKeys(Print & out, byte binding)
+{
+  //empty bindings are printed as 0, the code of CLEAR
+  const byte * keys = macroKeys(binding);
+  const byte length = macroLength(binding);
+  if (length == 0) {
+    out.print("0 ");
+  }
+  for (byte i = 0; i < length; i++) {
+    out.print(keys[i]); out.print(' ');
+  }
 }
 
-void serialDumpConfig()
+void serialDumpConfig(Print & out)
 {
-  Serial.println(PROGRAM_VERSION_STRING);
+  out.println(PROGRAM_VERSION_STRING);
   for (int ib = 0; ib < BUTTONS_NUMBER_OF; ib++) {
-    Serial.print("Button #");
-    Serial.print(ib);
-    Serial.print(" short: ");
-    for (int ik = 0; ik < KEYS_NUMBER_OF; ik++) {
-      Serial.print(buttonShortPressedString[ib][ik]); Serial.print(' ');
-    }
-    Serial.print("long: ");
-    for (int ik = 0; ik < KEYS_NUMBER_OF; ik++) {
-      Serial.print(buttonLongPressedString[ib][ik]); Serial.print(' ');
-    }
-    Serial.println();
+    out.print("Button #");
+    out.print(ib);
+    out.print(" short: ");
+    serialDumpKeys(out, BINDING_BUTTON_SHORT(ib));
+    out.print("long: ");
+    serialDumpKeys(out, BINDING_BUTTON_LONG(ib));
+    out.println();
   }
   for (int ic = 0; ic < COINS_NUMBER_OF; ic++) {
-    Serial.print("Coin #");
-    Serial.print(ic);
-    Serial.print(": ");
-    for (int ik = 0; ik < KEYS_NUMBER_OF; ik++) {
-      Serial.print(coinInsertedString[ic][ik]); Serial.print(' ');
-    }
-    Serial.println();
+    out.print("Coin #");
+    out.print(ic);
+    out.print(": ");
+    serialDumpKeys(out, BINDING_COIN(ic));
+    out.println();
   }
-  Serial.print("Coin rejection is ");
+  out.print("Macro pool: ");
+  out.print(macroUsed());
+  out.print(" of ");
+  out.print(MACRO_POOL_SIZE);
+  out.println(" bytes used");
+  out.print("Coin rejection is ");
   if (digitalRead(PIN_REJECT_COINS) == HIGH) {
-    Serial.println("ON");
+    out.println("ON");
   }
   else {
-    Serial.println("OFF");
-  }
-}
-
-void serialReadCommand()
-{
-  static int serialCommand = COMMAND_UNKNOWN;
-  static int serialBytesNeeded = 1;
-  //check if command or data
-  if (Serial.available() >= serialBytesNeeded && serialCommand == COMMAND_UNKNOWN) {
-    //read command byte
-    serialCommand = Serial.read();
-    switch (serialCommand) {
-      case COMMAND_SET_COIN_REJECT:
-        //we expect another byte stating true or false here
-        //Keyboard.print("Coin reject commmand");
-        serialBytesNeeded = 2;
-        break;
-      case COMMAND_SET_BUTTON_SHORT:
-      case COMMAND_SET_BUTTON_LONG:
-      case COMMAND_SET_COIN:
-        //we expect another byte with the button number here and then 1-6 key codes
-        //Keyboard.print("Button/coin command");
-        serialBytesNeeded = 3;
-        break;
-      case COMMAND_DUMP_CONFIG:
-        //flush commands
-        while (Serial.available() > 0) {
-          Serial.read();
-        }
-        //wait for next command
-        serialCommand = COMMAND_UNKNOWN;
-        serialBytesNeeded = 1;
-        //dump configuration
-        serialDumpConfig();
-        //send positive response
-        Serial.print(COMMAND_OK);
-        break;
-      case COMMAND_CHECK_VERSION:
-        //flush commands
-        while (Serial.available() > 0) {
-          Serial.read();
+    out.println("OFF");
+  }
+  noInterrupts();
+  const uint16_t coinEdgesLost = coinEventsOverflows;
+  interrupts();
+  out.print("Coin edges lost: ");
+  out.print(coinEdgesLost);
+  out.print(", pulses rejected: ");
+  out.println(coinPulsesRejected);
+  out.print("Button presses rejected: ");
+  out.println(buttonPressesRejected);
+  out.print("Bindings ");
+  out.print(configChanged || configSaveIndex >= 0 ? "not saved yet" : "saved");
+  out.print(", slot ");
+  out.print(configSlot);
+  out.print(" of ");
+  out.print(CONFIG_SLOTS_NUMBER_OF);
+  out.print(", EEPROM bytes written: ");
+  out.println(configBytesWritten);
+}
+
+//config snapshot format version 2:
+//format version (1 byte), BUTTONS_NUMBER_OF (1), COINS_NUMBER_OF (1), MACRO_MAX_LENGTH (1),
+//for the short press keys of all buttons, then the long press keys, then the coin keys: length (1), keys (length),
+//coin rejection on (1)
+#define CONFIG_SNAPSHOT_FORMAT_VERSION 2
+#define CONFIG_SNAPSHOT_HEADER_SIZE 4
+//largest snapshot, with the whole macro pool used. WRITE_CONFIG takes snapshots up to this size
+#define CONFIG_SNAPSHOT_MAX_SIZE (CONFIG_SNAPSHOT_HEADER_SIZE + MACRO_BINDINGS_NUMBER_OF + MACRO_POOL_SIZE + 1)
+
+void serialPrintConfig(Print & out)
+{
+  out.write(CONFIG_SNAPSHOT_FORMAT_VERSION);
+  out.write(BUTTONS_NUMBER_OF);
+  out.write(COINS_NUMBER_OF);
+  out.write(MACRO_MAX_LENGTH);
+  for (byte i = 0; i < MACRO_BINDINGS_NUMBER_OF; i++) {
+    out.write(macroLength(i));
+    out.write(macroKeys(i), macroLength(i));
+  }
+  out.write(digitalRead(PIN_REJECT_COINS) == HIGH ? 1 : 0);
+}
+
+//replace all bindings and the coin rejection state with a snapshot. the snapshot is checked completely before anything
+//is changed and then swapped in at once, so buttons and coins never see a mix of old and new bindings.
+//returns false if it is for a different layout, has invalid keys or doesn't fit into the macro pool
+bool commandWriteConfig(const byte * snapshot, uint16_t length)
+{
+  if (length < CONFIG_SNAPSHOT_HEADER_SIZE || snapshot[0] != CONFIG_SNAPSHOT_FORMAT_VERSION || snapshot[1] != BUTTONS_NUMBER_OF
+      || snapshot[2] != COINS_NUMBER_OF || snapshot[3] != MACRO_MAX_LENGTH) {
+    return false;
+  }
+  uint16_t index = CONFIG_SNAPSHOT_HEADER_SIZE;
+  uint16_t used = 0;
+  for (byte i = 0; i < MACRO_BINDINGS_NUMBER_OF; i++) {
+    const byte keysLength = index < length ? snapshot[index++] : 0xFF;
+    //0 ends the keys of a binding, so it can't be part of them
+    if (keysLength > MACRO_MAX_LENGTH || (index + keysLength) >= length || memchr(&snapshot[index], 0, keysLength) != NULL || !macroValid(&snapshot[index], keysLength)) {
+      return false;
+    }
+    index += keysLength;
+    used += keysLength;
+  }
+  if (used > MACRO_POOL_SIZE || (index + 1) != length) {
+    return false;
+  }
+  //keys of bindings that change and are still queued are not sent anymore
+  bool changed = false;
+  index = CONFIG_SNAPSHOT_HEADER_SIZE;
+  for (byte i = 0; i < MACRO_BINDINGS_NUMBER_OF; i++) {
+    const byte keysLength = snapshot[index++];
+    if (keysLength != macroLength(i) || memcmp(&snapshot[index], macroKeys(i), keysLength) != 0) {
+      keyboardCancelString(i);
+      changed = true;
+    }
+    index += keysLength;
+  }
+  //swap in the new bindings
+  index = CONFIG_SNAPSHOT_HEADER_SIZE;
+  MacroOffset end = 0;
+  for (byte i = 0; i < MACRO_BINDINGS_NUMBER_OF; i++) {
+    const byte keysLength = snapshot[index++];
+    memcpy(&macroPool[end], &snapshot[index], keysLength);
+    end += keysLength;
+    macroEnd[i] = end;
+    index += keysLength;
+  }
+  if (changed) {
+    configSetChanged();
+  }
+  commandSetCoinReject(snapshot[index] > 0);
+  return true;
+}
+
+//telemetry format version 1, all values LSB first:
+//format version (1 byte), loops (4), loop period min us (2), max us (2), loop period histogram (PERF_HISTOGRAM_SIZE * 2),
+//keyboard total us (4), max us (2), LED show total us (4), max us (2), serial total us (4), max us (2),
+//button presses rejected (2), coin pulses rejected (2), coin edges lost (2), key queue full (2), bad frames (2),
+//serial bytes dropped (2), uptime ms (4)
+#define TELEMETRY_FORMAT_VERSION 1
+
+void printUint16(Print & out, uint16_t value)
+{
+  out.write(lowByte(value));
+  out.write(highByte(value));
+}
+
+void printUint32(Print & out, uint32_t value)
+{
+  printUint16(out, value & 0xFFFF);
+  printUint16(out, value >> 16);
+}
+
+void printPerfTimer(Print & out, const PerfTimer & timer)
+{
+  printUint32(out, timer.total);
+  printUint16(out, timer.max);
+}
+
+void serialPrintTelemetry(Print & out)
+{
+  noInterrupts();
+  const uint16_t coinEdgesLost = coinEventsOverflows;
+  interrupts();
+  out.write(TELEMETRY_FORMAT_VERSION);
+  printUint32(out, perfLoops);
+  printUint16(out, perfLoopMin);
+  printUint16(out, perfLoopMax);
+  for (byte i = 0; i < PERF_HISTOGRAM_SIZE; i++) {
+    printUint16(out, perfLoopHistogram[i]);
+  }
+  printPerfTimer(out, perfKeyboard);
+  printPerfTimer(out, perfLedShow);
+  printPerfTimer(out, perfSerial);
+  printUint16(out, buttonPressesRejected);
+  printUint16(out, coinPulsesRejected);
+  printUint16(out, coinEdgesLost);
+  printUint16(out, perfKeysQueueFull);
+  printUint16(out, perfBadFrames);
+  printUint16(out, perfSerialBytesDropped);
+  printUint32(out, millis());
+}
+
+void perfReset()
+{
+  perfLoops = 0;
+  perfLoopMin = 0xFFFF;
+  perfLoopMax = 0;
+  for (byte i = 0; i < PERF_HISTOGRAM_SIZE; i++) {
+    perfLoopHistogram[i] = 0;
+  }
+  const PerfTimer zero = {0, 0};
+  perfKeyboard = zero;
+  perfLedShow = zero;
+  perfSerial = zero;
+  buttonPressesRejected = 0;
+  coinPulsesRejected = 0;
+  noInterrupts();
+  coinEventsOverflows = 0;
+  interrupts();
+  perfKeysQueueFull = 0;
+  perfBadFrames = 0;
+  perfSerialBytesDropped = 0;
+}
+
+//coin counters format version 1, all values LSB first:
+//format version (1 byte), number of coins (1), for every coin: coins accepted (4), credits (4), pulses rejected (2),
+//credits not sent as keys yet (2)
+#define COIN_COUNTERS_FORMAT_VERSION 1
+
+void serialPrintCoinCounters(Print & out)
+{
+  out.write(COIN_COUNTERS_FORMAT_VERSION);
+  out.write(COINS_NUMBER_OF);
+  for (byte i = 0; i < COINS_NUMBER_OF; i++) {
+    printUint32(out, coinsAccepted[i]);
+    printUint32(out, coinCredits[i]);
+    printUint16(out, coinPulsesRejectedPerCoin[i]);
+    printUint16(out, coinCreditsPending[i]);
+  }
+}
+
+//prints bytes as two hex digits each, so binary data can't be mistaken for a response terminator
+class HexPrint : public Print
+{
+public:
+  size_t write(uint8_t data)
+  {
+    const char digits[] = "0123456789ABCDEF";
+    Serial.write(digits[data >> 4]);
+    Serial.write(digits[data & 0x0F]);
+    return 1;
+  }
+};
+
+//----- framed commands ----------------------------------------------------------------------------
+//Framed commands can be sent instead of the '\n'-terminated commands above. The host may send several frames without waiting for the responses.
+//A frame is: FRAME_START, 16-bit payload length (LSB first), sequence number, payload, 16-bit CRC (LSB first).
+//The CRC is CRC-16/CCITT (polynomial 0x1021, start value 0xFFFF) over length, sequence number and payload.
+//Command frames carry the same command byte and arguments as the commands above, but without terminator.
+//Response frames carry the sequence number of the command frame and a FRAME_STATUS_* byte followed by the response data.
+//The host resends frames whose response got lost. The last frames executed are remembered, so a frame received again is
+//answered again instead of being executed twice. The host keeps at most FRAME_HISTORY_SIZE sequence numbers in flight.
+
+#define FRAME_START 0xA5
+#define FRAME_MAX_PAYLOAD (1 + CONFIG_SNAPSHOT_MAX_SIZE) //maximum payload length of a command frame: WRITE_CONFIG and a snapshot with the whole macro pool used
+#define FRAME_TIMEOUT 100 //time in ms after which an incomplete frame is discarded
+#define FRAME_HISTORY_SIZE 8 //number of frames remembered to detect frames resent by the host. must be a power of two
+#define FRAME_HISTORY_TIMEOUT 1000 //time in ms after which a frame is forgotten. longer than the host resends frames
+#define FRAME_HISTORY_EMPTY 0xFF //status of a history entry that holds no frame
+
+#define FRAME_STATUS_OK 0 //command executed
+#define FRAME_STATUS_NOK 1 //command or its arguments are not ok
+#define FRAME_STATUS_BAD_FRAME 2 //frame was too long or its CRC was wrong
+
+#define FRAME_STATE_IDLE 0
+#define FRAME_STATE_LENGTH_LOW 1
+#define FRAME_STATE_LENGTH_HIGH 2
+#define FRAME_STATE_SEQUENCE 3
+#define FRAME_STATE_PAYLOAD 4
+#define FRAME_STATE_CRC_LOW 5
+#define FRAME_STATE_CRC_HIGH 6
+
+byte frameState = FRAME_STATE_IDLE;
+byte framePayload[FRAME_MAX_PAYLOAD];
+uint16_t frameLength = 0;
+uint16_t frameIndex = 0;
+byte frameSequence = 0;
+uint16_t frameCrc = 0;
+uint16_t frameReceivedCrc = 0;
+unsigned long frameStartTime = 0;
+
+//a frame executed lately, stored at its sequence number modulo FRAME_HISTORY_SIZE
+struct FrameHistoryEntry
+{
+  byte sequence;
+  byte status;
+  uint16_t crc;
+  uint16_t time; //low 16 bits of millis() when it was executed
+};
+FrameHistoryEntry frameHistory[FRAME_HISTORY_SIZE];
+
+//counts bytes printed, so we can send the response length before the response
+class CountingPrint : public Print
+{
+public:
+  uint16_t count = 0;
+  size_t write(uint8_t) { count++; return 1; }
+};
+
+//sends bytes printed to the serial port and updates the frame CRC
+class FramePrint : public Print
+{
+public:
+  uint16_t crc = 0xFFFF;
+  size_t write(uint8_t data) { crc = crc16Update(crc, data); return Serial.write(data); }
+};
+
+//version string, capabilities and input layout: B = buttons, C = coins, K = maximum keys per binding
+void framePrintVersion(Print & out)
+{
+  out.print(PROGRAM_VERSION_STRING PROGRAM_CAPABILITIES " B");
+  out.print(BUTTONS_NUMBER_OF);
+  out.print(" C");
+  out.print(COINS_NUMBER_OF);
+  out.print(" K");
+  out.print(MACRO_MAX_LENGTH);
+}
+
+void frameSendResponse(byte sequence, byte status, void (*printData)(Print &))
+{
+  //get length of response data
+  uint16_t length = 1;
+  if (printData != NULL) {
+    CountingPrint counter;
+    printData(counter);
+    length += counter.count;
+  }
+  //send frame
+  Serial.write(FRAME_START);
+  FramePrint out;
+  out.write(lowByte(length));
+  out.write(highByte(length));
+  out.write(sequence);
+  out.write(status);
+  if (printData != NULL) {
+    printData(out);
+  }
+  const uint16_t crc = out.crc;
+  Serial.write(lowByte(crc));
+  Serial.write(highByte(crc));
+}
+
+//forget all frames, e.g. when the config was changed some other way, so a frame sent again later is executed again
+void frameClearHistory()
+{
+  for (byte i = 0; i < FRAME_HISTORY_SIZE; i++) {
+    frameHistory[i].status = FRAME_HISTORY_EMPTY;
+  }
+}
+
+//returns the entry of the frame received if it was executed lately, else NULL
+FrameHistoryEntry * frameFindInHistory()
+{
+  FrameHistoryEntry & entry = frameHistory[frameSequence & (FRAME_HISTORY_SIZE - 1)];
+  if (entry.status == FRAME_HISTORY_EMPTY || entry.sequence != frameSequence || entry.crc != frameCrc || (uint16_t)((uint16_t)millis() - entry.time) > FRAME_HISTORY_TIMEOUT) {
+    return NULL;
+  }
+  return &entry;
+}
+
+void frameExecuteCommand()
+{
+  byte status = FRAME_STATUS_NOK;
+  void (*printData)(Print &) = NULL;
+  const byte command = frameLength > 0 ? framePayload[0] : COMMAND_UNKNOWN;
+  const byte index = framePayload[1];
+  //checked as 16-bit value, so a frame with too many keys is not cut down to a few keys
+  const uint16_t nrOfKeys = frameLength >= 2 ? frameLength - 2 : 0;
+  switch (command) {
+    case COMMAND_SET_COIN_REJECT:
+      if (frameLength == 2) {
+        commandSetCoinReject(framePayload[1] > 0);
+        status = FRAME_STATUS_OK;
+      }
+      break;
+    case COMMAND_SET_BUTTON_SHORT:
+    case COMMAND_SET_BUTTON_LONG:
+      if (frameLength >= 3 && nrOfKeys <= MACRO_MAX_LENGTH && index < BUTTONS_NUMBER_OF && commandSetKeys(command == COMMAND_SET_BUTTON_SHORT ? BINDING_BUTTON_SHORT(index) : BINDING_BUTTON_LONG(index), &framePayload[2], nrOfKeys)) {
+        status = FRAME_STATUS_OK;
+      }
+      break;
+    case COMMAND_SET_COIN:
+      if (frameLength >= 3 && nrOfKeys <= MACRO_MAX_LENGTH && index < COINS_NUMBER_OF && commandSetKeys(BINDING_COIN(index), &framePayload[2], nrOfKeys)) {
+        status = FRAME_STATUS_OK;
+      }
+      break;
+    case COMMAND_DUMP_CONFIG:
+      printData = serialDumpConfig;
+      status = FRAME_STATUS_OK;
+      break;
+    case COMMAND_CHECK_VERSION:
+      printData = framePrintVersion;
+      status = FRAME_STATUS_OK;
+      break;
+    case COMMAND_SET_BRIDGE:
+      if (frameLength == 2) {
+        bridgeSetMode(framePayload[1] > 0);
+        status = FRAME_STATUS_OK;
+      }
+      break;
+    case COMMAND_READ_CONFIG:
+      printData = serialPrintConfig;
+      status = FRAME_STATUS_OK;
+      break;
+    case COMMAND_READ_TELEMETRY:
+      if (frameLength == 2) {
+        printData = serialPrintTelemetry;
+        status = FRAME_STATUS_OK;
+      }
+      break;
+    case COMMAND_READ_COIN_COUNTERS:
+      if (frameLength == 2) {
+        printData = serialPrintCoinCounters;
+        status = FRAME_STATUS_OK;
+      }
+      break;
+    case COMMAND_SAVE_CONFIG:
+      configSave();
+      status = FRAME_STATUS_OK;
+      break;
+    case COMMAND_WRITE_CONFIG:
+      //the payload buffer is the staging area. the bindings in use only change once the whole frame arrived and its CRC is ok
+      if (commandWriteConfig(&framePayload[1], frameLength - 1)) {
+        status = FRAME_STATUS_OK;
+      }
+      break;
+  }
+  frameSendResponse(frameSequence, status, printData);
+  FrameHistoryEntry & entry = frameHistory[frameSequence & (FRAME_HISTORY_SIZE - 1)];
+  entry.sequence = frameSequence;
+  entry.status = status;
+  entry.crc = frameCrc;
+  entry.time = millis();
+  if (command == COMMAND_READ_TELEMETRY && status == FRAME_STATUS_OK && framePayload[1] > 0) {
+    perfReset();
+  }
+  if (command == COMMAND_READ_COIN_COUNTERS && status == FRAME_STATUS_OK && framePayload[1] > 0) {
+    coinsResetCounters();
+  }
+}
+
+void frameReadByte(byte data)
+{
+  switch (frameState) {
+    case FRAME_STATE_IDLE:
+      if (data == FRAME_START) {
+        frameStartTime = millis();
+        frameCrc = 0xFFFF;
+        frameState = FRAME_STATE_LENGTH_LOW;
+      }
+      return;
+    case FRAME_STATE_LENGTH_LOW:
+      frameLength = data;
+      frameState = FRAME_STATE_LENGTH_HIGH;
+      break;
+    case FRAME_STATE_LENGTH_HIGH:
+      frameLength |= (uint16_t)data << 8;
+      frameState = FRAME_STATE_SEQUENCE;
+      break;
+    case FRAME_STATE_SEQUENCE:
+      frameSequence = data;
+      frameIndex = 0;
+      frameState = frameLength > 0 ? FRAME_STATE_PAYLOAD : FRAME_STATE_CRC_LOW;
+      break;
+    case FRAME_STATE_PAYLOAD:
+      //store what fits. a frame that is too long is answered with FRAME_STATUS_BAD_FRAME
+      if (frameIndex < FRAME_MAX_PAYLOAD) {
+        framePayload[frameIndex] = data;
+      }
+      if (++frameIndex >= frameLength) {
+        frameState = FRAME_STATE_CRC_LOW;
+      }
+      break;
+    case FRAME_STATE_CRC_LOW:
+      frameReceivedCrc = data;
+      frameState = FRAME_STATE_CRC_HIGH;
+      return;
+    case FRAME_STATE_CRC_HIGH:
+      frameReceivedCrc |= (uint16_t)data << 8;
+      frameState = FRAME_STATE_IDLE;
+      if (frameReceivedCrc != frameCrc || frameLength > FRAME_MAX_PAYLOAD) {
+        perfBadFrames++;
+        frameSendResponse(frameSequence, FRAME_STATUS_BAD_FRAME, NULL);
+      }
+      else if (FrameHistoryEntry * entry = frameFindInHistory()) {
+        //sent again, because the response got lost. commands with response data only read, so they are executed again,
+        //but without resetting counters a second time. the host does not resend commands that reset counters
+        const byte command = framePayload[0];
+        if (entry->status == FRAME_STATUS_OK && (command == COMMAND_DUMP_CONFIG || command == COMMAND_CHECK_VERSION || command == COMMAND_READ_CONFIG
+            || command == COMMAND_READ_TELEMETRY || command == COMMAND_READ_COIN_COUNTERS)) {
+          framePayload[1] = 0;
+          frameExecuteCommand();
         }
-        //wait for next command
-        serialCommand = COMMAND_UNKNOWN;
-        serialBytesNeeded = 1;
-        //dump version string
-        Serial.print(PROGRAM_VERSION_STRING);
-        //send positive response
-        Serial.print(COMMAND_OK);
-        break;
-      default:
-        //unknown command. flush port
-        //Keyboard.print("Bad command");
-        while (Serial.available() > 0) {
-          Serial.read();
+        else {
+          frameSendResponse(frameSequence, entry->status, NULL);
         }
-        //read until we find a valid command
-        serialCommand = COMMAND_UNKNOWN;
-        serialBytesNeeded = 1;
-        //invalid command. send negative response
-        Serial.write(COMMAND_NOK);
-        return;
+      }
+      else {
+        frameExecuteCommand();
+      }
+      return;
+  }
+  frameCrc = crc16Update(frameCrc, data);
+}
+
+//----- command parser -----------------------------------------------------------------------------
+//Reads one byte at a time, so several commands can be queued in the serial buffer and are answered in the order they arrived.
+//A command with a fixed number of arguments is executed as soon as they are complete and its terminator is skipped
+//when it arrives. SET_BUTTON_* and SET_COIN keys end at the terminator. Frames are handed to frameReadByte().
+
+#define SERIAL_STATE_COMMAND 0 //waiting for a command byte or FRAME_START
+#define SERIAL_STATE_ARGUMENT 1 //waiting for the argument byte or button/coin number
+#define SERIAL_STATE_KEYS 2 //reading keys up to the terminator
+#define SERIAL_STATE_SKIP 3 //skipping the rest of an unknown command up to the terminator
+
+#define SERIAL_TIMEOUT 100 //time in ms after which an incomplete command is discarded
+#define SERIAL_TIME_BUDGET 1000 //time in us after which reading commands stops for this loop. the rest is read in the next loop
+
+byte serialState = SERIAL_STATE_COMMAND;
+byte serialCommand = COMMAND_UNKNOWN;
+byte serialArgument = 0;
+byte serialKeys[MACRO_MAX_LENGTH];
+byte serialKeysLength = 0;
+bool serialKeysTooLong = false;
+unsigned long serialStartTime = 0;
+
+void serialCountDropped(uint16_t count)
+{
+  perfSerialBytesDropped = perfClamp((unsigned long)perfSerialBytesDropped + count);
+}
+
+void serialExecuteCommand()
+{
+  bool succeeded = true;
+  frameClearHistory();
+  switch (serialCommand) {
+    case COMMAND_SET_COIN_REJECT:
+      commandSetCoinReject(serialArgument > 0);
+      break;
+    case COMMAND_SET_BUTTON_SHORT:
+    case COMMAND_SET_BUTTON_LONG: {
+      const byte button = serialArgument < BUTTONS_NUMBER_OF ? serialArgument : (BUTTONS_NUMBER_OF - 1);
+      succeeded = !serialKeysTooLong && commandSetKeys(COMMAND_SET_BUTTON_SHORT == serialCommand ? BINDING_BUTTON_SHORT(button) : BINDING_BUTTON_LONG(button), serialKeys, serialKeysLength);
+      break;
     }
+    case COMMAND_SET_COIN: {
+      const byte coin = serialArgument < COINS_NUMBER_OF ? serialArgument : (COINS_NUMBER_OF - 1);
+      succeeded = !serialKeysTooLong && commandSetKeys(BINDING_COIN(coin), serialKeys, serialKeysLength);
+      break;
+    }
+    case COMMAND_DUMP_CONFIG:
+      serialDumpConfig(Serial);
+      break;
+    case COMMAND_CHECK_VERSION:
+      //version string, capabilities and input layout
+      framePrintVersion(Serial);
+      break;
+    case COMMAND_READ_CONFIG: {
+      //snapshot as hex digits
+      HexPrint out;
+      serialPrintConfig(out);
+      break;
+    }
+    case COMMAND_READ_TELEMETRY: {
+      HexPrint out;
+      serialPrintTelemetry(out);
+      if (serialArgument > 0) {
+        perfReset();
+      }
+      break;
+    }
+    case COMMAND_READ_COIN_COUNTERS: {
+      HexPrint out;
+      serialPrintCoinCounters(out);
+      if (serialArgument > 0) {
+        coinsResetCounters();
+      }
+      break;
+    }
+    case COMMAND_SET_BRIDGE:
+      bridgeSetMode(serialArgument > 0);
+      break;
+    case COMMAND_SAVE_CONFIG:
+      configSave();
+      break;
   }
-  if (Serial.available() >= serialBytesNeeded && serialCommand != COMMAND_UNKNOWN) {
-    //read data depending on command
-    switch (serialCommand) {
+  //wait for next command
+  serialState = SERIAL_STATE_COMMAND;
+  Serial.print(succeeded ? COMMAND_OK : COMMAND_NOK);
+}
+
+void serialReadByte(byte data)
+{
+  switch (serialState) {
+    case SERIAL_STATE_COMMAND:
+      serialCommand = data;
+      serialStartTime = millis();
+      switch (data) {
+        case COMMAND_TERMINATOR:
+          //terminator of a command that was executed before it arrived
+          return;
         case COMMAND_SET_COIN_REJECT:
-          //we expect another byte stating true or false here
-          if (Serial.read() > 0) {
-            //Keyboard.print(" ON");
-            digitalWrite(PIN_REJECT_COINS, HIGH);
-            ledShowRejectCoin(true);
-          }
-          else {
-            //Keyboard.print(" OFF");
-            digitalWrite(PIN_REJECT_COINS, LOW);
-            ledShowRejectCoin(false);
-          }
-	      //valid command. send positive response
-	      Serial.write(COMMAND_OK);
-          break;
+        case COMMAND_READ_TELEMETRY:
+        case COMMAND_READ_COIN_COUNTERS:
+        case COMMAND_SET_BRIDGE:
         case COMMAND_SET_BUTTON_SHORT:
-        case COMMAND_SET_BUTTON_LONG: {
-          //we expect another byte with the button number here and then 5 key codes
-          int button = Serial.read();
-          if (button < 0) {
-            button = 0;
-          }
-          else if (button > (BUTTONS_NUMBER_OF - 1)) {
-            button = (BUTTONS_NUMBER_OF - 1);
-          }
-          //Keyboard.print(" "); Keyboard.print(button);
-          if (COMMAND_SET_BUTTON_SHORT == serialCommand) {
-            serialReadKeys(buttonShortPressedString[button]);
-          }
-          else if (COMMAND_SET_BUTTON_LONG == serialCommand) {
-            serialReadKeys(buttonLongPressedString[button]);
-          }
-	  //valid command. send positive response
-	  Serial.write(COMMAND_OK);
-          break;
-        }
-        case COMMAND_SET_COIN: {
-          //we expect another byte with the coin number here and then 5 key codes
-          int coin = Serial.read();
-          if (coin < 0) {
-            coin = 0;
-          }
-          else if (coin > (COINS_NUMBER_OF - 1)) {
-            coin = (COINS_NUMBER_OF - 1);
-          }
-          //Keyboard.print(" "); Keyboard.print(coin);
-          serialReadKeys(coinInsertedString[coin]);
-	  //valid command. send positive response
-	  Serial.write(COMMAND_OK);
-          break;
-        }
+        case COMMAND_SET_BUTTON_LONG:
+        case COMMAND_SET_COIN:
+          serialState = SERIAL_STATE_ARGUMENT;
+          return;
+        case COMMAND_DUMP_CONFIG:
+        case COMMAND_CHECK_VERSION:
+        case COMMAND_READ_CONFIG:
+        case COMMAND_SAVE_CONFIG:
+          serialExecuteCommand();
+          return;
+        default:
+          //invalid command. send negative response and ignore the rest of it
+          serialState = SERIAL_STATE_SKIP;
+          Serial.print(COMMAND_NOK);
+          return;
+      }
+    case SERIAL_STATE_ARGUMENT:
+      serialArgument = data;
+      if (serialCommand == COMMAND_SET_BUTTON_SHORT || serialCommand == COMMAND_SET_BUTTON_LONG || serialCommand == COMMAND_SET_COIN) {
+        serialKeysLength = 0;
+        serialKeysTooLong = false;
+        serialState = SERIAL_STATE_KEYS;
+      }
+      else {
+        serialExecuteCommand();
+      }
+      return;
+    case SERIAL_STATE_KEYS:
+      if (data == COMMAND_TERMINATOR) {
+        serialExecuteCommand();
+      }
+      else if (serialKeysLength < MACRO_MAX_LENGTH) {
+        serialKeys[serialKeysLength++] = data;
+      }
+      else {
+        //too many keys. the command fails
+        serialKeysTooLong = true;
+        serialCountDropped(1);
+      }
+      return;
+    case SERIAL_STATE_SKIP:
+      if (data == COMMAND_TERMINATOR) {
+        serialState = SERIAL_STATE_COMMAND;
+      }
+      else {
+        serialCountDropped(1);
+      }
+      return;
+  }
+}
+
+void serialReadCommands()
+{
+  //discard incomplete commands and frames after a while, so we don't hang when the host goes away
+  if (frameState != FRAME_STATE_IDLE && (millis() - frameStartTime) > FRAME_TIMEOUT) {
+    perfBadFrames++;
+    frameState = FRAME_STATE_IDLE;
+  }
+  if (serialState != SERIAL_STATE_COMMAND && (millis() - serialStartTime) > SERIAL_TIMEOUT) {
+    serialCountDropped(serialState == SERIAL_STATE_KEYS ? 2 + serialKeysLength : 1);
+    serialState = SERIAL_STATE_COMMAND;
+  }
+  //read as much as the time budget allows. bytes not read stay in the serial buffer until the next loop
+  const unsigned long start = micros();
+  while (Serial.available() > 0 && (micros() - start) < SERIAL_TIME_BUDGET) {
+    const byte data = Serial.read();
+    if (frameState != FRAME_STATE_IDLE || (serialState == SERIAL_STATE_COMMAND && data == FRAME_START)) {
+      frameReadByte(data);
     }
-    //finished. flush port
-    while (Serial.available() > 0) {
-      Serial.read();
+    else {
+      serialReadByte(data);
     }
-    //wait for next command
-    serialCommand = COMMAND_UNKNOWN;
-    serialBytesNeeded = 1;
   }
 }
 
 //----- main ------------------------------------------------------------------------------------------
 
+bool inputsBusy()
+{
+  //a pulse train not complete yet
+  for (byte i = 0; i < COINS_NUMBER_OF; i++) {
+    if (coinTrainPulses[i] > 0) {
+      return true;
+    }
+  }
+  //coin edges waiting, a coin signal on or buttons bouncing
+  return coinEventsHead != coinEventsTail || coinEventsLastPins != ((1 << COINS_NUMBER_OF) - 1) || (buttonsCount0 | buttonsCount1) != 0;
+}
+
 void setup()
 {
   //setup mainboard I/O pins
@@ -514,23 +1871,33 @@ void setup()
   for (; i < COINS_NUMBER_OF; i++) {
     pinMode(PIN_COIN[i], INPUT_PULLUP);
   }
+  coinsSetupCapture();
+
+  //load key bindings and coin rejection stored in EEPROM, else use the defaults
+  macroSetDefaults();
+  configLoad();
 
   //setup button input pins
   i = 0;
-  for (; i < BUTTONS_NUMBER_OF; i++) {
+  for (; i < PIN_BUTTONS_NUMBER_OF; i++) {
     pinMode(PIN_BUTTON[i], INPUT_PULLUP);
   }
+  buttonsSetupScan();
 
   //setup LED strip
   FastLED.addLeds<WS2812, PIN_LED_STRIP, GRB>(leds, NUM_LEDS);
   FastLED.setCorrection(TypicalLEDStrip);
   FastLED.setDither(DISABLE_DITHER);
   //show coin receptor status with LEDs
-  ledShowRejectCoin(true);
+  ledSetup();
+  ledShowRejectCoin(digitalRead(PIN_REJECT_COINS) == HIGH);
+  ledCycleInteriorColor();
   FastLED.show();
+  ledsDirty = 0;
 
-  //open the serial port
+  //open the serial port. no frames received yet
   Serial.begin(38400);
+  frameClearHistory();
 
   //initialize control over the keyboard
   Keyboard.begin();
@@ -538,15 +1905,24 @@ void setup()
 
 void loop()
 {
+  perfCountLoop();
   //check for incoming commands via serial port
-  serialReadCommand();
+  const unsigned long serialStart = micros();
+  serialReadCommands();
+  perfAdd(perfSerial, serialStart);
   //check buttons and issue commands
   buttonsReadState();
   buttonsDoCommands();
   //read coin states and issue commands
   coinsReadState();
   coinsDoCommands();
-  //do color-cycling of interior color
-  ledCycleInteriorColor();
+  //send queued keys
+  const unsigned long keyboardStart = micros();
+  keyboardUpdate();
+  perfAdd(perfKeyboard, keyboardStart);
+  //do color-cycling of interior color and send changed LEDs
+  ledUpdate();
+  //save changed key bindings
+  configUpdate();
 }
 
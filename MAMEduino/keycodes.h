@@ -0,0 +1,122 @@
+//Key codes used in MAMEduino key bindings. Shared by the Arduino code and the PC code, so keep it plain.
+//Codes 1-127 are ASCII characters, the other codes are those of the Arduino Keyboard library:
+//128-135 are modifiers, 136-251 are HID keyboard usages + 136. The codes above are MAMEduino functions.
+
+#pragma once
+
+//the next key is held down together with the previous one, e.g. LCTRL CHAR_CHORD 'c'
+#define CHAR_CHORD 252
+//the next byte is a HID consumer control usage, e.g. CHAR_MEDIA MEDIA_VOLUME_UP
+#define CHAR_MEDIA 253
+//pulse mainboard reset pin
+#define CHAR_PIN_RESET 254
+//pulse mainboard power pin
+#define CHAR_PIN_POWER 255
+
+//this is where the first hardware function starts
+#define CHAR_HARDWARE_FUNCTION CHAR_PIN_RESET
+
+//macro steps. they use the codes of HID usages 0-2, which are no keys. the next byte is an operand with
+//MACRO_OPERAND set, so it is never 0 or the command terminator
+//wait before the next step. operand: MACRO_OPERAND | time in MACRO_TIME_UNIT ms (1-127)
+#define CHAR_DELAY 0x88
+//hold the next key or pin down for this long instead of 100ms. operand: like CHAR_DELAY
+#define CHAR_HOLD 0x89
+//send the previous step again. operand: MACRO_OPERAND | number of repeats (1-127)
+#define CHAR_REPEAT 0x8A
+
+#define MACRO_OPERAND 0x80
+#define MACRO_TIME_UNIT 20
+
+//HID consumer control usages sent after CHAR_MEDIA
+#define MEDIA_NEXT 0xB5
+#define MEDIA_PREVIOUS 0xB6
+#define MEDIA_STOP 0xB7
+#define MEDIA_PLAY_PAUSE 0xCD
+#define MEDIA_MUTE 0xE2
+#define MEDIA_VOLUME_UP 0xE9
+#define MEDIA_VOLUME_DOWN 0xEA
+
+//names of all keys that can be bound. a code > 255 is CHAR_MEDIA in the high byte and the usage in the low byte.
+//single printable characters are bound by themselves and are not listed.
+//the PC code builds its name lookup tables from this list, so names only need to be added here.
+#define MAMEDUINO_KEYS(KEY) \
+  KEY(CLEAR, 0) \
+  KEY(SPACE, ' ') \
+  KEY(LCTRL, 0x80) \
+  KEY(LSHIFT, 0x81) \
+  KEY(LALT, 0x82) \
+  KEY(LGUI, 0x83) \
+  KEY(RCTRL, 0x84) \
+  KEY(RSHIFT, 0x85) \
+  KEY(RALT, 0x86) \
+  KEY(RGUI, 0x87) \
+  KEY(RETURN, 0xB0) \
+  KEY(ESC, 0xB1) \
+  KEY(BACKSPACE, 0xB2) \
+  KEY(TAB, 0xB3) \
+  KEY(CAPS_LOCK, 0xC1) \
+  KEY(F1, 0xC2) \
+  KEY(F2, 0xC3) \
+  KEY(F3, 0xC4) \
+  KEY(F4, 0xC5) \
+  KEY(F5, 0xC6) \
+  KEY(F6, 0xC7) \
+  KEY(F7, 0xC8) \
+  KEY(F8, 0xC9) \
+  KEY(F9, 0xCA) \
+  KEY(F10, 0xCB) \
+  KEY(F11, 0xCC) \
+  KEY(F12, 0xCD) \
+  KEY(PRINT_SCREEN, 0xCE) \
+  KEY(SCROLL_LOCK, 0xCF) \
+  KEY(PAUSE, 0xD0) \
+  KEY(INSERT, 0xD1) \
+  KEY(HOME, 0xD2) \
+  KEY(PAGEUP, 0xD3) \
+  KEY(DELETE, 0xD4) \
+  KEY(END, 0xD5) \
+  KEY(PAGEDOWN, 0xD6) \
+  KEY(RIGHT, 0xD7) \
+  KEY(LEFT, 0xD8) \
+  KEY(DOWN, 0xD9) \
+  KEY(UP, 0xDA) \
+  KEY(NUM_LOCK, 0xDB) \
+  KEY(KP_SLASH, 0xDC) \
+  KEY(KP_ASTERISK, 0xDD) \
+  KEY(KP_MINUS, 0xDE) \
+  KEY(KP_PLUS, 0xDF) \
+  KEY(KP_ENTER, 0xE0) \
+  KEY(KP_1, 0xE1) \
+  KEY(KP_2, 0xE2) \
+  KEY(KP_3, 0xE3) \
+  KEY(KP_4, 0xE4) \
+  KEY(KP_5, 0xE5) \
+  KEY(KP_6, 0xE6) \
+  KEY(KP_7, 0xE7) \
+  KEY(KP_8, 0xE8) \
+  KEY(KP_9, 0xE9) \
+  KEY(KP_0, 0xEA) \
+  KEY(KP_DOT, 0xEB) \
+  KEY(MENU, 0xED) \
+  KEY(F13, 0xF0) \
+  KEY(F14, 0xF1) \
+  KEY(F15, 0xF2) \
+  KEY(F16, 0xF3) \
+  KEY(F17, 0xF4) \
+  KEY(F18, 0xF5) \
+  KEY(F19, 0xF6) \
+  KEY(F20, 0xF7) \
+  KEY(F21, 0xF8) \
+  KEY(F22, 0xF9) \
+  KEY(F23, 0xFA) \
+  KEY(F24, 0xFB) \
+  KEY(MEDIA_NEXT, (CHAR_MEDIA << 8) | MEDIA_NEXT) \
+  KEY(MEDIA_PREVIOUS, (CHAR_MEDIA << 8) | MEDIA_PREVIOUS) \
+  KEY(MEDIA_STOP, (CHAR_MEDIA << 8) | MEDIA_STOP) \
+  KEY(MEDIA_PLAY_PAUSE, (CHAR_MEDIA << 8) | MEDIA_PLAY_PAUSE) \
+  KEY(MEDIA_MUTE, (CHAR_MEDIA << 8) | MEDIA_MUTE) \
+  KEY(MEDIA_VOLUME_UP, (CHAR_MEDIA << 8) | MEDIA_VOLUME_UP) \
+  KEY(MEDIA_VOLUME_DOWN, (CHAR_MEDIA << 8) | MEDIA_VOLUME_DOWN) \
+  KEY(PIN_RESET, CHAR_PIN_RESET) \
+  KEY(PIN_POWER, CHAR_PIN_POWER)
@@ -0,0 +1,62 @@
+//Input layout of the cabinet. The Arduino code is built for it and the PC code uses it as default for devices
+//that don't report their layout. Change the LAYOUT_* numbers here or define them when compiling.
+
+#pragma once
+
+#include <stdint.h>
+
+//buttons on Arduino pins. their pins are listed in PIN_BUTTON in MAMEduino.ino
+#ifndef LAYOUT_PIN_BUTTONS
+#define LAYOUT_PIN_BUTTONS 5
+#endif
+//chained 74HC165 shift registers read over SPI. every register adds 8 buttons after the pin buttons
+#ifndef LAYOUT_SHIFT_REGISTERS
+#define LAYOUT_SHIFT_REGISTERS 0
+#endif
+//coin inputs. their pins are listed in PIN_COIN in MAMEduino.ino and must all be on port B
+#ifndef LAYOUT_COINS
+#define LAYOUT_COINS 3
+#endif
+//maximum key bytes per button or coin binding. bindings only use the bytes they need, see LAYOUT_MACRO_POOL
+#ifndef LAYOUT_KEYS
+#define LAYOUT_KEYS 24
+#endif
+//bytes shared by the keys of all bindings
+#ifndef LAYOUT_MACRO_POOL
+#define LAYOUT_MACRO_POOL 96
+#endif
+
+//button masks have one bit per button, so up to 32 buttons are supported
+#define LAYOUT_MAX_BUTTONS 32
+
+//smallest unsigned type that fits
+template <bool FITS_8, bool FITS_16>
+struct LayoutUintType { typedef uint32_t type; };
+template <bool FITS_16>
+struct LayoutUintType<true, FITS_16> { typedef uint8_t type; };
+template <>
+struct LayoutUintType<false, true> { typedef uint16_t type; };
+
+template <uint8_t PIN_BUTTONS, uint8_t SHIFT_REGISTERS, uint8_t COINS, uint8_t KEYS, uint16_t MACRO_POOL>
+struct InputLayout
+{
+  static const uint8_t pinButtons = PIN_BUTTONS;
+  static const uint8_t shiftRegisters = SHIFT_REGISTERS;
+  static const uint8_t buttons = PIN_BUTTONS + 8 * SHIFT_REGISTERS;
+  static const uint8_t coins = COINS;
+  static const uint8_t keys = KEYS;
+  static const uint16_t macroPool = MACRO_POOL;
+  //short press, long press and coin bindings
+  static const uint8_t bindings = 2 * buttons + coins;
+  //bit i = button i
+  typedef typename LayoutUintType<(buttons <= 8), (buttons <= 16)>::type ButtonMask;
+  //offset into the macro pool
+  typedef typename LayoutUintType<(macroPool <= 255), true>::type MacroOffset;
+
+  static_assert(buttons > 0 && buttons <= LAYOUT_MAX_BUTTONS, "1 to LAYOUT_MAX_BUTTONS buttons are supported.");
+  static_assert(coins > 0 && coins <= 8, "1 to 8 coins are supported.");
+  static_assert(keys > 0 && keys <= macroPool, "Bindings need at least one key and must fit into the macro pool.");
+  static_assert(bindings < 255, "Too many bindings for 8-bit binding numbers.");
+};
+
+typedef InputLayout<LAYOUT_PIN_BUTTONS, LAYOUT_SHIFT_REGISTERS, LAYOUT_COINS, LAYOUT_KEYS, LAYOUT_MACRO_POOL> Layout;
@@ -0,0 +1,409 @@
+//MAMEduino host benchmark. Measures the host <-> device command path against a stand-in device on a pseudo-terminal
+//and writes the results as JSON, so changes to the serial code or the protocol can be compared against a baseline.
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+#include <termios.h>
+#include <pty.h>
+#include <sys/wait.h>
+
+#include "../src/MAMEduino.h"
+#include "../src/consolestyle.h"
+#include "../src/serialport.h"
+#include "../src/framedprotocol.h"
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+bool beVerbose = false; //!<Set to true to display more output.
+
+int iterations = 1000; //!<How often every single-command measurement is repeated.
+int profileIterations = 100; //!<How often the profile and detection measurements are repeated.
+uint8_t nextSequence = 0; //!<Sequence number of the next frame. Kept across measurements like a device handle does.
+std::string outputFileName; //!<Where to write the results. Empty = stdout.
+std::string simulatorPath; //!<Path of mameduino-sim to use as stand-in. Empty = use the built-in stand-in.
+
+std::string portName; //!<Pseudo-terminal name of the stand-in device.
+
+//the built-in stand-in device
+int standInMaster = -1;
+int standInSlave = -1;
+std::atomic<bool> standInRunning(false);
+std::thread standInThread;
+//the simulator stand-in device
+pid_t simulatorPid = -1;
+
+//a profile like the one in setup_keys_and_run_emulator.sh: 5 short, 5 long, 3 coins, coin rejection
+const std::vector<std::vector<uint8_t>> profile = {
+    {'S', 0, 0}, {'S', 1, '1'}, {'S', 2, '2'}, {'S', 3, 177}, {'S', 4, 'p'},
+    {'L', 0, 0}, {'L', 1, 0}, {'L', 2, 0}, {'L', 3, 0}, {'L', 4, 255},
+    {'C', 0, '5'}, {'C', 1, '5', '5'}, {'C', 2, '5', '5', '5', '5'},
+    {'R', 0}
+};
+
+struct Result
+{
+    std::string name; //!<Name of the measurement.
+    std::vector<double> timesMs; //!<Measured times.
+    int failures; //!<Number of failed repetitions.
+};
+std::vector<Result> results;
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+std::string standInResponse(const std::vector<uint8_t> & command, bool & ok)
+{
+    ok = true;
+    switch (command.empty() ? 0 : command.front()) {
+        case '?':
+            return "MAMEduino 0.9.9.3" + FRAMED_PROTOCOL_CAPABILITY;
+        case 'D': {
+            //same size as the firmware dump
+            std::ostringstream dump;
+            dump << "MAMEduino 0.9.9.3\r\n";
+            for (int i = 0; i < 5; ++i) {
+                dump << "Button #" << i << " short: 0 0 0 0 0 0 long: 0 0 0 0 0 0 \r\n";
+            }
+            for (int i = 0; i < 3; ++i) {
+                dump << "Coin #" << i << ": 0 0 0 0 0 0 \r\n";
+            }
+            dump << "Coin rejection is ON\r\n";
+            dump << "Coin edges lost: 0, pulses rejected: 0\r\n";
+            dump << "Button presses rejected: 0\r\n";
+            dump << "Bindings saved, EEPROM bytes written: 0\r\n";
+            return dump.str();
+        }
+        case 'R':
+        case 'S':
+        case 'L':
+        case 'C':
+            ok = command.size() >= 2;
+            return "";
+    }
+    ok = false;
+    return "";
+}
+
+void standInLoop()
+{
+    //answer text and framed commands right away, so we measure only the host side and the pseudo-terminal
+    std::vector<uint8_t> buffer;
+    while (standInRunning) {
+        pollfd pollInfo = {standInMaster, POLLIN, 0};
+        if (poll(&pollInfo, 1, 10) <= 0) {
+            continue;
+        }
+        uint8_t data[256];
+        const ssize_t bytesRead = read(standInMaster, data, sizeof(data));
+        if (bytesRead <= 0) {
+            continue;
+        }
+        buffer.insert(buffer.end(), data, data + bytesRead);
+        while (!buffer.empty()) {
+            std::vector<uint8_t> reply;
+            if (buffer.front() == FRAME_START) {
+                Frame frame;
+                if (!extractFrame(buffer, frame)) {
+                    break;
+                }
+                bool ok;
+                const std::string response = standInResponse(frame.payload, ok);
+                //status byte and response data. sized up front, so the compiler can see the copy stays in bounds
+                std::vector<uint8_t> payload(1 + response.size());
+                payload.front() = ok ? FRAME_STATUS_OK : FRAME_STATUS_NOK;
+                std::copy(response.cbegin(), response.cend(), payload.begin() + 1);
+                reply = buildFrame(frame.sequence, payload);
+            }
+            else {
+                auto terminator = std::find(buffer.begin(), buffer.end(), COMMAND_TERMINATOR);
+                if (terminator == buffer.end()) {
+                    break;
+                }
+                const std::vector<uint8_t> command(buffer.begin(), terminator);
+                buffer.erase(buffer.begin(), terminator + 1);
+                bool ok;
+                std::string response = standInResponse(command, ok);
+                response += ok ? COMMAND_OK : COMMAND_NOK;
+                reply.assign(response.cbegin(), response.cend());
+            }
+            if (write(standInMaster, reply.data(), reply.size()) != static_cast<ssize_t>(reply.size())) {
+                std::cerr << ConsoleStyle(ConsoleStyle::RED) << "Error: Stand-in failed to write!" << ConsoleStyle() << std::endl;
+            }
+        }
+    }
+}
+
+bool startStandIn()
+{
+    if (!simulatorPath.empty()) {
+        //run the simulator as fast as possible and read the pseudo-terminal name from its first output line
+        int outputPipe[2];
+        if (pipe(outputPipe) != 0) {
+            return false;
+        }
+        simulatorPid = fork();
+        if (simulatorPid == 0) {
+            dup2(outputPipe[1], STDOUT_FILENO);
+            close(outputPipe[0]);
+            const int nullHandle = open("/dev/null", O_RDWR);
+            dup2(nullHandle, STDIN_FILENO);
+            execl(simulatorPath.c_str(), simulatorPath.c_str(), "-x", "0", "-o", "/dev/null", static_cast<char *>(nullptr));
+            _exit(127);
+        }
+        close(outputPipe[1]);
+        std::string firstLine;
+        char c;
+        while (read(outputPipe[0], &c, 1) == 1 && c != '\n') {
+            firstLine += c;
+        }
+        close(outputPipe[0]);
+        const size_t nameStart = firstLine.rfind(' ');
+        if (simulatorPid < 0 || nameStart == std::string::npos) {
+            std::cerr << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to start simulator " << simulatorPath << "!" << ConsoleStyle() << std::endl;
+            return false;
+        }
+        portName = firstLine.substr(nameStart + 1);
+        return true;
+    }
+    char name[256];
+    if (openpty(&standInMaster, &standInSlave, name, nullptr, nullptr) != 0) {
+        std::cerr << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to open pseudo-terminal!" << ConsoleStyle() << std::endl;
+        return false;
+    }
+    termios options;
+    tcgetattr(standInSlave, &options);
+    cfmakeraw(&options);
+    tcsetattr(standInSlave, TCSANOW, &options);
+    portName = name;
+    standInRunning = true;
+    standInThread = std::thread(standInLoop);
+    return true;
+}
+
+void stopStandIn()
+{
+    if (simulatorPid > 0) {
+        kill(simulatorPid, SIGTERM);
+        waitpid(simulatorPid, nullptr, 0);
+    }
+    if (standInRunning) {
+        standInRunning = false;
+        standInThread.join();
+        close(standInSlave);
+        close(standInMaster);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+/*!
+Run a measurement a number of times and store the times.
+\param[in] name Name of the measurement.
+\param[in] repetitions How often to run it.
+\param[in] measurement Function doing one repetition. Returns false if it failed.
+*/
+void measure(const std::string & name, int repetitions, std::function<bool()> measurement)
+{
+    Result result = {name, {}, 0};
+    for (int i = 0; i < repetitions; ++i) {
+        const auto startTime = std::chrono::steady_clock::now();
+        const bool succeeded = measurement();
+        const std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now() - startTime;
+        if (succeeded) {
+            result.timesMs.push_back(time.count());
+        }
+        else {
+            result.failures++;
+        }
+    }
+    std::cerr << "  " << std::left << std::setw(28) << name << " " << result.timesMs.size() << " ok, " << result.failures << " failed" << std::endl;
+    results.push_back(result);
+}
+
+bool sendText(const int portHandle, const std::vector<uint8_t> & command, std::string & response)
+{
+    std::vector<uint8_t> data = command;
+    data.push_back(COMMAND_TERMINATOR);
+    return writeToSerialPort(portHandle, data.data(), data.size()) && readResponseFromSerial(portHandle, response) == RESPONSE_OK;
+}
+
+bool sendFramed(const int portHandle, const std::vector<std::vector<uint8_t>> & payloads)
+{
+    std::vector<FramedCommand> commands;
+    for (const auto & payload : payloads) {
+        FramedCommand command;
+        command.payload = payload;
+        commands.push_back(command);
+    }
+    if (!sendFramedCommands(portHandle, commands, nextSequence)) {
+        return false;
+    }
+    for (const auto & command : commands) {
+        if (command.result != RESPONSE_OK) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void runBenchmarks()
+{
+    //open and set up the port
+    measure("open_configure", profileIterations, []() {
+        int portHandle;
+        termios oldOptions;
+        if (!openSerialPort(portHandle, portName, &oldOptions, beVerbose)) {
+            return false;
+        }
+        closeSerialPort(portHandle, &oldOptions);
+        return true;
+    });
+    //version check on a fresh port, like auto-detection does for every candidate
+    measure("probe", profileIterations, []() {
+        std::string versionString;
+        return probeSerialPort(portName, versionString);
+    });
+    //auto-detection with the port in the cache
+    char cacheDirectory[] = "/tmp/mameduino-benchmark-XXXXXX";
+    if (mkdtemp(cacheDirectory) != nullptr) {
+        setenv("XDG_CACHE_HOME", cacheDirectory, 1);
+        const std::string cacheFileName = std::string(cacheDirectory) + "/mameduino.port";
+        std::ofstream(cacheFileName) << portName << std::endl;
+        measure("autodetect_cached", profileIterations, []() {
+            std::string detectedPortName;
+            return detectSerialPort(detectedPortName, beVerbose) && detectedPortName == portName;
+        });
+        unlink(cacheFileName.c_str());
+        rmdir(cacheDirectory);
+    }
+    //commands over an open port
+    int portHandle;
+    termios oldOptions;
+    if (!openSerialPort(portHandle, portName, &oldOptions, beVerbose)) {
+        return;
+    }
+    const std::vector<uint8_t> rejectCommand = {'R', 1};
+    const std::vector<uint8_t> dumpCommand = {'D'};
+    std::string response;
+    measure("command_text", iterations, [&]() { return sendText(portHandle, rejectCommand, response); });
+    measure("command_framed", iterations, [&]() { return sendFramed(portHandle, {rejectCommand}); });
+    measure("profile_text", profileIterations, [&]() {
+        for (const auto & command : profile) {
+            if (!sendText(portHandle, command, response)) {
+                return false;
+            }
+        }
+        return true;
+    });
+    measure("profile_framed", profileIterations, [&]() { return sendFramed(portHandle, profile); });
+    measure("dump_text", profileIterations, [&]() { return sendText(portHandle, dumpCommand, response); });
+    measure("dump_framed", profileIterations, [&]() { return sendFramed(portHandle, {dumpCommand}); });
+    closeSerialPort(portHandle, &oldOptions);
+}
+
+double percentile(const std::vector<double> & sortedTimes, double fraction)
+{
+    if (sortedTimes.empty()) {
+        return 0.0;
+    }
+    const size_t index = static_cast<size_t>(fraction * (sortedTimes.size() - 1) + 0.5);
+    return sortedTimes.at(std::min(index, sortedTimes.size() - 1));
+}
+
+void writeResults(std::ostream & out)
+{
+    out << std::fixed << std::setprecision(4);
+    out << "{" << std::endl;
+    out << "  \"version\": \"" << MAMEDUINO_VERSION_STRING << "\"," << std::endl;
+    out << "  \"device\": \"" << (simulatorPath.empty() ? "stand-in" : "simulator") << "\"," << std::endl;
+    out << "  \"unit\": \"ms\"," << std::endl;
+    out << "  \"results\": [" << std::endl;
+    for (size_t i = 0; i < results.size(); ++i) {
+        std::vector<double> times = results.at(i).timesMs;
+        std::sort(times.begin(), times.end());
+        double sum = 0.0;
+        for (const auto time : times) {
+            sum += time;
+        }
+        out << "    {\"name\": \"" << results.at(i).name << "\", \"count\": " << times.size() << ", \"failures\": " << results.at(i).failures;
+        out << ", \"min\": " << (times.empty() ? 0.0 : times.front()) << ", \"mean\": " << (times.empty() ? 0.0 : sum / times.size());
+        out << ", \"p50\": " << percentile(times, 0.5) << ", \"p99\": " << percentile(times, 0.99) << ", \"max\": " << (times.empty() ? 0.0 : times.back()) << "}";
+        out << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    out << "  ]" << std::endl;
+    out << "}" << std::endl;
+}
+
+void printUsage()
+{
+    std::cerr << "Usage:" << ConsoleStyle(ConsoleStyle::CYAN) << " mameduino-benchmark [-n ITERATIONS] [-p ITERATIONS] [-o FILE] [-s SIMULATOR]" << ConsoleStyle() << std::endl;
+    std::cerr << ConsoleStyle(ConsoleStyle::CYAN) << "-n ITERATIONS" << ConsoleStyle() << " - Repetitions of single-command measurements. Default " << iterations << "." << std::endl;
+    std::cerr << ConsoleStyle(ConsoleStyle::CYAN) << "-p ITERATIONS" << ConsoleStyle() << " - Repetitions of open, detection, profile and dump measurements. Default " << profileIterations << "." << std::endl;
+    std::cerr << ConsoleStyle(ConsoleStyle::CYAN) << "-o FILE" << ConsoleStyle() << " - Write JSON results to FILE instead of stdout." << std::endl;
+    std::cerr << ConsoleStyle(ConsoleStyle::CYAN) << "-s SIMULATOR" << ConsoleStyle() << " - Use the firmware simulator binary instead of the built-in stand-in device." << std::endl;
+}
+
+bool readArguments(int argc, const char * argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string argument = argv[i];
+        const bool hasValue = (i + 1) < argc;
+        if (argument == "-n" && hasValue) {
+            iterations = atoi(argv[++i]);
+        }
+        else if (argument == "-p" && hasValue) {
+            profileIterations = atoi(argv[++i]);
+        }
+        else if (argument == "-o" && hasValue) {
+            outputFileName = argv[++i];
+        }
+        else if (argument == "-s" && hasValue) {
+            simulatorPath = argv[++i];
+        }
+        else if (argument == "-v") {
+            beVerbose = true;
+        }
+        else {
+            return false;
+        }
+    }
+    return iterations > 0 && profileIterations > 0;
+}
+
+int main(int argc, const char * argv[])
+{
+    if (!readArguments(argc, argv)) {
+        printUsage();
+        return -1;
+    }
+    if (!startStandIn()) {
+        return -2;
+    }
+    std::cerr << "Benchmarking against " << (simulatorPath.empty() ? "stand-in" : "simulator") << " device at " << portName << "..." << std::endl;
+    runBenchmarks();
+    stopStandIn();
+    if (outputFileName.empty()) {
+        writeResults(std::cout);
+    }
+    else {
+        std::ofstream outputFile(outputFileName);
+        writeResults(outputFile);
+    }
+    return 0;
+}
@@ -0,0 +1,503 @@
+//MAMEduino trace replay. Sends the host side of a trace recorded with "mameduino --capture" to a device again, at the
+//recorded speed or as fast as possible, and compares the responses and their timing with the recorded ones.
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <iterator>
+#include <chrono>
+#include <cmath>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+#include <termios.h>
+#include <sys/wait.h>
+
+#include "../src/MAMEduino.h"
+#include "../src/consolestyle.h"
+#include "../src/serialport.h"
+#include "../src/framedprotocol.h"
+#include "../src/bridge.h"
+#include "../src/capture.h"
+
+typedef std::chrono::steady_clock Clock;
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+bool beVerbose = false; //!<Set to true to display more output.
+
+double speedFactor = 1.0; //!<How much faster than recorded to replay. 0 = as fast as possible.
+int toleranceMs = 20; //!<How much a response may be later or earlier than recorded.
+int responseTimeMs = 200; //!<How long to wait for a response on top of its recorded time.
+std::string traceFileName; //!<Trace to replay.
+std::string simulatorPath; //!<Path of mameduino-sim to replay against.
+std::string portName; //!<Serial port of the device to replay against.
+
+pid_t simulatorPid = -1;
+
+/*!
+A response, frame or event received from the device.
+*/
+struct Message
+{
+    enum Kind {TEXT, FRAME, EVENT, BROKEN};
+    Kind kind = BROKEN;
+    std::vector<uint8_t> data; //!<All bytes of the message.
+    uint8_t status = 0; //!<Status byte of frames. FRAME_STATUS_OK or FRAME_STATUS_NOK for text responses.
+    uint8_t sequence = 0; //!<Sequence number of frames.
+    double timeMs = 0; //!<When the last byte arrived.
+    size_t writeIndex = 0; //!<Number of the last write before the message.
+};
+
+/*!
+Splits data received from the device into messages.
+*/
+class MessageSplitter
+{
+public:
+    void add(const uint8_t * data, size_t size, double timeMs, size_t writeIndex, std::vector<Message> & messages)
+    {
+        m_buffer.insert(m_buffer.end(), data, data + size);
+        Message message;
+        message.timeMs = timeMs;
+        message.writeIndex = writeIndex;
+        while (split(message)) {
+            messages.push_back(message);
+        }
+    }
+
+    /*!
+    Return the bytes left over at the end as a broken message.
+    */
+    bool finish(double timeMs, size_t writeIndex, Message & message)
+    {
+        if (m_buffer.empty()) {
+            return false;
+        }
+        message.kind = Message::BROKEN;
+        message.data.swap(m_buffer);
+        message.timeMs = timeMs;
+        message.writeIndex = writeIndex;
+        m_buffer.clear();
+        return true;
+    }
+
+private:
+    bool split(Message & message)
+    {
+        if (m_buffer.empty()) {
+            return false;
+        }
+        message.status = 0;
+        message.sequence = 0;
+        size_t size = 0;
+        if (m_buffer.front() == FRAME_START) {
+            //start, length, sequence, payload, CRC
+            if (m_buffer.size() < 3) {
+                return false;
+            }
+            const size_t payloadSize = m_buffer.at(1) | (m_buffer.at(2) << 8);
+            size = payloadSize > FRAME_MAX_RESPONSE ? 1 : 6 + payloadSize;
+            if (m_buffer.size() < size) {
+                return false;
+            }
+            std::vector<uint8_t> frameData(m_buffer.begin(), m_buffer.begin() + size);
+            Frame frame;
+            message.kind = extractFrame(frameData, frame) && !frame.payload.empty() ? Message::FRAME : Message::BROKEN;
+            message.sequence = frame.sequence;
+            message.status = frame.payload.empty() ? 0 : frame.payload.front();
+        }
+        else if (m_buffer.front() == BRIDGE_EVENT_START) {
+            if (m_buffer.size() < BRIDGE_EVENT_SIZE) {
+                return false;
+            }
+            size = BRIDGE_EVENT_SIZE;
+            BridgeEventParser parser;
+            std::vector<BridgeEvent> events;
+            std::string text;
+            parser.parse(std::string(m_buffer.begin(), m_buffer.begin() + size), events, text);
+            message.kind = events.size() == 1 ? Message::EVENT : Message::BROKEN;
+        }
+        else {
+            //text responses end with the OK/NK terminator
+            const std::string text(m_buffer.begin(), m_buffer.end());
+            const size_t okEnd = text.find(COMMAND_OK);
+            const size_t nokEnd = text.find(COMMAND_NOK);
+            const size_t end = std::min(okEnd, nokEnd);
+            if (end == std::string::npos) {
+                return false;
+            }
+            size = end + COMMAND_OK.length();
+            message.kind = Message::TEXT;
+            message.status = end == okEnd ? FRAME_STATUS_OK : FRAME_STATUS_NOK;
+        }
+        message.data.assign(m_buffer.begin(), m_buffer.begin() + size);
+        m_buffer.erase(m_buffer.begin(), m_buffer.begin() + size);
+        return true;
+    }
+
+    std::vector<uint8_t> m_buffer;
+};
+
+struct Write
+{
+    std::vector<uint8_t> data;
+    double timeMs; //!<When it was written in the recording.
+    double replayTimeMs; //!<When it was written in the replay.
+};
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+bool startSimulator()
+{
+    //run the simulator at the replay speed and read the pseudo-terminal name from its first output line
+    int outputPipe[2];
+    if (pipe(outputPipe) != 0) {
+        return false;
+    }
+    std::ostringstream speed;
+    speed << speedFactor;
+    simulatorPid = fork();
+    if (simulatorPid == 0) {
+        dup2(outputPipe[1], STDOUT_FILENO);
+        close(outputPipe[0]);
+        const int nullHandle = open("/dev/null", O_RDWR);
+        dup2(nullHandle, STDIN_FILENO);
+        execl(simulatorPath.c_str(), simulatorPath.c_str(), "-x", speed.str().c_str(), "-o", "/dev/null", static_cast<char *>(nullptr));
+        _exit(127);
+    }
+    close(outputPipe[1]);
+    std::string firstLine;
+    char c;
+    while (read(outputPipe[0], &c, 1) == 1 && c != '\n') {
+        firstLine += c;
+    }
+    close(outputPipe[0]);
+    const size_t nameStart = firstLine.rfind(' ');
+    if (simulatorPid < 0 || nameStart == std::string::npos) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to start simulator " << simulatorPath << "!" << ConsoleStyle() << std::endl;
+        return false;
+    }
+    portName = firstLine.substr(nameStart + 1);
+    return true;
+}
+
+void stopSimulator()
+{
+    if (simulatorPid > 0) {
+        kill(simulatorPid, SIGTERM);
+        waitpid(simulatorPid, nullptr, 0);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+/*!
+Split a trace into the writes and the messages received.
+*/
+void splitTrace(const std::vector<TraceRecord> & records, std::vector<Write> & writes, std::vector<Message> & messages)
+{
+    MessageSplitter splitter;
+    for (const auto & record : records) {
+        const double timeMs = record.timeUs / 1000.0;
+        if (record.direction == TRACE_TO_DEVICE) {
+            writes.push_back({record.data, timeMs, 0.0});
+        }
+        else if (!writes.empty()) {
+            splitter.add(record.data.data(), record.data.size(), timeMs, writes.size() - 1, messages);
+        }
+    }
+    Message rest;
+    if (splitter.finish(records.empty() ? 0.0 : records.back().timeUs / 1000.0, writes.empty() ? 0 : writes.size() - 1, rest)) {
+        messages.push_back(rest);
+    }
+}
+
+size_t countResponses(const std::vector<Message> & messages)
+{
+    return std::count_if(messages.cbegin(), messages.cend(), [](const Message & message) { return message.kind != Message::EVENT; });
+}
+
+/*!
+Read from the device until a number of responses arrived or the deadline has passed.
+\return Returns false if reading failed.
+*/
+bool receiveUntil(const int portHandle, Clock::time_point startTime, Clock::time_point deadline, size_t nrOfResponses, size_t writeIndex, MessageSplitter & splitter, std::vector<Message> & messages)
+{
+    while (countResponses(messages) < nrOfResponses || nrOfResponses == SIZE_MAX) {
+        const auto remainingTime = std::chrono::duration_cast<std::chrono::microseconds>(deadline - Clock::now());
+        if (remainingTime.count() <= 0) {
+            break;
+        }
+        pollfd pollInfo = {portHandle, POLLIN, 0};
+        const int pollResult = poll(&pollInfo, 1, static_cast<int>((remainingTime.count() + 999) / 1000));
+        if (pollResult < 0 && errno != EINTR) {
+            return false;
+        }
+        if (pollResult > 0) {
+            if (pollInfo.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                return false;
+            }
+            uint8_t buffer[256];
+            const ssize_t bytesRead = readFromPort(portHandle, buffer, sizeof(buffer));
+            if (bytesRead < 0 && errno != EAGAIN && errno != EINTR) {
+                return false;
+            }
+            if (bytesRead > 0) {
+                const std::chrono::duration<double, std::milli> timeMs = Clock::now() - startTime;
+                splitter.add(buffer, bytesRead, timeMs.count(), writeIndex, messages);
+            }
+        }
+    }
+    return true;
+}
+
+/*!
+Send the writes to the device at their recorded time divided by speedFactor and receive the messages.
+\return Returns false if the port failed.
+*/
+bool replay(const int portHandle, std::vector<Write> & writes, const std::vector<Message> & recordedMessages, std::vector<Message> & messages)
+{
+    const auto startTime = Clock::now();
+    auto scaledTime = [&](double timeMs) {
+        return startTime + std::chrono::microseconds(static_cast<int64_t>(timeMs * 1000.0 / speedFactor));
+    };
+    MessageSplitter splitter;
+    size_t recordedIndex = 0;
+    size_t nrOfResponses = 0;
+    for (size_t i = 0; i < writes.size(); ++i) {
+        //keep receiving until it is time for the next write
+        if (speedFactor > 0.0 && !receiveUntil(portHandle, startTime, scaledTime(writes.at(i).timeMs), SIZE_MAX, i > 0 ? i - 1 : 0, splitter, messages)) {
+            return false;
+        }
+        if (!writeToPort(portHandle, writes.at(i).data.data(), writes.at(i).data.size())) {
+            return false;
+        }
+        const auto writeTime = Clock::now();
+        writes.at(i).replayTimeMs = std::chrono::duration<double, std::milli>(writeTime - startTime).count();
+        //wait for the responses that arrived before the next write in the recording
+        double lastResponseMs = writes.at(i).timeMs;
+        for (; recordedIndex < recordedMessages.size() && recordedMessages.at(recordedIndex).writeIndex <= i; ++recordedIndex) {
+            if (recordedMessages.at(recordedIndex).kind != Message::EVENT) {
+                nrOfResponses++;
+                lastResponseMs = recordedMessages.at(recordedIndex).timeMs;
+            }
+        }
+        const double waitMs = (lastResponseMs - writes.at(i).timeMs) / (speedFactor > 0.0 ? speedFactor : 1.0) + toleranceMs + responseTimeMs;
+        if (!receiveUntil(portHandle, startTime, writeTime + std::chrono::microseconds(static_cast<int64_t>(waitMs * 1000.0)), nrOfResponses, i, splitter, messages)) {
+            return false;
+        }
+    }
+    //receive what came after the last write in the recording
+    if (speedFactor > 0.0 && !recordedMessages.empty() && !writes.empty()
+        && !receiveUntil(portHandle, startTime, scaledTime(recordedMessages.back().timeMs + toleranceMs), SIZE_MAX, writes.size() - 1, splitter, messages)) {
+        return false;
+    }
+    Message rest;
+    if (splitter.finish(std::chrono::duration<double, std::milli>(Clock::now() - startTime).count(), writes.empty() ? 0 : writes.size() - 1, rest)) {
+        messages.push_back(rest);
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+std::string describeMessage(const Message & message)
+{
+    std::ostringstream description;
+    switch (message.kind) {
+        case Message::TEXT:
+            description << (message.status == FRAME_STATUS_OK ? "OK" : "NK") << " text response";
+            break;
+        case Message::FRAME:
+            description << "frame #" << static_cast<int>(message.sequence) << " status " << static_cast<int>(message.status);
+            break;
+        case Message::EVENT:
+            description << "event";
+            break;
+        case Message::BROKEN:
+            description << "broken data";
+            break;
+    }
+    description << " (" << message.data.size() << " bytes)";
+    return description.str();
+}
+
+std::string printableData(const std::vector<uint8_t> & data)
+{
+    std::ostringstream printable;
+    for (const auto byte : data) {
+        if (byte >= 32 && byte < 127) {
+            printable << static_cast<char>(byte);
+        }
+        else {
+            printable << "\\x" << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(byte) << std::dec;
+        }
+    }
+    return printable.str();
+}
+
+/*!
+Compare the messages of the replay with the recorded ones and print the differences.
+\return Returns 0 if they match, -3 on protocol errors and -4 if only the timing diverged.
+*/
+int compareMessages(const std::vector<Write> & writes, const std::vector<Message> & recordedMessages, const std::vector<Message> & messages)
+{
+    //events depend on the inputs of the device, so they are only counted
+    std::vector<Message> recordedResponses;
+    std::vector<Message> responses;
+    std::copy_if(recordedMessages.cbegin(), recordedMessages.cend(), std::back_inserter(recordedResponses), [](const Message & message) { return message.kind != Message::EVENT; });
+    std::copy_if(messages.cbegin(), messages.cend(), std::back_inserter(responses), [](const Message & message) { return message.kind != Message::EVENT; });
+    size_t protocolErrors = 0;
+    size_t dataDifferences = 0;
+    size_t timingDivergences = 0;
+    double maxDivergenceMs = 0.0;
+    for (size_t i = 0; i < std::max(recordedResponses.size(), responses.size()); ++i) {
+        if (i >= responses.size()) {
+            std::cout << ConsoleStyle(ConsoleStyle::RED) << "Response " << i << ": missing, recorded " << describeMessage(recordedResponses.at(i)) << "." << ConsoleStyle() << std::endl;
+            protocolErrors++;
+            continue;
+        }
+        const Message & response = responses.at(i);
+        if (i >= recordedResponses.size()) {
+            std::cout << ConsoleStyle(ConsoleStyle::RED) << "Response " << i << ": unexpected " << describeMessage(response) << "." << ConsoleStyle() << std::endl;
+            protocolErrors++;
+            continue;
+        }
+        //kind, status and sequence number must match, the data may differ, e.g. in counters
+        const Message & recorded = recordedResponses.at(i);
+        if (response.kind == Message::BROKEN || response.kind != recorded.kind || response.status != recorded.status || response.sequence != recorded.sequence) {
+            std::cout << ConsoleStyle(ConsoleStyle::RED) << "Response " << i << ": " << describeMessage(response) << ", recorded " << describeMessage(recorded) << "." << ConsoleStyle() << std::endl;
+            protocolErrors++;
+            continue;
+        }
+        if (response.data != recorded.data) {
+            dataDifferences++;
+            if (beVerbose) {
+                std::cout << "Response " << i << " data differs:" << std::endl;
+                std::cout << "  recorded: " << printableData(recorded.data) << std::endl;
+                std::cout << "  replayed: " << printableData(response.data) << std::endl;
+            }
+        }
+        //compare the time from the write before the response in the recording
+        const Write & write = writes.at(recorded.writeIndex);
+        const double recordedMs = recorded.timeMs - write.timeMs;
+        const double expectedMs = speedFactor > 0.0 ? recordedMs / speedFactor : recordedMs;
+        const double replayedMs = response.timeMs - write.replayTimeMs;
+        //as fast as possible only later responses count
+        const double divergenceMs = speedFactor > 0.0 ? std::abs(replayedMs - expectedMs) : replayedMs - expectedMs;
+        if (divergenceMs > toleranceMs) {
+            timingDivergences++;
+            maxDivergenceMs = std::max(maxDivergenceMs, divergenceMs);
+            std::cout << ConsoleStyle(ConsoleStyle::YELLOW) << "Response " << i << ": " << describeMessage(response) << " after " << std::fixed << std::setprecision(1)
+                      << replayedMs << "ms, expected " << expectedMs << "ms." << ConsoleStyle() << std::endl;
+        }
+        else if (beVerbose) {
+            std::cout << "Response " << i << ": " << describeMessage(response) << " after " << std::fixed << std::setprecision(1) << replayedMs << "ms, expected " << expectedMs << "ms." << std::endl;
+        }
+    }
+    const size_t recordedEvents = recordedMessages.size() - recordedResponses.size();
+    const size_t events = messages.size() - responses.size();
+    std::cout << "Replayed " << writes.size() << " write(s), received " << responses.size() << " of " << recordedResponses.size() << " response(s)";
+    std::cout << " and " << events << " of " << recordedEvents << " event(s)." << std::endl;
+    std::cout << "Responses with different data: " << dataDifferences << (dataDifferences > 0 && !beVerbose ? " (use -v to show them)" : "") << "." << std::endl;
+    if (timingDivergences > 0) {
+        std::cout << ConsoleStyle(ConsoleStyle::YELLOW) << "Timing divergences: " << timingDivergences << ", up to " << std::fixed << std::setprecision(1) << maxDivergenceMs << "ms." << ConsoleStyle() << std::endl;
+    }
+    if (protocolErrors > 0) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: " << protocolErrors << " protocol error(s)!" << ConsoleStyle() << std::endl;
+        return -3;
+    }
+    if (timingDivergences > 0) {
+        return -4;
+    }
+    std::cout << ConsoleStyle(ConsoleStyle::GREEN) << "Replay matches the trace." << ConsoleStyle() << std::endl;
+    return 0;
+}
+
+void printUsage()
+{
+    std::cout << "Usage:" << ConsoleStyle(ConsoleStyle::CYAN) << " mameduino-replay TRACE (-s SIMULATOR | -p SERIAL_DEVICE) [-x FACTOR] [-j MS] [-v]" << ConsoleStyle() << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-s SIMULATOR" << ConsoleStyle() << " - Replay against the firmware simulator binary, running at the replay speed." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-p SERIAL_DEVICE" << ConsoleStyle() << " - Replay against a device, e.g. /dev/ttyACM0." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-x FACTOR" << ConsoleStyle() << " - Replay FACTOR times faster than recorded. 0 = as fast as possible. Default 1." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-j MS" << ConsoleStyle() << " - How much a response may be later or earlier than recorded. Default " << toleranceMs << "ms." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-v" << ConsoleStyle() << " - Show every response and the data of responses that differ." << std::endl;
+    std::cout << "Returns 0 if the replay matches, -3 on protocol errors and -4 if only the timing diverged." << std::endl;
+}
+
+bool readArguments(int argc, const char * argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string argument = argv[i];
+        const bool hasValue = (i + 1) < argc;
+        if (argument == "-s" && hasValue) {
+            simulatorPath = argv[++i];
+        }
+        else if (argument == "-p" && hasValue) {
+            portName = argv[++i];
+        }
+        else if (argument == "-x" && hasValue) {
+            speedFactor = atof(argv[++i]);
+        }
+        else if (argument == "-j" && hasValue) {
+            toleranceMs = atoi(argv[++i]);
+        }
+        else if (argument == "-v") {
+            beVerbose = true;
+        }
+        else if (traceFileName.empty() && argument.front() != '-') {
+            traceFileName = argument;
+        }
+        else {
+            return false;
+        }
+    }
+    return !traceFileName.empty() && simulatorPath.empty() != portName.empty() && speedFactor >= 0.0 && toleranceMs >= 0;
+}
+
+int main(int argc, const char * argv[])
+{
+    if (!readArguments(argc, argv)) {
+        printUsage();
+        return -1;
+    }
+    std::vector<TraceRecord> records;
+    if (!readTrace(traceFileName, records)) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to read trace " << traceFileName << "!" << ConsoleStyle() << std::endl;
+        return -1;
+    }
+    std::vector<Write> writes;
+    std::vector<Message> recordedMessages;
+    splitTrace(records, writes, recordedMessages);
+    if (beVerbose) {
+        std::cout << "Trace has " << writes.size() << " write(s) and " << recordedMessages.size() << " message(s) over " << std::fixed << std::setprecision(1)
+                  << (records.empty() ? 0.0 : records.back().timeUs / 1000.0) << "ms." << std::endl;
+    }
+    if (!simulatorPath.empty() && !startSimulator()) {
+        return -2;
+    }
+    int portHandle;
+    termios oldOptions;
+    if (!openSerialPort(portHandle, portName, &oldOptions, beVerbose)) {
+        stopSimulator();
+        return -2;
+    }
+    std::vector<Message> messages;
+    const bool portOk = replay(portHandle, writes, recordedMessages, messages);
+    closeSerialPort(portHandle, &oldOptions);
+    stopSimulator();
+    if (!portOk) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Serial port failed during replay!" << ConsoleStyle() << std::endl;
+    }
+    const int result = compareMessages(writes, recordedMessages, messages);
+    return portOk ? result : -3;
+}
@@ -4,42 +4,20 @@
 devicename=-a
 
 #button layout: 0=coin reject, 1=1 player, 2=2 players, 3=red, 4=black
-./mameduino $devicename -s 0 CLEAR
-./mameduino $devicename -s 1 1
-./mameduino $devicename -s 2 2
-./mameduino $devicename -s 3 ESC
-./mameduino $devicename -s 4 p
-./mameduino $devicename -l 0 CLEAR
-./mameduino $devicename -l 1 CLEAR
-./mameduino $devicename -l 2 CLEAR
-./mameduino $devicename -l 3 CLEAR
-./mameduino $devicename -l 4 PIN_POWER
 #coin layout: 0=50ct, 1=1euro, 2=2euro
-./mameduino $devicename -c 0 5
-./mameduino $devicename -c 1 5 5
-./mameduino $devicename -c 2 5 5 5 5
-#turn coin rejection off
-./mameduino $devicename -r off
-wait
+#all commands are sent in one session. you could also put them in a profile file and use "-f FILE"
+./mameduino $devicename \
+    -s 0 CLEAR -s 1 1 -s 2 2 -s 3 ESC -s 4 p \
+    -l 0 CLEAR -l 1 CLEAR -l 2 CLEAR -l 3 CLEAR -l 4 PIN_POWER \
+    -c 0 5 -c 1 5 5 -c 2 5 5 5 5 \
+    -r off
 
 #run emulator
 retroarch -L /bla/libretro/mame078_libretro.so --config /bla/configs/all/retroarch.cfg --appendconfig /bla/configs/mame/retroarch.cfg $1
 
-#turn coin rejection on again
-./mameduino $devicename -r on
-#button layout: 0=coin reject, 1=1 player, 2=2 players, 3=red, 4=black
-./mameduino $devicename -s 0 CLEAR
-./mameduino $devicename -s 1 CLEAR
-./mameduino $devicename -s 2 CLEAR
-./mameduino $devicename -s 3 CLEAR
-./mameduino $devicename -s 4 CLEAR
-./mameduino $devicename -l 0 CLEAR
-./mameduino $devicename -l 1 CLEAR
-./mameduino $devicename -l 2 CLEAR
-./mameduino $devicename -l 3 CLEAR
-./mameduino $devicename -l 4 PIN_POWER
-#coin layout: 0=50ct, 1=1euro, 2=2euro
-./mameduino $devicename -c 0 CLEAR
-./mameduino $devicename -c 1 CLEAR
-./mameduino $devicename -c 2 CLEAR
-wait
+#turn coin rejection on again and reset button and coin layout
+./mameduino $devicename \
+    -r on \
+    -s 0 CLEAR -s 1 CLEAR -s 2 CLEAR -s 3 CLEAR -s 4 CLEAR \
+    -l 0 CLEAR -l 1 CLEAR -l 2 CLEAR -l 3 CLEAR -l 4 PIN_POWER \
+    -c 0 CLEAR -c 1 CLEAR -c 2 CLEAR
@@ -0,0 +1,517 @@
+#include "Arduino.h"
+#include "Keyboard.h"
+#include "FastLED.h"
+#include "EEPROM.h"
+#include "HID.h"
+#include "SPI.h"
+
+#include "simulator.h"
+#include "../src/keytable.h"
+
+#include <stdio.h>
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+#define SIM_SERIAL_WRITE_US 10 //!<Virtual time a byte written to the serial port takes.
+#define SIM_DIGITAL_IO_US 4 //!<Virtual time digitalRead / digitalWrite take. They are slow on the AVR.
+#define SIM_LED_SHOW_US_PER_LED 30 //!<Virtual time FastLED.show() takes per WS2812 LED. Interrupts are off meanwhile.
+#define SIM_EEPROM_WRITE_US 3400 //!<Virtual time writing an EEPROM byte takes.
+#define SIM_SPI_TRANSFER_US 2 //!<Virtual time an SPI byte transfer takes, incl. loop overhead.
+
+struct PinState
+{
+    uint8_t mode; //!<INPUT, OUTPUT or INPUT_PULLUP.
+    uint8_t outputValue; //!<Value written with digitalWrite.
+    int inputLevel; //!<Level driven from the outside or SIM_PIN_FLOATING.
+};
+PinState pins[NUM_DIGITAL_PINS];
+int shiftRegisterInputs[SIM_SHIFT_REGISTER_INPUTS]; //!<Levels driven on the shift register inputs or SIM_PIN_FLOATING.
+uint32_t shiftRegisterLatch = 0; //!<Input levels latched by the last load pulse, bit i = input i.
+uint8_t shiftRegisterNext = 0; //!<Register the next SPI transfer reads.
+
+uint8_t serialBuffer[SIM_SERIAL_BUFFER_SIZE]; //!<Serial receive ring buffer.
+size_t serialBufferStart = 0; //!<Index of the first byte in serialBuffer.
+size_t serialBufferCount = 0; //!<Number of bytes in serialBuffer.
+
+volatile uint8_t PINB = 0;
+volatile uint8_t PINC = 0;
+volatile uint8_t PIND = 0;
+volatile uint8_t PINE = 0;
+volatile uint8_t PINF = 0;
+volatile uint8_t PCICR = 0;
+volatile uint8_t PCIFR = 0;
+volatile uint8_t PCMSK0 = 0;
+
+bool interruptsEnabled = true; //!<False between noInterrupts() and interrupts() and while an interrupt is being served.
+
+//Leonardo digital pin to port and bit. Pins 0-13 are the digital header, 14-17 MISO, SCK, MOSI, RX LED, 18-23 A0-A5
+const uint8_t pinPort[] = {PD, PD, PD, PD, PD, PC, PD, PE, PB, PB, PB, PB, PD, PC, PB, PB, PB, PB, PF, PF, PF, PF, PF, PF};
+const uint8_t pinBit[] = {2, 3, 1, 0, 4, 6, 7, 6, 4, 5, 6, 7, 6, 7, 3, 1, 2, 0, 7, 6, 5, 4, 1, 0};
+const uint8_t nrOfMappedPins = sizeof(pinPort) / sizeof(pinPort[0]);
+
+uint8_t eepromData[SIM_EEPROM_SIZE]; //!<EEPROM contents.
+
+Serial_ Serial;
+Keyboard_ Keyboard;
+CFastLED FastLED;
+EEPROMClass EEPROM;
+SPIClass SPI;
+
+//----- time -----------------------------------------------------------------------------------------
+
+unsigned long millis()
+{
+    return static_cast<unsigned long>(simGetMicros() / 1000);
+}
+
+unsigned long micros()
+{
+    return static_cast<unsigned long>(simGetMicros());
+}
+
+void delay(unsigned long ms)
+{
+    simAdvance(static_cast<uint64_t>(ms) * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    simAdvance(us);
+}
+
+//----- digital I/O -----------------------------------------------------------------------------------
+
+int pinLevel(uint8_t pin)
+{
+    const PinState & state = pins[pin];
+    if (state.inputLevel != SIM_PIN_FLOATING) {
+        return state.inputLevel;
+    }
+    //floating inputs read as LOW unless the pull-up is on
+    return state.outputValue;
+}
+
+//weak, so sketches without pin change interrupt handler link
+extern "C" void __attribute__((weak)) simPcint0Vector()
+{
+}
+
+void servePendingInterrupts()
+{
+    if (interruptsEnabled && (PCIFR & bit(PCIF0))) {
+        PCIFR &= ~bit(PCIF0);
+        interruptsEnabled = false;
+        simPcint0Vector();
+        interruptsEnabled = true;
+    }
+}
+
+/*!
+Update the port input registers from the pin levels. Raises a pin change interrupt
+if an enabled pin on port B changed. It is served right away, or when interrupts are enabled again.
+*/
+void updatePorts()
+{
+    const uint8_t oldPinB = PINB;
+    uint8_t ports[PF + 1] = {0};
+    for (uint8_t pin = 0; pin < nrOfMappedPins; ++pin) {
+        if (pinLevel(pin) == HIGH) {
+            ports[pinPort[pin]] |= bit(pinBit[pin]);
+        }
+    }
+    PINB = ports[PB];
+    PINC = ports[PC];
+    PIND = ports[PD];
+    PINE = ports[PE];
+    PINF = ports[PF];
+    if (((oldPinB ^ PINB) & PCMSK0) && (PCICR & bit(PCIE0))) {
+        PCIFR |= bit(PCIF0);
+        servePendingInterrupts();
+    }
+}
+
+uint8_t simPinToPort(uint8_t pin)
+{
+    return pin < nrOfMappedPins ? pinPort[pin] : NOT_A_PORT;
+}
+
+uint8_t simPinToBitMask(uint8_t pin)
+{
+    return pin < nrOfMappedPins ? bit(pinBit[pin]) : 0;
+}
+
+volatile uint8_t * simPortInputRegister(uint8_t port)
+{
+    switch (port) {
+        case PB: return &PINB;
+        case PC: return &PINC;
+        case PD: return &PIND;
+        case PE: return &PINE;
+        case PF: return &PINF;
+    }
+    return nullptr;
+}
+
+int simPinToPcint(uint8_t pin)
+{
+    //on the ATmega32U4 only port B has pin change interrupts, PCINT0-7
+    return (pin < nrOfMappedPins && pinPort[pin] == PB) ? pinBit[pin] : -1;
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    if (pin < NUM_DIGITAL_PINS) {
+        pins[pin].mode = mode;
+        //like on the AVR, the output latch enables the pull-up on inputs
+        if (mode == INPUT_PULLUP) {
+            pins[pin].outputValue = HIGH;
+        }
+        else if (mode == INPUT) {
+            pins[pin].outputValue = LOW;
+        }
+        updatePorts();
+    }
+}
+
+/*!
+The 74HC165 latches its inputs while the load pin is LOW. Inputs have pull-ups, so floating inputs read HIGH.
+*/
+void shiftRegisterLoad(uint8_t oldValue, uint8_t newValue)
+{
+    if (oldValue == HIGH && newValue == LOW) {
+        shiftRegisterLatch = 0;
+        for (int i = 0; i < SIM_SHIFT_REGISTER_INPUTS; ++i) {
+            if (shiftRegisterInputs[i] != LOW) {
+                shiftRegisterLatch |= 1UL << i;
+            }
+        }
+        shiftRegisterNext = 0;
+    }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    simAdvance(SIM_DIGITAL_IO_US);
+    if (pin < NUM_DIGITAL_PINS) {
+        value = value ? HIGH : LOW;
+        //the shift register load pin toggles on every scan, so it is not logged
+        if (pin == SIM_SHIFT_REGISTER_LOAD_PIN) {
+            shiftRegisterLoad(pins[pin].outputValue, value);
+        }
+        else if (pins[pin].mode == OUTPUT && pins[pin].outputValue != value) {
+            simLog("PIN %d %s", pin, value ? "HIGH" : "LOW");
+        }
+        pins[pin].outputValue = value;
+        updatePorts();
+    }
+}
+
+int digitalRead(uint8_t pin)
+{
+    simAdvance(SIM_DIGITAL_IO_US);
+    if (pin >= NUM_DIGITAL_PINS) {
+        return LOW;
+    }
+    return pinLevel(pin);
+}
+
+void simSetPinInput(uint8_t pin, int level)
+{
+    if (pin >= SIM_SHIFT_REGISTER_PIN && pin < SIM_SHIFT_REGISTER_PIN + SIM_SHIFT_REGISTER_INPUTS) {
+        shiftRegisterInputs[pin - SIM_SHIFT_REGISTER_PIN] = level;
+    }
+    else if (pin < NUM_DIGITAL_PINS) {
+        pins[pin].inputLevel = level;
+        updatePorts();
+    }
+}
+
+struct PinInitializer
+{
+    PinInitializer()
+    {
+        for (int i = 0; i < NUM_DIGITAL_PINS; ++i) {
+            pins[i].mode = INPUT;
+            pins[i].outputValue = LOW;
+            pins[i].inputLevel = SIM_PIN_FLOATING;
+        }
+        for (int i = 0; i < SIM_SHIFT_REGISTER_INPUTS; ++i) {
+            shiftRegisterInputs[i] = SIM_PIN_FLOATING;
+        }
+        memset(eepromData, 0xFF, sizeof(eepromData));
+    }
+} pinInitializer;
+
+//----- SPI -----------------------------------------------------------------------------------------
+
+void SPIClass::begin()
+{
+}
+
+void SPIClass::beginTransaction(SPISettings settings)
+{
+    (void)settings;
+}
+
+uint8_t SPIClass::transfer(uint8_t data)
+{
+    (void)data;
+    simAdvance(SIM_SPI_TRANSFER_US);
+    const uint8_t result = (shiftRegisterLatch >> (8 * shiftRegisterNext)) & 0xFF;
+    shiftRegisterNext = (shiftRegisterNext + 1) % (SIM_SHIFT_REGISTER_INPUTS / 8);
+    return result;
+}
+
+void SPIClass::endTransaction()
+{
+}
+
+//----- interrupts ------------------------------------------------------------------------------------
+
+void interrupts()
+{
+    interruptsEnabled = true;
+    servePendingInterrupts();
+}
+
+void noInterrupts()
+{
+    interruptsEnabled = false;
+}
+
+//----- print ----------------------------------------------------------------------------------------
+
+size_t Print::write(const uint8_t * buffer, size_t size)
+{
+    size_t n = 0;
+    while (size--) {
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+size_t Print::printSigned(long n, int base)
+{
+    if (n < 0 && base == DEC) {
+        return print('-') + printNumber(static_cast<unsigned long>(-n), base);
+    }
+    return printNumber(static_cast<unsigned long>(n), base);
+}
+
+size_t Print::printNumber(unsigned long n, int base)
+{
+    char buffer[8 * sizeof(long) + 1];
+    char * str = &buffer[sizeof(buffer) - 1];
+    *str = '\0';
+    if (base < 2) {
+        base = 10;
+    }
+    do {
+        const char digit = static_cast<char>(n % base);
+        n /= base;
+        *--str = digit < 10 ? digit + '0' : digit + 'A' - 10;
+    } while (n);
+    return write(str);
+}
+
+//----- serial ---------------------------------------------------------------------------------------
+
+void Serial_::begin(unsigned long baud)
+{
+    simLog("SERIAL begin %lu", baud);
+}
+
+int Serial_::available()
+{
+    simReceiveSerial();
+    return static_cast<int>(serialBufferCount);
+}
+
+int Serial_::read()
+{
+    if (available() == 0) {
+        return -1;
+    }
+    const uint8_t data = serialBuffer[serialBufferStart];
+    serialBufferStart = (serialBufferStart + 1) % SIM_SERIAL_BUFFER_SIZE;
+    serialBufferCount--;
+    return data;
+}
+
+int Serial_::peek()
+{
+    if (available() == 0) {
+        return -1;
+    }
+    return serialBuffer[serialBufferStart];
+}
+
+void Serial_::flush()
+{
+}
+
+int Serial_::availableForWrite()
+{
+    return SIM_SERIAL_BUFFER_SIZE;
+}
+
+size_t Serial_::write(uint8_t data)
+{
+    return write(&data, 1);
+}
+
+size_t Serial_::write(const uint8_t * buffer, size_t size)
+{
+    simAdvance(size * SIM_SERIAL_WRITE_US);
+    simSendSerial(buffer, size);
+    return size;
+}
+
+size_t simSerialReceiveSpace()
+{
+    return SIM_SERIAL_BUFFER_SIZE - serialBufferCount;
+}
+
+void simSerialReceive(const uint8_t * data, size_t size)
+{
+    for (size_t i = 0; i < size && serialBufferCount < SIM_SERIAL_BUFFER_SIZE; ++i) {
+        serialBuffer[(serialBufferStart + serialBufferCount) % SIM_SERIAL_BUFFER_SIZE] = data[i];
+        serialBufferCount++;
+    }
+}
+
+//----- keyboard -------------------------------------------------------------------------------------
+
+const char * keyName(uint8_t key)
+{
+    static char name[8];
+    //printable characters are shown as they are, everything else by its name in the key table
+    if (key > ' ' && key < 127) {
+        snprintf(name, sizeof(name), "'%c'", key);
+        return name;
+    }
+    const char * tableName = keyNameFromCode(key);
+    if (tableName != nullptr) {
+        return tableName;
+    }
+    snprintf(name, sizeof(name), "0x%02X", key);
+    return name;
+}
+
+size_t Keyboard_::press(uint8_t key)
+{
+    simLog("KEY press %s", keyName(key));
+    return 1;
+}
+
+size_t Keyboard_::release(uint8_t key)
+{
+    simLog("KEY release %s", keyName(key));
+    return 1;
+}
+
+void Keyboard_::releaseAll()
+{
+    simLog("KEY release all");
+}
+
+size_t Keyboard_::write(uint8_t key)
+{
+    press(key);
+    return release(key);
+}
+
+//----- HID -----------------------------------------------------------------------------------------
+
+HID_ & HID()
+{
+    static HID_ hid;
+    return hid;
+}
+
+int HID_::SendReport(uint8_t id, const void * data, int length)
+{
+    //only media key reports are sent directly
+    const uint8_t usage = length > 0 ? *static_cast<const uint8_t *>(data) : 0;
+    const char * name = keyNameFromCode((CHAR_MEDIA << 8) | usage);
+    if (usage == 0) {
+        simLog("MEDIA release (report %d)", id);
+    }
+    else if (name != nullptr) {
+        simLog("MEDIA press %s (report %d)", name, id);
+    }
+    else {
+        simLog("MEDIA press 0x%02X (report %d)", usage, id);
+    }
+    return length;
+}
+
+//----- LEDs -----------------------------------------------------------------------------------------
+
+void hsv2rgb_rainbow(const CHSV & hsv, CRGB & rgb)
+{
+    //simple six-sector conversion. good enough for the simulator
+    const uint8_t sector = hsv.h / 43;
+    const uint8_t remainder = (hsv.h - sector * 43) * 6;
+    const uint8_t p = (hsv.v * (255 - hsv.s)) >> 8;
+    const uint8_t q = (hsv.v * (255 - ((hsv.s * remainder) >> 8))) >> 8;
+    const uint8_t t = (hsv.v * (255 - ((hsv.s * (255 - remainder)) >> 8))) >> 8;
+    switch (sector) {
+        case 0: rgb = CRGB(hsv.v, t, p); break;
+        case 1: rgb = CRGB(q, hsv.v, p); break;
+        case 2: rgb = CRGB(p, hsv.v, t); break;
+        case 3: rgb = CRGB(p, q, hsv.v); break;
+        case 4: rgb = CRGB(t, p, hsv.v); break;
+        default: rgb = CRGB(hsv.v, p, q); break;
+    }
+}
+
+CRGB::CRGB(const CHSV & hsv)
+{
+    hsv2rgb_rainbow(hsv, *this);
+}
+
+void CFastLED::show()
+{
+    //WS2812 output runs with interrupts off, so nothing else happens meanwhile
+    const bool wereEnabled = interruptsEnabled;
+    interruptsEnabled = false;
+    simAdvance(static_cast<uint64_t>(m_nrOfLeds) * SIM_LED_SHOW_US_PER_LED);
+    interruptsEnabled = wereEnabled;
+    servePendingInterrupts();
+    if (simIsVerbose() && m_leds != nullptr) {
+        simLog("LED show #%02X%02X%02X ... #%02X%02X%02X", m_leds[0].r, m_leds[0].g, m_leds[0].b, m_leds[m_nrOfLeds - 1].r, m_leds[m_nrOfLeds - 1].g, m_leds[m_nrOfLeds - 1].b);
+    }
+}
+
+//----- EEPROM ---------------------------------------------------------------------------------------
+
+uint8_t EEPROMClass::read(int index)
+{
+    return (index >= 0 && index < SIM_EEPROM_SIZE) ? eepromData[index] : 0xFF;
+}
+
+void EEPROMClass::write(int index, uint8_t value)
+{
+    //the AVR waits for the write to finish
+    simAdvance(SIM_EEPROM_WRITE_US);
+    if (index >= 0 && index < SIM_EEPROM_SIZE) {
+        if (simIsVerbose()) {
+            simLog("EEPROM write %d = %d", index, value);
+        }
+        eepromData[index] = value;
+        simEepromWritten();
+    }
+}
+
+void EEPROMClass::update(int index, uint8_t value)
+{
+    if (read(index) != value) {
+        write(index, value);
+    }
+}
+
+uint8_t * simEepromData()
+{
+    return eepromData;
+}
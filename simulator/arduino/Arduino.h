@@ -0,0 +1,148 @@
+#pragma once
+
+//Minimal Arduino core API for building the MAMEduino sketch on the host. See simulator.cpp for the implementation.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef uint16_t word;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+#define lowByte(w) ((uint8_t)((w) & 0xff))
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bit(b) (1UL << (b))
+
+//there is only one address space on the host
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+
+//----- time -----------------------------------------------------------------------------------------
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+//----- digital I/O -----------------------------------------------------------------------------------
+
+#define NUM_DIGITAL_PINS 31
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+//----- interrupts ------------------------------------------------------------------------------------
+
+void interrupts();
+void noInterrupts();
+
+//interrupt service routines are plain functions the simulated core calls when the interrupt fires
+#define ISR(vector) extern "C" void vector()
+#define PCINT0_vect simPcint0Vector
+
+//----- AVR registers ---------------------------------------------------------------------------------
+//Port input and pin change interrupt registers and pin mapping of the ATmega32U4 as on the Leonardo
+
+extern volatile uint8_t PINB;
+extern volatile uint8_t PINC;
+extern volatile uint8_t PIND;
+extern volatile uint8_t PINE;
+extern volatile uint8_t PINF;
+extern volatile uint8_t PCICR;
+extern volatile uint8_t PCIFR;
+extern volatile uint8_t PCMSK0;
+
+#define PCIE0 0
+#define PCIF0 0
+
+#define NOT_A_PIN 0
+#define NOT_A_PORT 0
+#define PB 2
+#define PC 3
+#define PD 4
+#define PE 5
+#define PF 6
+
+uint8_t simPinToPort(uint8_t pin);
+uint8_t simPinToBitMask(uint8_t pin);
+volatile uint8_t * simPortInputRegister(uint8_t port);
+int simPinToPcint(uint8_t pin);
+
+#define digitalPinToPort(P) simPinToPort(P)
+#define digitalPinToBitMask(P) simPinToBitMask(P)
+#define portInputRegister(P) simPortInputRegister(P)
+#define digitalPinToPCICR(P) (simPinToPcint(P) >= 0 ? &PCICR : (volatile uint8_t *)0)
+#define digitalPinToPCICRbit(P) 0
+#define digitalPinToPCMSK(P) (simPinToPcint(P) >= 0 ? &PCMSK0 : (volatile uint8_t *)0)
+#define digitalPinToPCMSKbit(P) simPinToPcint(P)
+
+//----- print and stream -----------------------------------------------------------------------------
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t data) = 0;
+    virtual size_t write(const uint8_t * buffer, size_t size);
+    size_t write(const char * str) { return str == NULL ? 0 : write(reinterpret_cast<const uint8_t *>(str), strlen(str)); }
+
+    size_t print(const char str[]) { return write(str); }
+    size_t print(char c) { return write(static_cast<uint8_t>(c)); }
+    size_t print(unsigned char n, int base = DEC) { return printNumber(n, base); }
+    size_t print(int n, int base = DEC) { return printSigned(n, base); }
+    size_t print(unsigned int n, int base = DEC) { return printNumber(n, base); }
+    size_t print(long n, int base = DEC) { return printSigned(n, base); }
+    size_t print(unsigned long n, int base = DEC) { return printNumber(n, base); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+    template <typename T> size_t println(T value, int base) { size_t n = print(value, base); return n + println(); }
+
+private:
+    size_t printSigned(long n, int base);
+    size_t printNumber(unsigned long n, int base);
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+};
+
+class Serial_ : public Stream
+{
+public:
+    void begin(unsigned long baud);
+    void end() {}
+    int available();
+    int read();
+    int peek();
+    void flush();
+    int availableForWrite();
+    size_t write(uint8_t data);
+    size_t write(const uint8_t * buffer, size_t size);
+    using Print::write;
+    operator bool() { return true; }
+};
+
+extern Serial_ Serial;
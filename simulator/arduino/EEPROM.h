@@ -0,0 +1,18 @@
+#pragma once
+
+//EEPROM library stand-in. Writes take as long as on the AVR and can be kept in a file between runs.
+
+#include "Arduino.h"
+
+#define SIM_EEPROM_SIZE 1024 //!<EEPROM size of the ATmega32U4.
+
+class EEPROMClass
+{
+public:
+    uint8_t read(int index);
+    void write(int index, uint8_t value);
+    void update(int index, uint8_t value);
+    uint16_t length() { return SIM_EEPROM_SIZE; }
+};
+
+extern EEPROMClass EEPROM;
@@ -0,0 +1,47 @@
+#pragma once
+
+//FastLED stand-in. Colors are stored, show() only counts frames.
+
+#include "Arduino.h"
+
+struct CHSV
+{
+    uint8_t h, s, v;
+    CHSV() : h(0), s(0), v(0) {}
+    CHSV(uint8_t hue, uint8_t saturation, uint8_t value) : h(hue), s(saturation), v(value) {}
+};
+
+struct CRGB
+{
+    uint8_t r, g, b;
+    CRGB() : r(0), g(0), b(0) {}
+    CRGB(uint8_t red, uint8_t green, uint8_t blue) : r(red), g(green), b(blue) {}
+    CRGB(const CHSV & hsv);
+    bool operator==(const CRGB & other) const { return r == other.r && g == other.g && b == other.b; }
+    bool operator!=(const CRGB & other) const { return !(*this == other); }
+};
+
+void hsv2rgb_rainbow(const CHSV & hsv, CRGB & rgb);
+
+enum EOrder { RGB, GRB };
+enum LEDColorCorrection { UncorrectedColor = 0xFFFFFF, TypicalLEDStrip = 0xFFB0F0 };
+enum ESPIChipsets { WS2812 };
+#define DISABLE_DITHER 0x00
+#define BINARY_DITHER 0x01
+
+class CFastLED
+{
+public:
+    template <ESPIChipsets CHIPSET, uint8_t DATA_PIN, EOrder RGB_ORDER>
+    CFastLED & addLeds(CRGB * leds, int nrOfLeds) { m_leds = leds; m_nrOfLeds = nrOfLeds; return *this; }
+    void setCorrection(LEDColorCorrection) {}
+    void setDither(uint8_t) {}
+    void setBrightness(uint8_t) {}
+    void show();
+
+private:
+    CRGB * m_leds = nullptr;
+    int m_nrOfLeds = 0;
+};
+
+extern CFastLED FastLED;
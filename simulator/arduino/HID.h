@@ -0,0 +1,23 @@
+#pragma once
+
+//PluggableUSB HID library stand-in. Reports sent directly are logged by the simulator.
+
+#include "Arduino.h"
+
+class HIDSubDescriptor
+{
+public:
+    HIDSubDescriptor(const void * data, uint16_t length) : data(data), length(length) {}
+
+    const void * data;
+    uint16_t length;
+};
+
+class HID_
+{
+public:
+    int AppendDescriptor(HIDSubDescriptor * node) { return node != NULL ? 1 : 0; }
+    int SendReport(uint8_t id, const void * data, int length);
+};
+
+HID_ & HID();
@@ -0,0 +1,31 @@
+#pragma once
+
+//SPI library stand-in. The simulated bus has a chain of 74HC165 shift registers on it, see simSetPinInput()
+//and SIM_SHIFT_REGISTER_LOAD_PIN.
+
+#include "Arduino.h"
+
+#define MSBFIRST 1
+#define LSBFIRST 0
+#define SPI_MODE0 0x00
+
+class SPISettings
+{
+public:
+    SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) : clock(clock), bitOrder(bitOrder), dataMode(dataMode) {}
+
+    uint32_t clock;
+    uint8_t bitOrder;
+    uint8_t dataMode;
+};
+
+class SPIClass
+{
+public:
+    void begin();
+    void beginTransaction(SPISettings settings);
+    uint8_t transfer(uint8_t data);
+    void endTransaction();
+};
+
+extern SPIClass SPI;
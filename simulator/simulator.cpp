@@ -0,0 +1,426 @@
+//MAMEduino firmware simulator. Runs the unchanged MAMEduino sketch on the host against a simulated Arduino core.
+//The serial port of the device is a pseudo-terminal, so the mameduino tools can talk to it like to a real device.
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <termios.h>
+#include <signal.h>
+#include <pty.h>
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "simulator.h"
+#include "../src/MAMEduino.h"
+#include "../src/consolestyle.h"
+
+//the sketch
+void setup();
+void loop();
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+struct ScriptEvent
+{
+    uint64_t timeUs; //!<Virtual time the event happens at.
+    std::string command; //!<Script command line without time.
+};
+
+std::vector<ScriptEvent> scriptEvents; //!<Script events sorted by time.
+size_t nextScriptEvent = 0; //!<Index of the next event to apply.
+
+uint64_t virtualMicros = 0; //!<Virtual time since start in microseconds.
+double speedFactor = 1.0; //!<How much faster than real time the virtual clock runs. 0 = as fast as possible.
+uint64_t loopCostUs = 20; //!<Virtual time one loop() iteration takes in addition to the time spent in the simulated core.
+uint64_t runTimeUs = 0; //!<Stop after this virtual time. 0 = run forever.
+std::chrono::steady_clock::time_point realStartTime; //!<Real time the simulation started.
+
+bool beVerbose = false; //!<Set to true to log serial data and LED updates.
+std::string scriptFileName; //!<Script with timed pin events.
+std::string linkName; //!<Name of a symbolic link to the pseudo-terminal to create.
+std::string eepromFileName; //!<File the EEPROM contents are kept in between runs.
+std::ostream * logStream = &std::cout; //!<Where events are logged to.
+std::ofstream logFile; //!<Log file if one was given.
+
+int ptyMaster = -1; //!<Our side of the pseudo-terminal.
+int ptySlave = -1; //!<Kept open so the pseudo-terminal stays valid while no client has it open.
+std::string ptyName; //!<Device name of the pseudo-terminal clients open.
+std::string stdinBuffer; //!<Live commands read from stdin, not yet complete.
+bool stdinOpen = true; //!<False after stdin was closed.
+
+volatile sig_atomic_t keepRunning = 1; //!<Set to 0 by SIGINT/SIGTERM or the quit command.
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+uint64_t simGetMicros()
+{
+    return virtualMicros;
+}
+
+bool simIsVerbose()
+{
+    return beVerbose;
+}
+
+void simLog(const char * format, ...)
+{
+    char message[256];
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(message, sizeof(message), format, arguments);
+    va_end(arguments);
+    char timeStamp[32];
+    snprintf(timeStamp, sizeof(timeStamp), "[%6llu.%06llu] ", static_cast<unsigned long long>(virtualMicros / 1000000), static_cast<unsigned long long>(virtualMicros % 1000000));
+    *logStream << timeStamp << message << std::endl;
+}
+
+void simSendSerial(const uint8_t * data, size_t size)
+{
+    if (beVerbose) {
+        std::string hex;
+        for (size_t i = 0; i < size; ++i) {
+            char digits[4];
+            snprintf(digits, sizeof(digits), " %02X", data[i]);
+            hex += digits;
+        }
+        simLog("SERIAL tx%s", hex.c_str());
+    }
+    //the master is non-blocking. data nobody reads is dropped, like on the Leonardo
+    if (write(ptyMaster, data, size) < 0 && errno != EAGAIN && errno != EIO) {
+        simLog("SERIAL write failed: %s", strerror(errno));
+    }
+}
+
+void simReceiveSerial()
+{
+    //only take what fits into the receive buffer. the rest waits in the pseudo-terminal, like on the USB bus
+    const size_t space = simSerialReceiveSpace();
+    if (space == 0) {
+        return;
+    }
+    uint8_t buffer[SIM_SERIAL_BUFFER_SIZE];
+    const ssize_t bytesRead = read(ptyMaster, buffer, space);
+    if (bytesRead > 0) {
+        if (beVerbose) {
+            std::string hex;
+            for (ssize_t i = 0; i < bytesRead; ++i) {
+                char digits[4];
+                snprintf(digits, sizeof(digits), " %02X", buffer[i]);
+                hex += digits;
+            }
+            simLog("SERIAL rx%s", hex.c_str());
+        }
+        simSerialReceive(buffer, bytesRead);
+    }
+}
+
+void simEepromWritten()
+{
+    //write the whole file every time, so it is up to date when the simulator is killed
+    if (!eepromFileName.empty()) {
+        std::ofstream file(eepromFileName, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(simEepromData()), SIM_EEPROM_SIZE);
+    }
+}
+
+bool readEepromFile()
+{
+    //a missing file is an erased EEPROM
+    std::ifstream file(eepromFileName, std::ios::binary);
+    if (file.is_open() && !file.read(reinterpret_cast<char *>(simEepromData()), SIM_EEPROM_SIZE)) {
+        std::cerr << ConsoleStyle(ConsoleStyle::RED) << "Error: EEPROM file " << eepromFileName << " must be " << SIM_EEPROM_SIZE << " bytes!" << ConsoleStyle() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+void scheduleEvent(uint64_t timeUs, const std::string & command)
+{
+    ScriptEvent event = {timeUs, command};
+    //keep events sorted, events with the same time in the order they were added
+    auto position = std::upper_bound(scriptEvents.begin() + nextScriptEvent, scriptEvents.end(), event, [](const ScriptEvent & a, const ScriptEvent & b) { return a.timeUs < b.timeUs; });
+    scriptEvents.insert(position, event);
+}
+
+bool parseLevel(const std::string & levelName, int & level)
+{
+    if (levelName == "low") {
+        level = LOW;
+    }
+    else if (levelName == "high") {
+        level = HIGH;
+    }
+    else if (levelName == "float") {
+        level = SIM_PIN_FLOATING;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+/*!
+Execute a script command:
+pin PIN low|high|float - Drive a pin from the outside or stop driving it.
+  Pins from SIM_SHIFT_REGISTER_PIN (100) on are shift register inputs.
+pulse PIN MS - Drive a pin LOW for MS milliseconds, e.g. to press a button or send a coin pulse.
+quit - Stop the simulation.
+*/
+bool executeCommand(const std::string & commandLine)
+{
+    std::istringstream lineStream(commandLine);
+    std::string command;
+    lineStream >> command;
+    if (command == "pin") {
+        int pin;
+        std::string levelName;
+        int level;
+        if (lineStream >> pin >> levelName && parseLevel(levelName, level)) {
+            simLog("INPUT %d %s", pin, levelName.c_str());
+            simSetPinInput(static_cast<uint8_t>(pin), level);
+            return true;
+        }
+    }
+    else if (command == "pulse") {
+        int pin;
+        double durationMs;
+        if (lineStream >> pin >> durationMs) {
+            simLog("INPUT %d low", pin);
+            simSetPinInput(static_cast<uint8_t>(pin), LOW);
+            scheduleEvent(virtualMicros + static_cast<uint64_t>(durationMs * 1000), "pin " + std::to_string(pin) + " float");
+            return true;
+        }
+    }
+    else if (command == "quit") {
+        keepRunning = 0;
+        return true;
+    }
+    std::cerr << ConsoleStyle(ConsoleStyle::RED) << "Error: Bad simulator command \"" << commandLine << "\"!" << ConsoleStyle() << std::endl;
+    return false;
+}
+
+bool readScript(const std::string & fileName)
+{
+    std::ifstream file(fileName);
+    if (!file.is_open()) {
+        std::cerr << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to open script " << fileName << "!" << ConsoleStyle() << std::endl;
+        return false;
+    }
+    //every line is: TIME_MS COMMAND ARGUMENTS. lines starting with '#' are comments
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        std::istringstream lineStream(line);
+        double timeMs;
+        std::string command;
+        if (!(lineStream >> std::ws) || lineStream.peek() == '#' || lineStream.peek() == EOF) {
+            continue;
+        }
+        if (!(lineStream >> timeMs) || !std::getline(lineStream >> std::ws, command)) {
+            std::cerr << ConsoleStyle(ConsoleStyle::RED) << "Error in script " << fileName << ", line " << lineNumber << "." << ConsoleStyle() << std::endl;
+            return false;
+        }
+        scheduleEvent(static_cast<uint64_t>(timeMs * 1000), command);
+    }
+    return true;
+}
+
+void readLiveCommands()
+{
+    //commands on stdin are executed right away
+    char buffer[256];
+    const ssize_t bytesRead = read(STDIN_FILENO, buffer, sizeof(buffer));
+    if (bytesRead == 0) {
+        stdinOpen = false;
+    }
+    else if (bytesRead > 0) {
+        stdinBuffer.append(buffer, bytesRead);
+        size_t lineEnd;
+        while ((lineEnd = stdinBuffer.find('\n')) != std::string::npos) {
+            const std::string line = stdinBuffer.substr(0, lineEnd);
+            stdinBuffer.erase(0, lineEnd + 1);
+            if (line.find_first_not_of(" \t\r") != std::string::npos) {
+                executeCommand(line);
+            }
+        }
+    }
+}
+
+void simAdvance(uint64_t us)
+{
+    const uint64_t targetMicros = virtualMicros + us;
+    //apply script events in this time span at their exact time
+    while (nextScriptEvent < scriptEvents.size() && scriptEvents.at(nextScriptEvent).timeUs <= targetMicros) {
+        const ScriptEvent event = scriptEvents.at(nextScriptEvent++);
+        virtualMicros = std::max(virtualMicros, event.timeUs);
+        executeCommand(event.command);
+    }
+    virtualMicros = targetMicros;
+    if (speedFactor <= 0.0) {
+        return;
+    }
+    //wait until the real clock has caught up, meanwhile handling live commands. don't bother for less than a millisecond
+    const auto realTargetTime = realStartTime + std::chrono::microseconds(static_cast<int64_t>(virtualMicros / speedFactor));
+    while (true) {
+        const auto remainingTime = std::chrono::duration_cast<std::chrono::microseconds>(realTargetTime - std::chrono::steady_clock::now());
+        if (remainingTime.count() < 1000) {
+            break;
+        }
+        pollfd pollInfo = {stdinOpen ? STDIN_FILENO : -1, POLLIN, 0};
+        if (poll(&pollInfo, 1, static_cast<int>(remainingTime.count() / 1000)) > 0) {
+            readLiveCommands();
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+bool openPseudoTerminal()
+{
+    char name[256];
+    if (openpty(&ptyMaster, &ptySlave, name, nullptr, nullptr) != 0) {
+        std::cerr << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to open pseudo-terminal (" << strerror(errno) << ")!" << ConsoleStyle() << std::endl;
+        return false;
+    }
+    ptyName = name;
+    //raw mode, so nothing is echoed or translated until a client sets up the port
+    termios options;
+    tcgetattr(ptySlave, &options);
+    cfmakeraw(&options);
+    tcsetattr(ptySlave, TCSANOW, &options);
+    fcntl(ptyMaster, F_SETFL, fcntl(ptyMaster, F_GETFL) | O_NONBLOCK);
+    if (!linkName.empty()) {
+        unlink(linkName.c_str());
+        if (symlink(name, linkName.c_str()) != 0) {
+            std::cerr << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to create link " << linkName << " (" << strerror(errno) << ")!" << ConsoleStyle() << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void printUsage()
+{
+    std::cout << "Usage:" << ConsoleStyle(ConsoleStyle::CYAN) << " mameduino-sim [OPTIONS]" << ConsoleStyle() << std::endl;
+    std::cout << "Runs the MAMEduino firmware with its serial port on a pseudo-terminal and logs key presses and pin changes." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-s SCRIPT" << ConsoleStyle() << " - Apply timed pin events from SCRIPT. Lines are \"TIME_MS COMMAND\"." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-x FACTOR" << ConsoleStyle() << " - Run the virtual clock FACTOR times faster than real time. 0 = as fast as possible. Default 1." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-t SECONDS" << ConsoleStyle() << " - Stop after SECONDS of virtual time." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-c US" << ConsoleStyle() << " - Virtual time one loop() iteration takes. Default " << loopCostUs << "." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-l LINK" << ConsoleStyle() << " - Create a symbolic link LINK to the pseudo-terminal." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-e FILE" << ConsoleStyle() << " - Keep the EEPROM contents in FILE between runs." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-o FILE" << ConsoleStyle() << " - Write the event log to FILE instead of stdout." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-v" << ConsoleStyle() << " - Also log serial data, LED updates and EEPROM writes." << std::endl;
+    std::cout << "Script and live commands on stdin:" << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "pin PIN low|high|float" << ConsoleStyle() << " - Drive a pin from the outside or release it." << std::endl;
+    std::cout << "  PIN " << SIM_SHIFT_REGISTER_PIN << "+ are the inputs of the shift register chain on the SPI bus." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "pulse PIN MS" << ConsoleStyle() << " - Drive a pin LOW for MS milliseconds, e.g. press a button." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "quit" << ConsoleStyle() << " - Stop the simulation." << std::endl;
+}
+
+bool readArguments(int argc, const char * argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string argument = argv[i];
+        const bool hasValue = (i + 1) < argc;
+        if (argument == "-v") {
+            beVerbose = true;
+        }
+        else if (argument == "-s" && hasValue) {
+            scriptFileName = argv[++i];
+        }
+        else if (argument == "-x" && hasValue) {
+            speedFactor = atof(argv[++i]);
+        }
+        else if (argument == "-t" && hasValue) {
+            runTimeUs = static_cast<uint64_t>(atof(argv[++i]) * 1000000);
+        }
+        else if (argument == "-c" && hasValue) {
+            loopCostUs = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (argument == "-l" && hasValue) {
+            linkName = argv[++i];
+        }
+        else if (argument == "-e" && hasValue) {
+            eepromFileName = argv[++i];
+        }
+        else if (argument == "-o" && hasValue) {
+            logFile.open(argv[++i]);
+            if (!logFile.is_open()) {
+                std::cerr << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to open log file " << argv[i] << "!" << ConsoleStyle() << std::endl;
+                return false;
+            }
+            logStream = &logFile;
+        }
+        else if (argument == "-?" || argument == "-h" || argument == "--help") {
+            printUsage();
+            exit(0);
+        }
+        else {
+            std::cerr << ConsoleStyle(ConsoleStyle::RED) << "Error: Bad argument \"" << argument << "\"!" << ConsoleStyle() << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void signalHandler(int /*signal*/)
+{
+    keepRunning = 0;
+}
+
+int main(int argc, const char * argv[])
+{
+    if (!readArguments(argc, argv)) {
+        printUsage();
+        return -1;
+    }
+    if (!scriptFileName.empty() && !readScript(scriptFileName)) {
+        return -1;
+    }
+    if (!eepromFileName.empty() && !readEepromFile()) {
+        return -1;
+    }
+    if (!openPseudoTerminal()) {
+        return -2;
+    }
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+    fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+    //tell the user where to connect. flush, so scripts can read it right away
+    std::cout << "MAMEduino simulator " << MAMEDUINO_VERSION_STRING << ", serial port " << ptyName << std::endl << std::flush;
+
+    realStartTime = std::chrono::steady_clock::now();
+    setup();
+    while (keepRunning && (runTimeUs == 0 || virtualMicros < runTimeUs)) {
+        loop();
+        simAdvance(loopCostUs);
+        if (stdinOpen && speedFactor <= 0.0) {
+            readLiveCommands();
+        }
+    }
+    simLog("STOP");
+
+    if (!linkName.empty()) {
+        unlink(linkName.c_str());
+    }
+    close(ptySlave);
+    close(ptyMaster);
+    return 0;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+//Interface between the simulated Arduino core (arduino.cpp) and the simulator (simulator.cpp).
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SIM_SERIAL_BUFFER_SIZE 64 //!<Size of the serial receive buffer. Same as for the Leonardo USB CDC serial port.
+#define SIM_PIN_FLOATING -1 //!<Pin is not driven from the outside.
+#define SIM_SHIFT_REGISTER_PIN 100 //!<Pins from here on are the inputs of the shift registers on the SPI bus, 8 per register.
+#define SIM_SHIFT_REGISTER_INPUTS 32 //!<Number of simulated shift register inputs.
+#define SIM_SHIFT_REGISTER_LOAD_PIN 13 //!<Pin driving the parallel load input of the shift registers. Same as PIN_SHIFT_LOAD in the sketch.
+
+//----- implemented in simulator.cpp -------------------------------------------------------------------
+
+/*!
+Current virtual time in microseconds since the simulated device was started.
+*/
+uint64_t simGetMicros();
+
+/*!
+Advance the virtual clock. Script events due in this time are applied, serial data is received,
+and in real-time mode we sleep until the real clock has caught up.
+\param[in] us Number of microseconds to advance.
+*/
+void simAdvance(uint64_t us);
+
+/*!
+Log an event with the current virtual time stamp, printf-style.
+*/
+void simLog(const char * format, ...) __attribute__((format(printf, 1, 2)));
+
+/*!
+Returns true if verbose logging is on.
+*/
+bool simIsVerbose();
+
+/*!
+Pull bytes received on the pseudo-terminal into the serial receive buffer, as long as there is space.
+*/
+void simReceiveSerial();
+
+/*!
+Send bytes to the pseudo-terminal.
+*/
+void simSendSerial(const uint8_t * data, size_t size);
+
+/*!
+Called after an EEPROM byte was written, so the EEPROM file can be updated.
+*/
+void simEepromWritten();
+
+//----- implemented in arduino.cpp ---------------------------------------------------------------------
+
+/*!
+Free space in the serial receive buffer.
+*/
+size_t simSerialReceiveSpace();
+
+/*!
+Put bytes into the serial receive buffer. Must not be more than simSerialReceiveSpace().
+*/
+void simSerialReceive(const uint8_t * data, size_t size);
+
+/*!
+Drive a pin from the outside.
+\param[in] pin Pin number. SIM_SHIFT_REGISTER_PIN + i is input i of the shift register chain.
+\param[in] level HIGH, LOW or SIM_PIN_FLOATING.
+*/
+void simSetPinInput(uint8_t pin, int level);
+
+/*!
+EEPROM contents. SIM_EEPROM_SIZE bytes, erased bytes are 0xFF.
+*/
+uint8_t * simEepromData();
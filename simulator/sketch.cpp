@@ -0,0 +1,5 @@
+//Builds the unchanged MAMEduino sketch against the simulated Arduino core.
+//The Arduino IDE includes Arduino.h automatically, so we do that here.
+
+#include "Arduino.h"
+#include "../MAMEduino/MAMEduino.ino"
@@ -3,98 +3,81 @@
 #include <vector>
 #include <iostream>
 #include <sstream>
+#include <fstream>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <cstring>
+#include <future>
+#include <algorithm>
 
-#include <stdio.h>
-#include <string.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <termios.h>
-#include <errno.h>
+#include <signal.h>
 
 #include "MAMEduino.h"
 #include "consolestyle.h"
+#include "device.h"
+#include "telemetry.h"
+#include "deviceconfig.h"
+#include "bridge.h"
+#include "keytable.h"
 
 //---------------------------------------------------------------------------------------------------------------------------
 
-#define MAX_BUTTON_INDEX 4 //!<button index 0-4 are supported
-#define MAX_COIN_INDEX 2 //!<coin indices 0-2 are supported
-#define MAX_NR_OF_KEYS 6 //!<1-6 keys can be sent per button press or coin insertion
+//the number of buttons, coins and keys per binding are reported by the device. these only limit what is accepted as arguments
+#define MAX_BUTTON_INDEX (LAYOUT_MAX_BUTTONS - 1) //!<button indices are checked against the device layout after connecting
+#define MAX_COIN_INDEX 255 //!<coin indices are checked against the device layout after connecting
 
-enum Command {SET_COIN_REJECT, SET_BUTTON_SHORT, SET_BUTTON_LONG, SET_COIN, DUMP_CONFIG, CHECK_VERSION, BAD_COMMAND};
+enum Command {SET_COIN_REJECT, SET_BUTTON_SHORT, SET_BUTTON_LONG, SET_COIN, DUMP_CONFIG, CHECK_VERSION, READ_CONFIG, READ_TELEMETRY, READ_COIN_COUNTERS, WRITE_CONFIG, SAVE_CONFIG, BAD_COMMAND};
 //SET_COIN_REJECT 'R' --> set coin rejection to off (0b) or on (> 0b)
 //SET_BUTTON_SHORT 'S' --> set keys sent on short button press. followed by 1 byte button number and KEYS_NUMBER_OF bytes of key codes. unused codes must be 0!
 //SET_BUTTON_LONG 'L' --> set keys sent on short button press. followed by 1 byte button number and KEYS_NUMBER_OF bytes of key codes. unused codes must be 0!
 //SET_COIN 'C' --> set keys sent on coin insertion. followed by 1 byte coin number and KEYS_NUMBER_OF bytes of key codes. unused codes must be 0!
 //DUMP_CONFIG 'D' --> dump version information and all configured data to serial port after waiting for a short while. for debug purposes.
 //CHECK_VERSION '?' --> send version string to serial port. used by the PC side to find MAMEduino serial port.
-const std::string COMMAND_OK = "OK\n"; //!<Response sent when a command is detected.
-const std::string COMMAND_NOK = "NK\n"; //!<Response sent when the command or its arguments are not ok.
-const char COMMAND_TERMINATOR = 10; //!<Command terminator is LF aka '\n'
+//READ_CONFIG 'B' --> send a binary snapshot of all bindings and the coin rejection state.
+//READ_TELEMETRY 'T' --> send performance counters. followed by 1 byte: reset counters afterwards (> 0b) or not (0b).
+//READ_COIN_COUNTERS 'M' --> send coin audit counters. followed by 1 byte: reset counters afterwards (> 0b) or not (0b).
+//WRITE_CONFIG 'W' --> replace all bindings and the coin rejection state at once. followed by a config snapshot. frames only.
+//SAVE_CONFIG 'V' --> save bindings and coin rejection to EEPROM.
 
 std::map<Command, uint8_t> commandMap; //!<Maps arduino commands to their serial terminal values.
-std::map<std::string, uint8_t> keyNameMap; //!<Maps key name strings to their unsigned char value.
 
-Command command = BAD_COMMAND; //!<The command that was passed on the command line.
-std::vector<uint8_t> commandData; //string containing the whole command
+struct SerialCommand
+{
+    Command command = BAD_COMMAND; //!<The command to send.
+    std::vector<uint8_t> data; //!<Bytes of the whole command, without terminator.
+    std::string description; //!<Command line arguments the command was read from.
+};
+std::vector<SerialCommand> commands; //!<The commands that were passed on the command line or in profiles.
 
 std::string serialPortName = ""; //!<Default serial port device name.
 bool beVerbose = false; //!<Set to true to display more output.
 
 bool autodetectPort = false; //!<Set to true to autodetect the port upon start.
-const std::string possiblePortNames[] {
-    "USB0", "USB1", "USB2", "USB3", "USB4", "USB5", "USB6", "USB7", "USB8", "USB9", 
-    "ACM0", "ACM1", "ACM2", "ACM3", "ACM4", "ACM5", "ACM6", "ACM7", "ACM8", "ACM9", ""
-}; //!<List of possible path name. Simplest method I guess...
+bool forceTextProtocol = false; //!<Set to true to not use the framed protocol even if the device supports it.
+bool syncToDevice = false; //!<Set to true to only send settings the device does not have yet.
+bool writeConfigAtOnce = false; //!<Set to true to send all settings in one WRITE_CONFIG command.
+bool saveConfig = true; //!<Set to false to not save changed settings to the EEPROM of the device.
+bool runBridgeMode = false; //!<Set to true to inject the keys for device events on the host after sending the commands.
+bool printBridgeKeys = false; //!<Set to true to print the keys in bridge mode instead of sending them through uinput.
+std::string captureFileName; //!<Record the serial traffic to this trace file. Empty = don't record.
 
 //---------------------------------------------------------------------------------------------------------------------------
 
 void setup()
 {
     //setup the values which are sent for every command onthe terminal
-    commandMap[SET_COIN_REJECT] = 'R';
-    commandMap[SET_BUTTON_SHORT] = 'S';
-    commandMap[SET_BUTTON_LONG] = 'L';
-    commandMap[SET_COIN] = 'C';
-    commandMap[DUMP_CONFIG] = 'D';
-    commandMap[CHECK_VERSION] = '?';
-    //set names for keys that are read from the command line and their value sent to the arduino
-    keyNameMap["CLEAR"] = 0; //clear all key bindings for a press mode of a button
-    keyNameMap["LCTRL"] = 128;
-    keyNameMap["LSHIFT"] = 129;
-    keyNameMap["LALT"] = 130;
-    keyNameMap["LGUI"] = 131;
-    keyNameMap["RCTRL"] = 132;
-    keyNameMap["RSHIFT"] = 133;
-    keyNameMap["RALT"] = 134;
-    keyNameMap["RGUI"] = 135;
-    keyNameMap["UP"] = 218;
-    keyNameMap["DOWN"] = 217;
-    keyNameMap["LEFT"] = 216;
-    keyNameMap["RIGHT"] = 215;
-    keyNameMap["BACKSPACE"] = 178;
-    keyNameMap["TAB"] = 179;
-    keyNameMap["RETURN"] = 176;
-    keyNameMap["ESC"] = 177;
-    keyNameMap["INSERT"] = 209;
-    keyNameMap["DELETE"] = 212;
-    keyNameMap["PAGEUP"] = 211;
-    keyNameMap["PAGEDOWN"] = 214;
-    keyNameMap["HOME"] = 210;
-    keyNameMap["END"] = 213;
-    keyNameMap["F1"] = 194;
-    keyNameMap["F2"] = 195;
-    keyNameMap["F3"] = 196;
-    keyNameMap["F4"] = 197;
-    keyNameMap["F5"] = 198;
-    keyNameMap["F6"] = 199;
-    keyNameMap["F7"] = 200;
-    keyNameMap["F8"] = 201;
-    keyNameMap["F9"] = 202;
-    keyNameMap["F10"] = 203;
-    keyNameMap["F11"] = 204;
-    keyNameMap["F12"] = 205;
-    keyNameMap["PIN_RESET"] = 254;
-    keyNameMap["PIN_POWER"] = 255;
+    commandMap[SET_COIN_REJECT] = COMMAND_SET_COIN_REJECT;
+    commandMap[SET_BUTTON_SHORT] = COMMAND_SET_BUTTON_SHORT;
+    commandMap[SET_BUTTON_LONG] = COMMAND_SET_BUTTON_LONG;
+    commandMap[SET_COIN] = COMMAND_SET_COIN;
+    commandMap[DUMP_CONFIG] = COMMAND_DUMP_CONFIG;
+    commandMap[CHECK_VERSION] = COMMAND_CHECK_VERSION;
+    commandMap[READ_CONFIG] = COMMAND_READ_CONFIG;
+    commandMap[READ_TELEMETRY] = COMMAND_READ_TELEMETRY;
+    commandMap[READ_COIN_COUNTERS] = COMMAND_READ_COIN_COUNTERS;
+    commandMap[WRITE_CONFIG] = COMMAND_WRITE_CONFIG;
+    commandMap[SAVE_CONFIG] = COMMAND_SAVE_CONFIG;
 }
 
 void printVersion()
@@ -104,7 +87,7 @@ void printVersion()
 
 void printUsage()
 {
-    std::cout << "Usage:" << ConsoleStyle(ConsoleStyle::CYAN) << " mameduino <SERIAL_DEVICE> <COMMAND>" << ConsoleStyle() << std::endl;
+    std::cout << "Usage:" << ConsoleStyle(ConsoleStyle::CYAN) << " mameduino <SERIAL_DEVICE> <COMMAND> [<COMMAND> ...]" << ConsoleStyle() << std::endl;
     std::cout << "SERIAL_DEVICE should be e.g. " << ConsoleStyle(ConsoleStyle::CYAN) << "/dev/ttyACM0" << ConsoleStyle() << 
                  ", or use " << ConsoleStyle(ConsoleStyle::CYAN) << "-a" << ConsoleStyle() << " to auto-detect it." << std::endl;    
     std::cout << "Valid commands:" << std::endl;
@@ -113,13 +96,30 @@ void printUsage()
     std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-l BUTTON# KEY ..." << ConsoleStyle() << " - Set keyboard keys to send when button is LONG-pressed."  << std::endl;
     std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-c COIN# KEY ..." << ConsoleStyle() << " - Set keyboard keys to send when coin is inserted." << std::endl;
     std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-d" << ConsoleStyle() << " - Dump version and current configuration of Arduino program." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-t [reset]" << ConsoleStyle() << " - Show performance counters of Arduino program. \"reset\" resets them afterwards." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-m [reset]" << ConsoleStyle() << " - Show coins and credits counted per coin input. \"reset\" resets them afterwards." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-f PROFILE" << ConsoleStyle() << " - Read commands from a profile file. One or more commands per line, '#' starts a comment line." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-v" << ConsoleStyle() << " - Verbose output, e.g. show response latencies." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "--sync" << ConsoleStyle() << " - Read the configuration of the Arduino first and only send settings that differ." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "--atomic" << ConsoleStyle() << " - Send all settings to the Arduino in one command, which it applies at once or not at all." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "--no-save" << ConsoleStyle() << " - Don't save the settings to the EEPROM of the Arduino. They are lost when it is switched off." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "--text" << ConsoleStyle() << " - Send plain text commands one by one, even if the device supports the framed protocol." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "--bridge" << ConsoleStyle() << " - Afterwards receive button and coin events and send their keys through /dev/uinput until Ctrl+C." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "--bridge-print" << ConsoleStyle() << " - Like --bridge, but print the keys instead of sending them." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "--capture TRACE" << ConsoleStyle() << " - Record all bytes sent to and received from the Arduino with their time. Replay them with mameduino-replay." << std::endl;
     std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-h/-?/--help" << ConsoleStyle() << " - Show this help." << std::endl;
-    std::cout << "Currently valid buttons: 0-" << MAX_BUTTON_INDEX << "." << std::endl;
-    std::cout << "Currently valid coins: 0-" << MAX_COIN_INDEX << "." << std::endl;
-    std::cout << "Up to " << MAX_NR_OF_KEYS << " keys are supported. Special keys are referenced by their names: " << std::endl;
-    std::cout << "  LCTRL, LSHIFT, LALT, LGUI, RCTRL, RSHIFT, RALT, RGUI," << std::endl;
-    std::cout << "  UP, DOWN, LEFT, RIGHT, BACKSPACE, TAB, RETURN, ESC," << std::endl;
-    std::cout << "  INSERT, DELETE, PAGEUP, PAGEDOWN, HOME, END, F1-F12" << std::endl;
+    std::cout << "Multiple commands can be passed and are all sent in one session over the same port." << std::endl;
+    std::cout << "The Arduino reports its number of buttons, coins and keys per binding when connecting." << std::endl;
+    std::cout << "The default layout has buttons 0-" << Layout::buttons - 1 << ", coins 0-" << Layout::coins - 1 << " and up to " << static_cast<int>(Layout::keys) << " keys per binding." << std::endl;
+    std::cout << "Special keys are referenced by their names:";
+    for (size_t i = 0; i < KEY_TABLE_SIZE; ++i) {
+        std::cout << (i % 12 == 0 ? "\n  " : " ") << KEY_TABLE[i].name;
+    }
+    std::cout << std::endl;
+    std::cout << "Keys joined by '+' are held down together, e.g. LCTRL+c. Chords and media keys count as several keys." << std::endl;
+    std::cout << "KEY*N sends a key or chord N times. DELAY:MS waits, HOLD:MS holds the next key down for up to " << (0xFF & ~MACRO_OPERAND) * MACRO_TIME_UNIT << "ms." << std::endl;
+    std::cout << "DELAY can be up to " << (Layout::macroPool / 2) * (0xFF & ~MACRO_OPERAND) * MACRO_TIME_UNIT << "ms, if the macro pool is empty otherwise." << std::endl;
+    std::cout << "Times are rounded to " << MACRO_TIME_UNIT << "ms. Repeats, delays and holds count as two keys." << std::endl;
     std::cout << "The reset and power pin/button can be accessed with PIN_RESET and PIN_POWER." << std::endl;
     std::cout << "Your can clear key bindings for a button/coin with the keyword CLEAR." << std::endl;
     std::cout << "Examples:" << std::endl;
@@ -128,41 +128,305 @@ void printUsage()
     std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "mameduino /dev/ttyACM0 -l 1 CLEAR" << ConsoleStyle() << " (remove all keys for button 1, long press)" << std::endl;
     std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "mameduino /dev/ttyS0 -l 3 PIN_POWER" << ConsoleStyle() << " (pulse power pin for button 1, long press)" << std::endl;
     std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "mameduino /dev/ttyUSB0 -c 2 b l a h r g" << ConsoleStyle() << " (send \"blahrg\" for coin 2)" << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "mameduino -a -s 1 1 -s 2 2 -r off" << ConsoleStyle() << " (set keys for buttons 1 and 2, turn coin rejection off)" << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "mameduino -a -l 0 TAB DELAY:500 DOWN*4 RETURN" << ConsoleStyle() << " (open the MAME menu and select the 5th entry on long press of button 0)" << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "mameduino -a -f mame.profile" << ConsoleStyle() << " (send all commands from file mame.profile)" << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "mameduino -a --sync -f mame.profile" << ConsoleStyle() << " (send only the settings from mame.profile the Arduino does not have yet)" << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "mameduino -a --bridge" << ConsoleStyle() << " (send the keys bound on the Arduino without keystroke delays)" << std::endl;
 }
 
-bool readKeys(int argc, const char * argv[], int startIndex)
+bool isCommandArgument(const std::string & argument)
 {
-    if (startIndex < argc) {
-        int argumentIndex = 0;
-        for(int i = startIndex; i < argc && (i - startIndex) < MAX_NR_OF_KEYS;) {
-            //check if key is a single character or a modifier etc.
-            std::string key = argv[i++];
-            if (key.size() > 1) {
-                //elaborate key. check map
-                auto keyIt = keyNameMap.find(key);
-                if (keyIt != keyNameMap.cend()) {
-                    //found. append to command arguments
-                    commandData.push_back(keyIt->second);
-                    argumentIndex++;
-                }
-                else {
-                    //not found. complain to user
-                    std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Unknown key name \"" << key << "\"." << ConsoleStyle() << std::endl;
+    return argument == "-r" || argument == "-s" || argument == "-l" || argument == "-c" || argument == "-d" || argument == "-t" || argument == "-m" || argument == "-f" || argument == "-v" || argument == "--text" || argument == "--sync" || argument == "--atomic" || argument == "--no-save" || argument == "--bridge" || argument == "--bridge-print" || argument == "--capture";
+}
+
+bool readKey(const std::string & key, std::vector<uint8_t> & keyData)
+{
+    //check if key is a single character or a modifier etc.
+    if (key.size() == 1) {
+        keyData.push_back(key.at(0));
+        return true;
+    }
+    const int code = keyCodeFromName(key.c_str());
+    if (code < 0) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Unknown key name \"" << key << "\"." << ConsoleStyle() << std::endl;
+        return false;
+    }
+    //media keys are sent as two bytes
+    if (code > 0xFF) {
+        keyData.push_back(static_cast<uint8_t>(code >> 8));
+    }
+    keyData.push_back(static_cast<uint8_t>(code));
+    return true;
+}
+
+bool readNumber(const std::string & argument, int minValue, int maxValue, int & value)
+{
+    std::istringstream tempStream(argument);
+    return !argument.empty() && (tempStream >> value) && tempStream.eof() && value >= minValue && value <= maxValue;
+}
+
+bool readMacroStep(const std::string & argument, std::vector<uint8_t> & keyData)
+{
+    //DELAY:MS or HOLD:MS. times are sent in MACRO_TIME_UNIT steps
+    const bool isDelay = argument.compare(0, 6, "DELAY:") == 0;
+    const int maxHoldMs = (0xFF & ~MACRO_OPERAND) * MACRO_TIME_UNIT;
+    //a delay is split into 2-byte steps of up to maxHoldMs, which must fit into the macro pool
+    const int maxDelayMs = static_cast<int>(Layout::macroPool / 2) * maxHoldMs;
+    const int maxMs = isDelay ? maxDelayMs : maxHoldMs;
+    int ms;
+    if (!readNumber(argument.substr(argument.find(':') + 1), MACRO_TIME_UNIT / 2, maxMs, ms)) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Bad time in \"" << argument << "\". It must be " << MACRO_TIME_UNIT / 2 << "-" << maxMs << "ms." << ConsoleStyle() << std::endl;
+        return false;
+    }
+    int units = (ms + MACRO_TIME_UNIT / 2) / MACRO_TIME_UNIT;
+    //long delays are split into several steps
+    while (units > 0) {
+        const int stepUnits = std::min(units, 0xFF & ~MACRO_OPERAND);
+        keyData.push_back(isDelay ? CHAR_DELAY : CHAR_HOLD);
+        keyData.push_back(static_cast<uint8_t>(MACRO_OPERAND | stepUnits));
+        units -= stepUnits;
+    }
+    return true;
+}
+
+bool readKeys(const std::vector<std::string> & arguments, size_t & index, std::vector<uint8_t> & data)
+{
+    std::vector<uint8_t> keyData;
+    bool holdPending = false;
+    //read keys until the arguments end or the next command starts
+    while (index < arguments.size() && !isCommandArgument(arguments.at(index))) {
+        std::string argument = arguments.at(index++);
+        //macro steps: wait or hold the next key longer
+        if (argument.compare(0, 6, "DELAY:") == 0 || argument.compare(0, 5, "HOLD:") == 0) {
+            if (holdPending) {
+                std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: HOLD must be followed by a key." << ConsoleStyle() << std::endl;
+                return false;
+            }
+            if (!readMacroStep(argument, keyData)) {
+                return false;
+            }
+            holdPending = argument.at(0) == 'H';
+            continue;
+        }
+        holdPending = false;
+        //KEY*N sends a key or chord N times
+        int repeats = 1;
+        const size_t star = argument.rfind('*');
+        if (star != std::string::npos && star > 0 && (star + 1) < argument.size() && argument.find_first_not_of("0123456789", star + 1) == std::string::npos) {
+            const int maxRepeats = (0xFF & ~MACRO_OPERAND) + 1;
+            if (!readNumber(argument.substr(star + 1), 1, maxRepeats, repeats)) {
+                std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Bad repeat count in \"" << argument << "\". It must be 1-" << maxRepeats << "." << ConsoleStyle() << std::endl;
+                return false;
+            }
+            argument = argument.substr(0, star);
+        }
+        //keys of a chord are joined by '+'. a part is at least one character long, so "LSHIFT++" is LSHIFT and '+'
+        size_t start = 0;
+        while (start < argument.size()) {
+            size_t end = argument.find('+', start + 1);
+            end = end == std::string::npos ? argument.size() : end;
+            const std::string key = argument.substr(start, end - start);
+            const bool isChord = start > 0 || end < argument.size();
+            if (isChord && (key == "CLEAR" || key == "PIN_RESET" || key == "PIN_POWER")) {
+                std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: " << key << " can not be part of a chord." << ConsoleStyle() << std::endl;
+                return false;
+            }
+            if (start > 0) {
+                keyData.push_back(CHAR_CHORD);
+            }
+            if (!readKey(key, keyData)) {
+                return false;
+            }
+            start = end + 1;
+        }
+        if (repeats > 1) {
+            keyData.push_back(CHAR_REPEAT);
+            keyData.push_back(static_cast<uint8_t>(MACRO_OPERAND | (repeats - 1)));
+        }
+    }
+    if (holdPending) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: HOLD must be followed by a key." << ConsoleStyle() << std::endl;
+        return false;
+    }
+    if (keyData.empty()) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: No key presses specified." << ConsoleStyle() << std::endl;
+        return false;
+    }
+    data.insert(data.end(), keyData.cbegin(), keyData.cend());
+    return true;
+}
+
+bool readIndex(const std::string & argument, const std::string & name, int maxIndex, uint8_t & index)
+{
+    int value;
+    std::istringstream tempStream(argument);
+    if (!(tempStream >> value) || !tempStream.eof() || value < 0 || value > maxIndex) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: " << name << " index must be 0-" << maxIndex << ", but was " << argument << "." << ConsoleStyle() << std::endl;
+        return false;
+    }
+    index = static_cast<uint8_t>(value);
+    return true;
+}
+
+bool readProfile(const std::string & fileName);
+
+bool readCommands(const std::vector<std::string> & arguments)
+{
+    for (size_t i = 0; i < arguments.size();) {
+        //read argument from list
+        const size_t firstArgument = i;
+        const std::string argument = arguments.at(i++);
+        SerialCommand serialCommand;
+        //check what it is
+        if (argument == "-d") {
+            serialCommand.command = DUMP_CONFIG;
+            serialCommand.data.push_back(commandMap[serialCommand.command]);
+        }
+        else if (argument == "-t" || argument == "-m") {
+            //optional next argument: "reset"
+            const bool reset = i < arguments.size() && arguments.at(i) == "reset";
+            if (reset) {
+                i++;
+            }
+            serialCommand.command = argument == "-t" ? READ_TELEMETRY : READ_COIN_COUNTERS;
+            serialCommand.data.push_back(commandMap[serialCommand.command]);
+            serialCommand.data.push_back(reset ? 1 : 0);
+        }
+        else if (argument == "-r") {
+            //check if we have another argument
+            if (i >= arguments.size()) {
+                std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Button reject argument missing." << ConsoleStyle() << std::endl;
+                return false;
+            }
+            //read next argument: "on" or "off"
+            const std::string onoff = arguments.at(i++);
+            if (onoff != "on" && onoff != "off") {
+                std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Button reject argument was \"" << onoff << "\", but must be \"on\" or \"off\"." << ConsoleStyle() << std::endl;
+                return false;
+            }
+            serialCommand.command = SET_COIN_REJECT;
+            serialCommand.data.push_back(commandMap[serialCommand.command]);
+            serialCommand.data.push_back(onoff == "on" ? 1 : 0);
+        }
+        else if (argument == "-s" || argument == "-l" || argument == "-c") {
+            //check if we have at least two more arguments
+            if ((i + 1) >= arguments.size()) {
+                std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Too few arguments for command " << argument << " (two are needed)." << ConsoleStyle() << std::endl;
+                return false;
+            }
+            //read next argument: button or coin index
+            uint8_t index;
+            if (argument == "-c") {
+                if (!readIndex(arguments.at(i++), "Coin", MAX_COIN_INDEX, index)) {
                     return false;
                 }
+                serialCommand.command = SET_COIN;
             }
             else {
-                //simple character. append to command arguments
-                commandData.push_back(key.at(0));
-                argumentIndex++;
+                if (!readIndex(arguments.at(i++), "Button", MAX_BUTTON_INDEX, index)) {
+                    return false;
+                }
+                serialCommand.command = argument == "-s" ? SET_BUTTON_SHORT : SET_BUTTON_LONG;
+            }
+            serialCommand.data.push_back(commandMap[serialCommand.command]);
+            serialCommand.data.push_back(index);
+            //read next arguments: keys
+            if (!readKeys(arguments, i, serialCommand.data)) {
+                return false;
             }
         }
-        return true;
+        else if (argument == "-v") {
+            //verbose output. not a command
+            beVerbose = true;
+            continue;
+        }
+        else if (argument == "--text") {
+            //don't use framed protocol. not a command
+            forceTextProtocol = true;
+            continue;
+        }
+        else if (argument == "--sync") {
+            //only send settings that differ. not a command
+            syncToDevice = true;
+            continue;
+        }
+        else if (argument == "--no-save") {
+            //keep settings in RAM only. not a command
+            saveConfig = false;
+            continue;
+        }
+        else if (argument == "--atomic") {
+            //merge settings into one command. not a command
+            writeConfigAtOnce = true;
+            continue;
+        }
+        else if (argument == "--bridge" || argument == "--bridge-print") {
+            //run bridge mode after sending commands. not a command
+            runBridgeMode = true;
+            printBridgeKeys = argument == "--bridge-print";
+            continue;
+        }
+        else if (argument == "--capture") {
+            //record serial traffic. not a command
+            if (i >= arguments.size()) {
+                std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Trace file name missing." << ConsoleStyle() << std::endl;
+                return false;
+            }
+            captureFileName = arguments.at(i++);
+            continue;
+        }
+        else if (argument == "-f") {
+            //read commands from profile file
+            if (i >= arguments.size()) {
+                std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Profile file name missing." << ConsoleStyle() << std::endl;
+                return false;
+            }
+            if (!readProfile(arguments.at(i++))) {
+                return false;
+            }
+            continue;
+        }
+        else {
+            std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Unknown command \"" << argument << "\"!" << ConsoleStyle() << std::endl;
+            return false;
+        }
+        //store command line for reporting
+        for (size_t j = firstArgument; j < i; ++j) {
+            serialCommand.description += (j > firstArgument ? " " : "") + arguments.at(j);
+        }
+        commands.push_back(serialCommand);
     }
-    else {
-        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: No key presses specified." << ConsoleStyle() << std::endl;
+    return true;
+}
+
+bool readProfile(const std::string & fileName)
+{
+    std::ifstream file(fileName);
+    if (!file.is_open()) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to open profile file \"" << fileName << "\"!" << ConsoleStyle() << std::endl;
+        return false;
     }
-    return false;
+    //every line holds commands in the same format as on the command line. lines starting with '#' are comments
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        std::istringstream lineStream(line);
+        std::vector<std::string> arguments;
+        std::string argument;
+        while (lineStream >> argument) {
+            arguments.push_back(argument);
+        }
+        if (arguments.empty() || arguments.front().at(0) == '#') {
+            continue;
+        }
+        if (!readCommands(arguments)) {
+            std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error in profile " << fileName << ", line " << lineNumber << "." << ConsoleStyle() << std::endl;
+            return false;
+        }
+    }
+    return true;
 }
 
 bool readArguments(int argc, const char * argv[])
@@ -186,193 +450,204 @@ bool readArguments(int argc, const char * argv[])
         std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: First argument must be a serial port device string." << ConsoleStyle() << std::endl;
         return false;
     }
-    for(int i = 2; i < argc;) {
-        //read argument from list
-        argument = argv[i++];
-        //check what it is
-        if (argument == "-d") {
-            command = DUMP_CONFIG;
-			commandData.push_back(commandMap[command]);
-			return true;
-        }
-        else if (argument == "-r") {
-            //czeck if we have another argument
-            if (i < argc) {
-                //read next argument: "on" or "off"
-                std::string onoff = argv[i++];
-                if (onoff != "on" && onoff != "off") {
-                    std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Button reject argument was \"" << onoff << "\", but must be \"on\" or \"off\"." << ConsoleStyle() << std::endl;
-                    return false;
-                }
-                command = SET_COIN_REJECT;
-				commandData.push_back(commandMap[command]);
-				commandData.push_back(onoff == "on" ? 1 : 0);
-                return true;
-            }
-            else {
-                std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Button reject argument missing." << ConsoleStyle() << std::endl;
-            }
-        }
-        else if (argument == "-s" || argument == "-l") {
-            //check if we have at least two more arguments
-            if ((i + 1) < argc) {
-                //read next argument: button index
-                int buttonIndex;
-                std::istringstream tempStream(argv[i]);
-                if (!(tempStream >> buttonIndex) || buttonIndex < 0 || buttonIndex > MAX_BUTTON_INDEX) {
-                    std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Button index must be 0-" << MAX_BUTTON_INDEX << ", but was " << argv[i] << "." << ConsoleStyle() << std::endl;
-                    return false;
+    //all other arguments are commands
+    const std::vector<std::string> arguments(argv + 2, argv + argc);
+    return readCommands(arguments);
+}
+
+std::string nameDumpKeys(const std::string & dump)
+{
+    //the Arduino prints key codes as numbers. replace them by names in the button and coin lines
+    std::istringstream dumpStream(dump);
+    std::string result;
+    std::string line;
+    while (std::getline(dumpStream, line)) {
+        if (line.compare(0, 8, "Button #") == 0 || line.compare(0, 6, "Coin #") == 0) {
+            std::istringstream lineStream(line);
+            std::string formatted;
+            std::string token;
+            std::vector<uint8_t> keys;
+            while (lineStream >> token) {
+                if (token.find_first_not_of("0123456789") == std::string::npos && std::stoi(token) <= 0xFF) {
+                    keys.push_back(static_cast<uint8_t>(std::stoi(token)));
+                    continue;
                 }
-                command = argument == "-s" ? SET_BUTTON_SHORT : SET_BUTTON_LONG;
-                commandData.push_back(commandMap[command]);
-                commandData.push_back(static_cast<uint8_t>(buttonIndex));
-                //read next arguments: keys
-                if (readKeys(argc, argv, ++i)) {
-                    return true;
+                if (!keys.empty()) {
+                    formatted += keysToString(keys) + " ";
+                    keys.clear();
                 }
+                formatted += token + " ";
             }
-            else {
-                std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Too few arguments for command (two are needed)." << ConsoleStyle() << std::endl;
+            if (!keys.empty()) {
+                formatted += keysToString(keys);
             }
+            line = formatted;
         }
-        else if (argument == "-c") {
-            //check if we have at least two more arguments
-            if ((i + 1) < argc) {
-                //read next argument: coin index
-                int coinIndex;
-                std::istringstream tempStream(argv[i]);
-                if (!(tempStream >> coinIndex) || coinIndex < 0 || coinIndex > MAX_COIN_INDEX) {
-                    std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Coin index must be 0-" << MAX_COIN_INDEX << ", but was " << argv[i] << "." << ConsoleStyle() << std::endl;
-                    return false;
-                }
-                command = SET_COIN;
-				commandData.push_back(commandMap[command]);
-				commandData.push_back(static_cast<uint8_t>(coinIndex));
-                //read next arguments: keys
-                if (readKeys(argc, argv, ++i)) {                    
-                    return true;
-                }
-            }
-            else {
-                std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Too few arguments for command (two are needed)." << ConsoleStyle() << std::endl;
-            }
+        result += line + "\n";
+    }
+    return result;
+}
+
+bool printCommandResult(const SerialCommand & serialCommand, bool succeeded, const std::string & response, double commandTimeMs)
+{
+    if (succeeded && serialCommand.command == DUMP_CONFIG) {
+        std::cout << nameDumpKeys(response);
+    }
+    if (succeeded && serialCommand.command == READ_TELEMETRY) {
+        Telemetry telemetry;
+        if (decodeTelemetry(response, telemetry)) {
+            printTelemetry(std::cout, telemetry);
         }
         else {
-            std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Unknown command \"" << argument << "\"!" << ConsoleStyle() << std::endl;
-            return false;
+            std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Unknown telemetry format!" << ConsoleStyle() << std::endl;
+            succeeded = false;
+        }
+    }
+    if (succeeded && serialCommand.command == READ_COIN_COUNTERS) {
+        std::vector<CoinCounter> counters;
+        if (decodeCoinCounters(response, counters)) {
+            printCoinCounters(std::cout, counters);
         }
+        else {
+            std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Unknown coin counter format!" << ConsoleStyle() << std::endl;
+            succeeded = false;
+        }
+    }
+    if (succeeded) {
+        std::cout << ConsoleStyle(ConsoleStyle::GREEN) << "OK" << ConsoleStyle();
     }
-    return false;
+    else {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "NK" << ConsoleStyle();
+    }
+    std::cout << " " << serialCommand.description << " (" << std::fixed << std::setprecision(1) << commandTimeMs << "ms)" << std::endl;
+    return succeeded;
 }
 
-bool serialPortExists(const std::string & portName)
+bool checkDeviceLimits(const DeviceLimits & limits)
 {
-    int portHandle = open(portName.c_str(), O_RDWR | O_NOCTTY | O_NDELAY);
-    if (portHandle <= 0) {
-        return false;
+    //indices and key counts could only be checked loosely when reading the arguments
+    bool succeeded = true;
+    for (const auto & serialCommand : commands) {
+        if (serialCommand.command != SET_BUTTON_SHORT && serialCommand.command != SET_BUTTON_LONG && serialCommand.command != SET_COIN) {
+            continue;
+        }
+        const bool isCoin = serialCommand.command == SET_COIN;
+        const size_t nrOfInputs = isCoin ? limits.nrOfCoins : limits.nrOfButtons;
+        const size_t nrOfKeys = serialCommand.data.size() - 2;
+        if (serialCommand.data.at(1) >= nrOfInputs) {
+            std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: \"" << serialCommand.description << "\": " << (isCoin ? "Coin" : "Button") << " index must be 0-" << nrOfInputs - 1 << " on this Arduino." << ConsoleStyle() << std::endl;
+            succeeded = false;
+        }
+        else if (nrOfKeys > limits.nrOfKeys) {
+            std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: \"" << serialCommand.description << "\": Too many keys specified (" << nrOfKeys << "). This Arduino supports " << limits.nrOfKeys << "." << ConsoleStyle() << std::endl;
+            succeeded = false;
+        }
     }
-    close(portHandle);
-    return true;
+    return succeeded;
 }
 
-bool openSerialPort(int & portHandle, const std::string & portName, termios * oldOptions)
+bool sendCommands(MAMEduinoDevice & device, int & nrOfFailedCommands)
 {
-    //try opening serial port
+    //queue all commands at once, so the device can keep several of them in flight
     if (beVerbose) {
-        std::cout << "Opening serial port " << portName << " ..." << std::endl;
-    }
-    portHandle = open(portName.c_str(), O_RDWR | O_NOCTTY | O_NDELAY);
-    if (portHandle <= 0) {
-		std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to open serial port " << portName << "!" << ConsoleStyle() << std::endl;
-		return false;
-	}
-	//no set serial port to proper settings
-	if (beVerbose) {
-    	std::cout << "Setting serial port to 38400bps, 8N1 mode..." << std::endl;
-    }
-	//store current terminal options
-	tcgetattr(portHandle, oldOptions);
-	//clear new terminal options
-	termios options;
-	memset(&options, 0, sizeof(termios));
-	//set baud rate to 38400 Baud
-	cfsetispeed(&options, B38400);
-    cfsetospeed(&options, B38400);
-    //set mode to 8N1
-    options.c_cflag |= (CLOCAL | CREAD); //Enable the receiver and set local mode
-    options.c_cflag &= ~PARENB; //no parity
-    options.c_cflag &= ~CSTOPB; //one stop bit
-    options.c_cflag &= ~CSIZE; //size mask flag
-    options.c_cflag |= CS8; //8 bit
-    //set raw output
-    options.c_oflag &= ~OPOST;
-    //set input mode (non-canonical, no echo)
-    options.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
-    //turn parity off
-    //options.c_iflag = IGNPAR;
-    //flush serial port
-    //tcflush(serialPort, TCIFLUSH);
-	//set terminal options
-	if (tcsetattr(portHandle, TCSANOW, &options) != 0) {
-		std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed set serial port options!" << ConsoleStyle() << std::endl;
-		close(portHandle);
-		return false;
-	}
-	return true;
+        std::cout << "Sending " << commands.size() << " command(s) to Arduino..." << std::endl;
+    }
+    std::vector<std::future<CommandResult>> results;
+    for (const auto & serialCommand : commands) {
+        results.push_back(device.send(serialCommand.data));
+    }
+    bool portFailed = false;
+    for (size_t i = 0; i < commands.size(); ++i) {
+        const CommandResult result = results.at(i).get();
+        portFailed = portFailed || result.result == RESPONSE_ERROR;
+        if (beVerbose && result.result == RESPONSE_TIMEOUT) {
+            std::cout << "No response received for command \"" << commands.at(i).description << "\"." << std::endl;
+        }
+        const bool succeeded = printCommandResult(commands.at(i), result.result == RESPONSE_OK, result.response, result.roundTripMs);
+        nrOfFailedCommands += succeeded ? 0 : 1;
+    }
+    if (portFailed) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to send commands to serial port!" << ConsoleStyle() << std::endl;
+    }
+    return !portFailed;
 }
 
-void closeSerialPort(const int portHandle, const termios * oldOptions)
+bool readDeviceConfig(MAMEduinoDevice & device, DeviceConfig & config)
 {
-	//restore old port settings
-	tcsetattr(portHandle, TCSAFLUSH, oldOptions);
-	//close port and terminate
-	close(portHandle);
+    const CommandResult result = device.send({COMMAND_READ_CONFIG}).get();
+    return result.result == RESPONSE_OK && decodeDeviceConfig(result.response, config);
 }
 
-bool writeToSerialPort(const int portHandle, const unsigned char * data, const ssize_t size)
+bool isSetCommand(const SerialCommand & serialCommand)
 {
-	//write bytes to the port
-	ssize_t n = write(portHandle, data, size);
-	if (n != size) {
-		std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed write to serial port!" << ConsoleStyle() << std::endl;
-		return false;
-	}
-	return true;
+    return serialCommand.command == SET_COIN_REJECT || serialCommand.command == SET_BUTTON_SHORT || serialCommand.command == SET_BUTTON_LONG || serialCommand.command == SET_COIN;
 }
 
-bool getResponseFromSerial(const int portHandle, std::string & response, int waitTimeMs = 200)
+void removeUnchangedCommands(DeviceConfig & config)
 {
-    //clear response string
-    response.clear();
-    //start reading from serial port
-    char buffer[256];
-    bool responseReceived = false;
-    int waitStep = 50;
-    std::string combinedResponse;
-    while (!responseReceived && waitTimeMs > 0) {
-        //sleep some time to transfer commands
-        usleep(waitStep*1000);
-        ssize_t bytesRead = read(portHandle, &buffer, sizeof(buffer) - 1);
-        if (bytesRead > 0) {
-            //response received, null-terminate string and add to combined response
-    	    buffer[bytesRead] = '\0';
-    	    combinedResponse += buffer;
-    	    //check if the message is long enough
-        	if (combinedResponse.length() >= COMMAND_OK.length()) {
-                //check if the end of our message is OK\n or NK\n
-         	    if (combinedResponse.substr(combinedResponse.length() - COMMAND_OK.length(), COMMAND_OK.length()) == COMMAND_OK) {
-         	        //remove end from response and return
-         	        response = combinedResponse.substr(0, combinedResponse.length() - COMMAND_OK.length());
-         	        return true;
-                }
-                else if (combinedResponse.substr(combinedResponse.length() - COMMAND_NOK.length(), COMMAND_NOK.length()) == COMMAND_NOK) {
-                    return false;
-                }
-            }
+    //commands are checked in order, so of two commands for the same binding the last one wins
+    const size_t nrOfCommands = commands.size();
+    std::vector<SerialCommand> changingCommands;
+    for (const auto & serialCommand : commands) {
+        if (!isSetCommand(serialCommand) || applyToDeviceConfig(config, serialCommand.data)) {
+            changingCommands.push_back(serialCommand);
+        }
+        else if (beVerbose) {
+            std::cout << "Skipping \"" << serialCommand.description << "\", the Arduino already has this setting." << std::endl;
+        }
+    }
+    commands = changingCommands;
+    std::cout << nrOfCommands - commands.size() << " of " << nrOfCommands << " command(s) already set on the Arduino." << std::endl;
+}
+
+void mergeSetCommands(DeviceConfig & config)
+{
+    //apply all settings to the config of the device and send the result in place of the first setting
+    std::vector<SerialCommand> otherCommands;
+    size_t firstSetCommand = std::string::npos;
+    size_t nrOfSetCommands = 0;
+    bool changes = false;
+    for (const auto & serialCommand : commands) {
+        if (isSetCommand(serialCommand)) {
+            firstSetCommand = std::min(firstSetCommand, otherCommands.size());
+            changes = applyToDeviceConfig(config, serialCommand.data) || changes;
+            nrOfSetCommands++;
+        }
+        else {
+            otherCommands.push_back(serialCommand);
         }
-        waitTimeMs -= waitStep;
     }
-    return false;
+    if (nrOfSetCommands == 0) {
+        return;
+    }
+    if (syncToDevice && !changes) {
+        std::cout << nrOfSetCommands << " of " << commands.size() << " command(s) already set on the Arduino." << std::endl;
+        commands = otherCommands;
+        return;
+    }
+    SerialCommand writeCommand;
+    writeCommand.command = WRITE_CONFIG;
+    writeCommand.data.push_back(commandMap[WRITE_CONFIG]);
+    const std::vector<uint8_t> snapshot = encodeDeviceConfig(config);
+    writeCommand.data.insert(writeCommand.data.end(), snapshot.cbegin(), snapshot.cend());
+    writeCommand.description = "--atomic (" + std::to_string(nrOfSetCommands) + " setting(s))";
+    otherCommands.insert(otherCommands.begin() + firstSetCommand, writeCommand);
+    commands = otherCommands;
+}
+
+void appendSaveCommand()
+{
+    //save once after all settings, so a profile is written to the EEPROM in one go
+    const bool changesConfig = std::any_of(commands.cbegin(), commands.cend(), [](const SerialCommand & serialCommand) {
+        return isSetCommand(serialCommand) || serialCommand.command == WRITE_CONFIG;
+    });
+    if (changesConfig) {
+        SerialCommand saveCommand;
+        saveCommand.command = SAVE_CONFIG;
+        saveCommand.data.push_back(commandMap[SAVE_CONFIG]);
+        saveCommand.description = "save configuration";
+        commands.push_back(saveCommand);
+    }
 }
 
 int main(int argc, const char * argv[])
@@ -381,79 +656,120 @@ int main(int argc, const char * argv[])
 
     printVersion();
     
-    if (argc < 2 || !readArguments(argc, argv) || command == BAD_COMMAND) {
+    if (argc < 2 || !readArguments(argc, argv) || (commands.empty() && !runBridgeMode)) {
         std::cout << std::endl;
         printUsage();
         return -1;
     }
 
-    termios oldOptions;
-    int portHandle = -1;
-    if (autodetectPort) {
-        //try to autodetect port. get post names from list
-        std::string portNameCandidate;
-        for (int i = 0; !possiblePortNames[i].empty() && serialPortName.empty(); ++i) {
-            //try to open port
-            portNameCandidate = "/dev/tty" + possiblePortNames[i];
-            if (serialPortExists(portNameCandidate) && openSerialPort(portHandle, portNameCandidate, &oldOptions)) {
-                //opening worked. send version command
-                std::vector<uint8_t> versionCommand;
-                versionCommand.push_back('?');
-                versionCommand.push_back(COMMAND_TERMINATOR);
-                if (writeToSerialPort(portHandle, versionCommand.data(), versionCommand.size() * sizeof(uint8_t))) {
-                    //sending worked. receive response.                           
-                    std::string response;
-                    if (getResponseFromSerial(portHandle, response) && response.substr(0, 10) == "MAMEduino ") {
-                        if (beVerbose) {
-                            std::cout << ConsoleStyle(ConsoleStyle::GREEN) << response << " found at " << portNameCandidate << "." << ConsoleStyle() << std::endl;
-                        }
-		                serialPortName = portNameCandidate;
-                    }
-                }
-                closeSerialPort(portHandle, &oldOptions);
-            }
-        }
-        if (serialPortName.empty()) {
-            std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to auto-detect serial port!" << ConsoleStyle() << std::endl;
-            return -2;
-        }
+    if (runBridgeMode) {
+        //bridge mode runs on the device thread and waits for SIGINT and SIGTERM there, so they must not end us here.
+        //block them before the device starts its thread, so all threads inherit the mask
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
     }
 
-    //open port with port name given on command line or filled by auto-detection
-    if (!openSerialPort(portHandle, serialPortName, &oldOptions)) {
+    //use the daemon if one is running for the same port, else open the port given on the command line or auto-detect it
+    MAMEduinoDevice device;
+    DeviceOptions options;
+    options.portName = autodetectPort ? "" : serialPortName;
+    options.forceTextProtocol = forceTextProtocol;
+    options.captureFileName = captureFileName;
+    const DeviceInfo deviceInfo = device.open(options).get();
+    if (deviceInfo.result == OPEN_NOT_FOUND) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to auto-detect serial port!" << ConsoleStyle() << std::endl;
+        return -2;
+    }
+    if (deviceInfo.result == OPEN_CAPTURE_FAILED) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to create trace file " << captureFileName << "!" << ConsoleStyle() << std::endl;
+        return -2;
+    }
+    if (deviceInfo.result != OPEN_OK) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to open serial port " << deviceInfo.portName << "!" << ConsoleStyle() << std::endl;
+        return -2;
+    }
+    if (beVerbose) {
+        std::cout << (deviceInfo.usesDaemon ? "Using mameduinod for serial port " : "Opened serial port ") << deviceInfo.portName << "." << std::endl;
+    }
+    if (deviceInfo.usesDaemon && runBridgeMode) {
+        //events can't be passed through the daemon
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Bridge mode needs the serial port. Stop mameduinod first!" << ConsoleStyle() << std::endl;
         return -2;
     }
     
+    //check what the device supports and how many inputs it has
+    if (deviceInfo.versionString.empty()) {
+        std::cout << ConsoleStyle(ConsoleStyle::YELLOW) << "Warning: Failed to read version from Arduino. Assuming the default layout." << ConsoleStyle() << std::endl;
+    }
+    else if (!deviceInfo.reportsLayout && beVerbose) {
+        std::cout << "Arduino does not report its layout. Assuming the default layout." << std::endl;
+    }
+    const DeviceLimits & deviceLimits = deviceInfo.limits;
     if (beVerbose) {
-    	std::cout << "Sending command to Arduino..." << std::endl;
-    }
-    //terminate command with a line break
-    commandData.push_back(COMMAND_TERMINATOR);
-    //write command to port
-	if (!writeToSerialPort(portHandle, commandData.data(), commandData.size() * sizeof(uint8_t))) {
-		closeSerialPort(portHandle, &oldOptions);
-		return -3;
-	}
-	
-	if (beVerbose) {
-    	std::cout << "Waiting for response from Arduino..." << std::endl;
-    }
-    //read response from arduino
-    std::string response;
-    if (getResponseFromSerial(portHandle, response)) {
-        if (command == DUMP_CONFIG) {
-            std::cout << response;
-        }
-        std::cout << ConsoleStyle(ConsoleStyle::GREEN) << "Command succeded." << ConsoleStyle() << std::endl;
+        std::cout << "Arduino has " << deviceLimits.nrOfButtons << " button(s), " << deviceLimits.nrOfCoins << " coin(s) and " << deviceLimits.nrOfKeys << " key(s) per binding." << std::endl;
     }
-    else {
-        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Sending the command failed!" << ConsoleStyle() << std::endl;
-        closeSerialPort(portHandle, &oldOptions);
+    if (!checkDeviceLimits(deviceLimits)) {
+        return -3;
+    }
+    if (beVerbose) {
+        std::cout << "Using " << (deviceInfo.usesFramedProtocol ? "framed" : "text") << " protocol." << std::endl;
+    }
+    //writing all settings at once needs frames, because the snapshot is binary
+    const bool canWriteConfig = writeConfigAtOnce && deviceInfo.usesFramedProtocol && supportsConfigWrite(deviceInfo.versionString);
+    if (writeConfigAtOnce && !canWriteConfig) {
+        std::cout << ConsoleStyle(ConsoleStyle::YELLOW) << "Warning: The Arduino can't take all settings at once. Sending them one by one." << ConsoleStyle() << std::endl;
+    }
+    //only send what the device doesn't have yet, or merge the settings into what it has
+    if (syncToDevice || canWriteConfig) {
+        DeviceConfig deviceConfig;
+        if (!readDeviceConfig(device, deviceConfig)) {
+            std::cout << ConsoleStyle(ConsoleStyle::YELLOW) << "Warning: Failed to read configuration from Arduino. Sending all commands one by one." << ConsoleStyle() << std::endl;
+        }
+        else if (canWriteConfig) {
+            mergeSetCommands(deviceConfig);
+        }
+        else {
+            removeUnchangedCommands(deviceConfig);
+        }
+    }
+    //newer firmware only saves settings when told to
+    if (saveConfig && supportsConfigSave(deviceInfo.versionString)) {
+        appendSaveCommand();
+    }
+    //send all commands over the open port
+    int nrOfFailedCommands = 0;
+    const auto startTime = std::chrono::steady_clock::now();
+    if (!sendCommands(device, nrOfFailedCommands)) {
+        return -3;
+    }
+    const std::chrono::duration<double, std::milli> totalTime = std::chrono::steady_clock::now() - startTime;
+    std::cout << commands.size() << " command(s) sent in " << std::fixed << std::setprecision(1) << totalTime.count() << "ms." << std::endl;
+    if (nrOfFailedCommands > 0) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: " << nrOfFailedCommands << " command(s) failed!" << ConsoleStyle() << std::endl;
         return -4;
     }
+    std::cout << ConsoleStyle(ConsoleStyle::GREEN) << "Command(s) succeded." << ConsoleStyle() << std::endl;
 
-    //close port	
-	closeSerialPort(portHandle, &oldOptions);
+    //inject keys for device events until stopped
+    if (runBridgeMode) {
+        std::unique_ptr<KeyInjector> injector = printBridgeKeys ? createPrintKeyInjector() : createUinputKeyInjector();
+        if (!injector) {
+            std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to create virtual keyboard through /dev/uinput (" << strerror(errno) << ")!" << ConsoleStyle() << std::endl;
+            return -5;
+        }
+        DeviceConfig deviceConfig;
+        if (!readDeviceConfig(device, deviceConfig)) {
+            std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to read key bindings from Arduino!" << ConsoleStyle() << std::endl;
+            return -5;
+        }
+        if (!device.runBridge(deviceConfig, *injector, beVerbose).get()) {
+            return -5;
+        }
+    }
 
+    //the port is closed when the device goes away
 	return 0;
 }
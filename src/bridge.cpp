@@ -0,0 +1,595 @@
+#include "bridge.h"
+
+#include <map>
+#include <deque>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <linux/uinput.h>
+
+#include "consolestyle.h"
+#include "serialport.h"
+#include "capture.h"
+#include "keytable.h"
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+void BridgeEventParser::parse(const std::string & data, std::vector<BridgeEvent> & events, std::string & text)
+{
+    m_buffer.append(data);
+    size_t index = 0;
+    while (index < m_buffer.size()) {
+        //anything outside of events is a command response
+        if (static_cast<uint8_t>(m_buffer[index]) != BRIDGE_EVENT_START) {
+            text.push_back(m_buffer[index++]);
+            continue;
+        }
+        //wait for the rest of the event
+        if (index + BRIDGE_EVENT_SIZE > m_buffer.size()) {
+            break;
+        }
+        uint8_t sum = 0;
+        for (size_t i = 1; i < BRIDGE_EVENT_SIZE - 1; ++i) {
+            sum += static_cast<uint8_t>(m_buffer[index + i]);
+        }
+        const uint8_t event = static_cast<uint8_t>(m_buffer[index + 1]);
+        const uint8_t type = event & 0xE0;
+        if (static_cast<uint8_t>(~sum) != static_cast<uint8_t>(m_buffer[index + BRIDGE_EVENT_SIZE - 1]) || (type != BridgeEvent::BUTTON_DOWN && type != BridgeEvent::BUTTON_UP && type != BridgeEvent::COIN)) {
+            //skip the start byte and look for the next event
+            m_badEvents++;
+            index++;
+            continue;
+        }
+        BridgeEvent bridgeEvent;
+        bridgeEvent.type = static_cast<BridgeEvent::Type>(type);
+        bridgeEvent.index = event & 0x1F;
+        for (size_t i = 0; i < 4; ++i) {
+            bridgeEvent.timeUs |= static_cast<uint32_t>(static_cast<uint8_t>(m_buffer[index + 2 + i])) << (8 * i);
+        }
+        events.push_back(bridgeEvent);
+        index += BRIDGE_EVENT_SIZE;
+    }
+    m_buffer.erase(0, index);
+}
+
+size_t BridgeEventParser::badEvents() const
+{
+    return m_badEvents;
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+/*!
+Linux key code for an Arduino key code and if shift must be pressed with it. Assumes a US keyboard layout like the Arduino Keyboard library.
+*/
+struct LinuxKey
+{
+    int code;
+    bool shift;
+};
+
+const std::map<uint16_t, LinuxKey> & linuxKeyMap()
+{
+    static std::map<uint16_t, LinuxKey> keyMap;
+    if (keyMap.empty()) {
+        const int letterCodes[] = {KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H, KEY_I, KEY_J, KEY_K, KEY_L, KEY_M,
+                                   KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R, KEY_S, KEY_T, KEY_U, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z};
+        for (int i = 0; i < 26; ++i) {
+            keyMap['a' + i] = {letterCodes[i], false};
+            keyMap['A' + i] = {letterCodes[i], true};
+        }
+        //KEY_1 ... KEY_9, KEY_0 are consecutive
+        const char digits[] = "1234567890";
+        const char shiftedDigits[] = "!@#$%^&*()";
+        for (int i = 0; i < 10; ++i) {
+            keyMap[digits[i]] = {KEY_1 + i, false};
+            keyMap[shiftedDigits[i]] = {KEY_1 + i, true};
+        }
+        const char symbols[] = " -=[]\\;'`,./";
+        const char shiftedSymbols[] = " _+{}|:\"~<>?";
+        const int symbolCodes[] = {KEY_SPACE, KEY_MINUS, KEY_EQUAL, KEY_LEFTBRACE, KEY_RIGHTBRACE, KEY_BACKSLASH, KEY_SEMICOLON, KEY_APOSTROPHE, KEY_GRAVE, KEY_COMMA, KEY_DOT, KEY_SLASH};
+        for (int i = 1; i < 12; ++i) {
+            keyMap[shiftedSymbols[i]] = {symbolCodes[i], true};
+        }
+        for (int i = 0; i < 12; ++i) {
+            keyMap[symbols[i]] = {symbolCodes[i], false};
+        }
+        //Arduino special keys, see MAMEDUINO_KEYS in keycodes.h
+        const std::pair<uint16_t, int> specialKeys[] = {
+            {128, KEY_LEFTCTRL}, {129, KEY_LEFTSHIFT}, {130, KEY_LEFTALT}, {131, KEY_LEFTMETA},
+            {132, KEY_RIGHTCTRL}, {133, KEY_RIGHTSHIFT}, {134, KEY_RIGHTALT}, {135, KEY_RIGHTMETA},
+            {0xB0, KEY_ENTER}, {0xB1, KEY_ESC}, {0xB2, KEY_BACKSPACE}, {0xB3, KEY_TAB}, {0xC1, KEY_CAPSLOCK},
+            {0xCC, KEY_F11}, {0xCD, KEY_F12}, {0xCE, KEY_SYSRQ}, {0xCF, KEY_SCROLLLOCK}, {0xD0, KEY_PAUSE},
+            {0xD1, KEY_INSERT}, {0xD2, KEY_HOME}, {0xD3, KEY_PAGEUP}, {0xD4, KEY_DELETE}, {0xD5, KEY_END}, {0xD6, KEY_PAGEDOWN},
+            {0xD7, KEY_RIGHT}, {0xD8, KEY_LEFT}, {0xD9, KEY_DOWN}, {0xDA, KEY_UP}, {0xDB, KEY_NUMLOCK},
+            {0xDC, KEY_KPSLASH}, {0xDD, KEY_KPASTERISK}, {0xDE, KEY_KPMINUS}, {0xDF, KEY_KPPLUS}, {0xE0, KEY_KPENTER},
+            {0xE1, KEY_KP1}, {0xE2, KEY_KP2}, {0xE3, KEY_KP3}, {0xE4, KEY_KP4}, {0xE5, KEY_KP5},
+            {0xE6, KEY_KP6}, {0xE7, KEY_KP7}, {0xE8, KEY_KP8}, {0xE9, KEY_KP9}, {0xEA, KEY_KP0}, {0xEB, KEY_KPDOT}, {0xED, KEY_COMPOSE},
+            {(CHAR_MEDIA << 8) | MEDIA_NEXT, KEY_NEXTSONG}, {(CHAR_MEDIA << 8) | MEDIA_PREVIOUS, KEY_PREVIOUSSONG},
+            {(CHAR_MEDIA << 8) | MEDIA_STOP, KEY_STOPCD}, {(CHAR_MEDIA << 8) | MEDIA_PLAY_PAUSE, KEY_PLAYPAUSE},
+            {(CHAR_MEDIA << 8) | MEDIA_MUTE, KEY_MUTE}, {(CHAR_MEDIA << 8) | MEDIA_VOLUME_UP, KEY_VOLUMEUP}, {(CHAR_MEDIA << 8) | MEDIA_VOLUME_DOWN, KEY_VOLUMEDOWN}
+        };
+        for (const auto & specialKey : specialKeys) {
+            keyMap[specialKey.first] = {specialKey.second, false};
+        }
+        //KEY_F1 ... KEY_F10 and KEY_F13 ... KEY_F24 are consecutive
+        for (int i = 0; i < 10; ++i) {
+            keyMap[0xC2 + i] = {KEY_F1 + i, false};
+        }
+        for (int i = 0; i < 12; ++i) {
+            keyMap[0xF0 + i] = {KEY_F13 + i, false};
+        }
+    }
+    return keyMap;
+}
+
+/*!
+Virtual keyboard created through /dev/uinput.
+*/
+class UinputKeyInjector : public KeyInjector
+{
+public:
+    ~UinputKeyInjector()
+    {
+        if (m_handle >= 0) {
+            ioctl(m_handle, UI_DEV_DESTROY);
+            close(m_handle);
+        }
+    }
+
+    bool open()
+    {
+        m_handle = ::open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+        if (m_handle < 0) {
+            return false;
+        }
+        //register all keys we can send
+        bool succeeded = ioctl(m_handle, UI_SET_EVBIT, EV_KEY) >= 0 && ioctl(m_handle, UI_SET_KEYBIT, KEY_LEFTSHIFT) >= 0;
+        for (const auto & entry : linuxKeyMap()) {
+            succeeded = succeeded && ioctl(m_handle, UI_SET_KEYBIT, entry.second.code) >= 0;
+        }
+        uinput_setup setup;
+        memset(&setup, 0, sizeof(setup));
+        setup.id.bustype = BUS_VIRTUAL;
+        strncpy(setup.name, "MAMEduino bridge", UINPUT_MAX_NAME_SIZE - 1);
+        return succeeded && ioctl(m_handle, UI_DEV_SETUP, &setup) >= 0 && ioctl(m_handle, UI_DEV_CREATE) >= 0;
+    }
+
+    bool sendKey(uint16_t key, bool pressed) override
+    {
+        const auto keyIt = linuxKeyMap().find(key);
+        if (keyIt == linuxKeyMap().cend()) {
+            return false;
+        }
+        //press shift first and release it last, then send everything in one report
+        input_event events[3];
+        size_t nrOfEvents = 0;
+        if (keyIt->second.shift && pressed) {
+            setEvent(events[nrOfEvents++], EV_KEY, KEY_LEFTSHIFT, 1);
+        }
+        setEvent(events[nrOfEvents++], EV_KEY, keyIt->second.code, pressed ? 1 : 0);
+        if (keyIt->second.shift && !pressed) {
+            setEvent(events[nrOfEvents++], EV_KEY, KEY_LEFTSHIFT, 0);
+        }
+        setEvent(events[nrOfEvents++], EV_SYN, SYN_REPORT, 0);
+        const ssize_t size = nrOfEvents * sizeof(input_event);
+        return write(m_handle, events, size) == size;
+    }
+
+private:
+    static void setEvent(input_event & event, uint16_t type, uint16_t code, int32_t value)
+    {
+        memset(&event, 0, sizeof(event));
+        event.type = type;
+        event.code = code;
+        event.value = value;
+    }
+
+    int m_handle = -1;
+};
+
+std::unique_ptr<KeyInjector> createUinputKeyInjector()
+{
+    std::unique_ptr<UinputKeyInjector> injector(new UinputKeyInjector);
+    if (!injector->open()) {
+        return nullptr;
+    }
+    return injector;
+}
+
+/*!
+Prints keys instead of sending them.
+*/
+class PrintKeyInjector : public KeyInjector
+{
+public:
+    bool sendKey(uint16_t key, bool pressed) override
+    {
+        const auto keyIt = linuxKeyMap().find(key);
+        if (keyIt == linuxKeyMap().cend()) {
+            return false;
+        }
+        const std::vector<uint8_t> keyBytes = key > 0xFF ? std::vector<uint8_t>{static_cast<uint8_t>(key >> 8), static_cast<uint8_t>(key)} : std::vector<uint8_t>{static_cast<uint8_t>(key)};
+        std::cout << "Key " << keysToString(keyBytes) << " -> " << (keyIt->second.shift ? "shift + " : "") << keyIt->second.code << (pressed ? " down" : " up") << std::endl;
+        return true;
+    }
+};
+
+std::unique_ptr<KeyInjector> createPrintKeyInjector()
+{
+    return std::unique_ptr<KeyInjector>(new PrintKeyInjector);
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+bool sendBridgeCommand(const int portHandle, bool on, TrafficCapture * capture)
+{
+    const unsigned char command[] = {COMMAND_SET_BRIDGE, static_cast<unsigned char>(on ? 1 : 0), COMMAND_TERMINATOR};
+    return writeToSerialPort(portHandle, command, sizeof(command), capture);
+}
+
+/*!
+One step of a binding played on the host: keys pressed together, how long they are held and how long to wait afterwards.
+A step without keys only waits.
+*/
+struct BridgeStep
+{
+    std::vector<uint16_t> keys;
+    int holdMs = 0;
+    int waitMs = 0;
+};
+
+/*!
+Steps of a binding in the order the device would send them. Keys the host can't send and hardware functions the
+device does itself are left out. Repeats are expanded, delays and hold times are kept like the device plays them.
+Key steps wait BRIDGE_KEY_GAP_MS instead of the 200ms of the device.
+*/
+std::vector<BridgeStep> bridgeSteps(const std::vector<uint8_t> & binding)
+{
+    std::vector<BridgeStep> steps;
+    BridgeStep lastStep;
+    bool hasLastStep = false;
+    int holdMs = BRIDGE_KEY_HOLD_MS;
+    for (size_t i = 0; i < binding.size(); ++i) {
+        const uint8_t code = binding.at(i);
+        if ((code == CHAR_DELAY || code == CHAR_HOLD || code == CHAR_REPEAT) && (i + 1) < binding.size()) {
+            const int operand = binding.at(++i) & ~MACRO_OPERAND;
+            if (code == CHAR_DELAY) {
+                lastStep = BridgeStep();
+                lastStep.waitMs = operand * MACRO_TIME_UNIT;
+                hasLastStep = true;
+                steps.push_back(lastStep);
+            }
+            else if (code == CHAR_HOLD) {
+                holdMs = operand * MACRO_TIME_UNIT;
+            }
+            else if (hasLastStep) {
+                //send the previous step again, like the device does
+                steps.insert(steps.end(), operand, lastStep);
+            }
+            continue;
+        }
+        //keys joined by CHAR_CHORD are pressed together. media keys are combined to one code
+        lastStep = BridgeStep();
+        for (; i < binding.size(); i += 2) {
+            uint16_t key = binding.at(i);
+            if (key == CHAR_MEDIA && (i + 1) < binding.size()) {
+                key = (CHAR_MEDIA << 8) | binding.at(++i);
+            }
+            if (linuxKeyMap().count(key) > 0) {
+                lastStep.keys.push_back(key);
+            }
+            if ((i + 2) >= binding.size() || binding.at(i + 1) != CHAR_CHORD) {
+                break;
+            }
+        }
+        lastStep.holdMs = holdMs;
+        lastStep.waitMs = BRIDGE_KEY_GAP_MS;
+        holdMs = BRIDGE_KEY_HOLD_MS;
+        hasLastStep = true;
+        //a step with only hardware functions is done by the device
+        if (!lastStep.keys.empty()) {
+            steps.push_back(lastStep);
+        }
+    }
+    return steps;
+}
+
+/*!
+Check if a binding is a single key or chord without delays, hold times or repeats. Such a binding is held down
+while its button is.
+*/
+bool isChordBinding(const std::vector<uint8_t> & binding)
+{
+    for (size_t i = 0; i < binding.size(); ++i) {
+        const uint8_t code = binding.at(i);
+        if (code == CHAR_DELAY || code == CHAR_HOLD || code == CHAR_REPEAT) {
+            return false;
+        }
+        if (code == CHAR_MEDIA) {
+            ++i;
+        }
+        if ((i + 1) < binding.size() && binding.at(++i) != CHAR_CHORD) {
+            return false;
+        }
+    }
+    return !binding.empty();
+}
+
+/*!
+Plays bindings step by step with their timing. Bindings are queued and played one after another, like the device does.
+*/
+class BridgePlayer
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit BridgePlayer(KeyInjector & injector)
+        : m_injector(injector)
+    {
+    }
+
+    void queue(const std::vector<BridgeStep> & steps)
+    {
+        m_steps.insert(m_steps.end(), steps.cbegin(), steps.cend());
+    }
+
+    /*!
+    Do all steps that are due.
+    \return Returns when the next step is due or Clock::time_point::max() if nothing is queued.
+    */
+    Clock::time_point update(Clock::time_point now)
+    {
+        while (true) {
+            if (m_state != IDLE && now < m_due) {
+                return m_due;
+            }
+            if (m_state == PRESSED) {
+                releaseKeys();
+                m_state = WAITING;
+                m_due = now + std::chrono::milliseconds(m_waitMs);
+                continue;
+            }
+            m_state = IDLE;
+            if (m_steps.empty()) {
+                return Clock::time_point::max();
+            }
+            const BridgeStep step = m_steps.front();
+            m_steps.pop_front();
+            m_waitMs = step.waitMs;
+            if (step.keys.empty()) {
+                m_state = WAITING;
+                m_due = now + std::chrono::milliseconds(step.waitMs);
+            }
+            else {
+                m_pressed = step.keys;
+                for (const auto key : m_pressed) {
+                    m_injector.sendKey(key, true);
+                }
+                m_state = PRESSED;
+                m_due = now + std::chrono::milliseconds(step.holdMs);
+            }
+        }
+    }
+
+    /*!
+    Release the keys of the current step and drop all queued steps.
+    */
+    void stop()
+    {
+        releaseKeys();
+        m_steps.clear();
+        m_state = IDLE;
+    }
+
+private:
+    void releaseKeys()
+    {
+        for (auto keyIt = m_pressed.crbegin(); keyIt != m_pressed.crend(); ++keyIt) {
+            m_injector.sendKey(*keyIt, false);
+        }
+        m_pressed.clear();
+    }
+
+    enum State {IDLE, PRESSED, WAITING};
+
+    KeyInjector & m_injector;
+    std::deque<BridgeStep> m_steps;
+    std::vector<uint16_t> m_pressed;
+    State m_state = IDLE;
+    Clock::time_point m_due;
+    int m_waitMs = 0;
+};
+
+/*!
+What a button is doing in bridge mode.
+*/
+struct BridgeButton
+{
+    bool down = false;
+    bool longPressSent = false;
+    std::chrono::steady_clock::time_point downTime;
+    std::vector<uint16_t> heldKeys; //!<Keys held down while the button is, if its binding is a single chord.
+};
+
+bool runBridge(const int portHandle, const DeviceConfig & config, KeyInjector & injector, bool verbose, TrafficCapture * capture)
+{
+    //switch device to bridge mode
+    std::string response;
+    if (!sendBridgeCommand(portHandle, true, capture) || readResponseFromSerial(portHandle, response, 200, capture) != RESPONSE_OK) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: The Arduino does not support bridge mode!" << ConsoleStyle() << std::endl;
+        return false;
+    }
+    //handle SIGINT and SIGTERM in the event loop
+    sigset_t signals;
+    sigset_t oldSignals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &oldSignals);
+    const int signalHandle = signalfd(-1, &signals, SFD_CLOEXEC);
+    //repeat SET_BRIDGE regularly so the device stays in bridge mode
+    const int timerHandle = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    itimerspec keepAlive = {{BRIDGE_KEEP_ALIVE_MS / 1000, (BRIDGE_KEEP_ALIVE_MS % 1000) * 1000000}, {BRIDGE_KEEP_ALIVE_MS / 1000, (BRIDGE_KEEP_ALIVE_MS % 1000) * 1000000}};
+    const int epollHandle = epoll_create1(EPOLL_CLOEXEC);
+    bool succeeded = signalHandle >= 0 && timerHandle >= 0 && epollHandle >= 0 && timerfd_settime(timerHandle, 0, &keepAlive, nullptr) >= 0;
+    for (const int handle : {portHandle, timerHandle, signalHandle}) {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = handle;
+        succeeded = succeeded && epoll_ctl(epollHandle, EPOLL_CTL_ADD, handle, &event) >= 0;
+    }
+    if (!succeeded) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to set up event loop (" << strerror(errno) << ")!" << ConsoleStyle() << std::endl;
+    }
+    else {
+        std::cout << "Bridge mode running. Press Ctrl+C to stop." << std::endl;
+    }
+    BridgeEventParser parser;
+    BridgePlayer player(injector);
+    std::vector<BridgeButton> buttons(config.buttonShort.size());
+    auto nextDue = std::chrono::steady_clock::time_point::max();
+    bool running = succeeded;
+    while (running) {
+        //wake up for the next macro step or long press
+        int timeoutMs = -1;
+        if (nextDue != std::chrono::steady_clock::time_point::max()) {
+            const auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(nextDue - std::chrono::steady_clock::now());
+            timeoutMs = remaining.count() > 0 ? static_cast<int>((remaining.count() + 999) / 1000) : 0;
+        }
+        epoll_event events[3];
+        const int nrOfEvents = epoll_wait(epollHandle, events, 3, timeoutMs);
+        if (nrOfEvents < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            succeeded = false;
+            break;
+        }
+        for (int i = 0; i < nrOfEvents && running; ++i) {
+            const int handle = events[i].data.fd;
+            if (handle == signalHandle) {
+                //take the signal, else it ends the program when the old signal mask is restored
+                signalfd_siginfo signalInfo;
+                if (read(signalHandle, &signalInfo, sizeof(signalInfo)) < 0) {
+                    succeeded = false;
+                }
+                running = false;
+            }
+            else if (handle == timerHandle) {
+                uint64_t expirations;
+                if (read(timerHandle, &expirations, sizeof(expirations)) > 0 && !sendBridgeCommand(portHandle, true, capture)) {
+                    succeeded = running = false;
+                }
+            }
+            else if (handle == portHandle) {
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Serial port closed!" << ConsoleStyle() << std::endl;
+                    succeeded = running = false;
+                    break;
+                }
+                char buffer[256];
+                const ssize_t bytesRead = readFromPort(portHandle, buffer, sizeof(buffer), capture);
+                if (bytesRead <= 0) {
+                    continue;
+                }
+                const auto receiveTime = std::chrono::steady_clock::now();
+                std::vector<BridgeEvent> bridgeEvents;
+                std::string text;
+                parser.parse(std::string(buffer, bytesRead), bridgeEvents, text);
+                if (text.find(COMMAND_NOK) != std::string::npos) {
+                    std::cout << ConsoleStyle(ConsoleStyle::YELLOW) << "Warning: The Arduino did not accept the bridge keep-alive." << ConsoleStyle() << std::endl;
+                }
+                for (const auto & bridgeEvent : bridgeEvents) {
+                    const uint8_t index = bridgeEvent.index;
+                    if (bridgeEvent.type == BridgeEvent::BUTTON_DOWN && index < buttons.size()) {
+                        BridgeButton & button = buttons[index];
+                        button.down = true;
+                        button.longPressSent = false;
+                        button.downTime = receiveTime;
+                        //without a long press binding the keys are sent right away. a single chord is held down while the button is
+                        if (config.buttonLong.at(index).empty() && isChordBinding(config.buttonShort.at(index))) {
+                            const auto steps = bridgeSteps(config.buttonShort.at(index));
+                            button.heldKeys = steps.empty() ? std::vector<uint16_t>() : steps.front().keys;
+                            for (const auto key : button.heldKeys) {
+                                injector.sendKey(key, true);
+                            }
+                        }
+                        else if (config.buttonLong.at(index).empty()) {
+                            player.queue(bridgeSteps(config.buttonShort.at(index)));
+                        }
+                    }
+                    else if (bridgeEvent.type == BridgeEvent::BUTTON_UP && index < buttons.size()) {
+                        BridgeButton & button = buttons[index];
+                        for (auto keyIt = button.heldKeys.crbegin(); keyIt != button.heldKeys.crend(); ++keyIt) {
+                            injector.sendKey(*keyIt, false);
+                        }
+                        button.heldKeys.clear();
+                        //with a long press binding we only know which binding to send when the button is released or held long enough
+                        if (button.down && !button.longPressSent && !config.buttonLong.at(index).empty()) {
+                            player.queue(bridgeSteps(config.buttonShort.at(index)));
+                        }
+                        button.down = false;
+                    }
+                    else if (bridgeEvent.type == BridgeEvent::COIN && index < config.coin.size()) {
+                        player.queue(bridgeSteps(config.coin.at(index)));
+                    }
+                    player.update(std::chrono::steady_clock::now());
+                    if (verbose) {
+                        const char * typeNames[] = {"Button down", "Button up", "Coin"};
+                        const std::chrono::duration<double, std::milli> injectTime = std::chrono::steady_clock::now() - receiveTime;
+                        std::cout << typeNames[bridgeEvent.type >> 5] << " " << static_cast<int>(bridgeEvent.index) << " at " << bridgeEvent.timeUs << "us, keys sent after "
+                                  << std::fixed << std::setprecision(3) << injectTime.count() << "ms." << std::endl;
+                    }
+                }
+            }
+        }
+        //send the long press binding of buttons held long enough, then do the macro steps that are due
+        const auto now = std::chrono::steady_clock::now();
+        nextDue = std::chrono::steady_clock::time_point::max();
+        for (size_t index = 0; index < buttons.size(); ++index) {
+            BridgeButton & button = buttons[index];
+            if (button.down && !button.longPressSent && !config.buttonLong.at(index).empty()) {
+                const auto longPressTime = button.downTime + std::chrono::milliseconds(BRIDGE_LONG_PRESS_MS);
+                if (now >= longPressTime) {
+                    button.longPressSent = true;
+                    player.queue(bridgeSteps(config.buttonLong.at(index)));
+                }
+                else {
+                    nextDue = std::min(nextDue, longPressTime);
+                }
+            }
+        }
+        nextDue = std::min(nextDue, player.update(now));
+    }
+    //release keys still held and switch device back to keyboard mode
+    player.stop();
+    for (const auto & button : buttons) {
+        for (auto keyIt = button.heldKeys.crbegin(); keyIt != button.heldKeys.crend(); ++keyIt) {
+            injector.sendKey(*keyIt, false);
+        }
+    }
+    if (sendBridgeCommand(portHandle, false, capture)) {
+        readResponseFromSerial(portHandle, response, 200, capture);
+    }
+    if (parser.badEvents() > 0) {
+        std::cout << ConsoleStyle(ConsoleStyle::YELLOW) << "Warning: " << parser.badEvents() << " broken event(s) received." << ConsoleStyle() << std::endl;
+    }
+    for (const int handle : {epollHandle, timerHandle, signalHandle}) {
+        if (handle >= 0) {
+            close(handle);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &oldSignals, nullptr);
+    return succeeded;
+}
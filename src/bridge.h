@@ -0,0 +1,106 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include <stdint.h>
+
+#include "deviceconfig.h"
+
+class TrafficCapture;
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+//The SET_BRIDGE command switches the device to bridge mode. The device then sends button and coin events instead of
+//keystrokes and the host injects the keys. The command must be repeated within BRIDGE_TIMEOUT_MS to stay in bridge mode.
+//An event is: BRIDGE_EVENT_START, event byte, 32-bit micros() time stamp (LSB first), check byte.
+//The check byte is the inverted sum of the event byte and the time stamp bytes.
+const uint8_t BRIDGE_EVENT_START = 0xE5; //!<First byte of an event.
+const size_t BRIDGE_EVENT_SIZE = 7; //!<Size of an event in bytes.
+const int BRIDGE_TIMEOUT_MS = 3000; //!<The device leaves bridge mode if SET_BRIDGE is not repeated within this time.
+const int BRIDGE_KEEP_ALIVE_MS = 1000; //!<How often the host repeats SET_BRIDGE.
+const int BRIDGE_LONG_PRESS_MS = 4000; //!<A button held this long sends its long press binding, like LONG_PRESS_DURATION of the device.
+const int BRIDGE_KEY_HOLD_MS = 20; //!<How long keys of a macro step are held, unless the step has a hold time. One frame at 50Hz.
+const int BRIDGE_KEY_GAP_MS = 20; //!<How long to wait after the keys of a macro step are released.
+
+/*!
+Button or coin event received from the device.
+*/
+struct BridgeEvent
+{
+    enum Type {BUTTON_DOWN = 0x00, BUTTON_UP = 0x20, COIN = 0x40};
+    Type type = BUTTON_DOWN;
+    uint8_t index = 0; //!<Button or coin number.
+    uint32_t timeUs = 0; //!<Device time stamp in microseconds.
+};
+
+/*!
+Splits the data received in bridge mode into events and command responses.
+*/
+class BridgeEventParser
+{
+public:
+    /*!
+    Parse received data.
+    \param[in] data Data received from the serial port.
+    \param[out] events Receives the complete events.
+    \param[out] text Receives the data that is not part of an event, e.g. command responses.
+    */
+    void parse(const std::string & data, std::vector<BridgeEvent> & events, std::string & text);
+
+    /*!
+    Number of events that were thrown away because of a wrong check byte or an unknown event byte.
+    */
+    size_t badEvents() const;
+
+private:
+    std::string m_buffer;
+    size_t m_badEvents = 0;
+};
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+/*!
+Sends key presses to the system. Keys are Arduino key codes as used in the bindings.
+*/
+class KeyInjector
+{
+public:
+    virtual ~KeyInjector() {}
+
+    /*!
+    Press or release a key. Shifted characters press shift too. Media keys are CHAR_MEDIA << 8 | usage.
+    \return Returns false if the key could not be sent.
+    */
+    virtual bool sendKey(uint16_t key, bool pressed) = 0;
+};
+
+/*!
+Creates a virtual keyboard through /dev/uinput.
+\return Returns the injector or nullptr if /dev/uinput could not be used.
+*/
+std::unique_ptr<KeyInjector> createUinputKeyInjector();
+
+/*!
+Prints the keys that would be sent instead of sending them. Used for testing without /dev/uinput.
+*/
+std::unique_ptr<KeyInjector> createPrintKeyInjector();
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+/*!
+Switch the device to bridge mode and inject the keys bound to button and coin events until SIGINT or SIGTERM arrive.
+A button without long press binding whose short press binding is a single key or chord holds it down while the button
+is. Other short press bindings are played with their delays, hold times and repeats when the button goes down, or when
+it is released if the button has a long press binding. A button held for BRIDGE_LONG_PRESS_MS plays its long press
+binding. Coins play their binding once per credit. Bindings are played one after another. Hardware functions like
+PIN_POWER are left to the device.
+\param[in] portHandle Handle of the open serial port.
+\param[in] config Bindings of the device.
+\param[in] injector Used to send the keys.
+\param[in] verbose Print every event and how long it took to send its keys.
+\param[in] capture Records the serial traffic if not nullptr.
+\return Returns false if bridge mode could not be started or the serial port failed.
+*/
+bool runBridge(const int portHandle, const DeviceConfig & config, KeyInjector & injector, bool verbose = false, TrafficCapture * capture = nullptr);
@@ -0,0 +1,106 @@
+#include "capture.h"
+
+#include <iterator>
+#include <algorithm>
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+void writeNumber(std::ostream & out, uint64_t value)
+{
+    //7 bits per byte, highest bit set if more bytes follow
+    do {
+        const uint8_t bits = value & 0x7F;
+        value >>= 7;
+        out.put(static_cast<char>(value != 0 ? (bits | 0x80) : bits));
+    } while (value != 0);
+}
+
+bool readNumber(std::vector<uint8_t>::const_iterator & it, std::vector<uint8_t>::const_iterator end, uint64_t & value)
+{
+    value = 0;
+    for (int shift = 0; it != end && shift < 64; shift += 7) {
+        const uint8_t bits = *it++;
+        value |= static_cast<uint64_t>(bits & 0x7F) << shift;
+        if ((bits & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+bool TrafficCapture::open(const std::string & fileName)
+{
+    close();
+    m_file.open(fileName, std::ios::binary | std::ios::trunc);
+    m_file << TRACE_MAGIC;
+    m_file.put(static_cast<char>(TRACE_VERSION));
+    m_lastTime = std::chrono::steady_clock::now();
+    if (!m_file) {
+        m_file.close();
+        return false;
+    }
+    return true;
+}
+
+void TrafficCapture::close()
+{
+    if (m_file.is_open()) {
+        m_file.close();
+    }
+}
+
+bool TrafficCapture::isOpen() const
+{
+    return m_file.is_open();
+}
+
+void TrafficCapture::record(TraceDirection direction, const void * data, size_t size)
+{
+    if (!m_file.is_open()) {
+        return;
+    }
+    //store the time to the previous record, which is small and fits in one or two bytes most of the time
+    const auto now = std::chrono::steady_clock::now();
+    m_file.put(static_cast<char>(direction));
+    writeNumber(m_file, std::chrono::duration_cast<std::chrono::microseconds>(now - m_lastTime).count());
+    writeNumber(m_file, size);
+    m_file.write(static_cast<const char *>(data), size);
+    m_lastTime = now;
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+bool readTrace(const std::string & fileName, std::vector<TraceRecord> & records)
+{
+    records.clear();
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    const std::vector<uint8_t> trace((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (trace.size() < TRACE_MAGIC.size() + 1 || !std::equal(TRACE_MAGIC.cbegin(), TRACE_MAGIC.cend(), trace.cbegin())
+        || trace.at(TRACE_MAGIC.size()) != TRACE_VERSION) {
+        return false;
+    }
+    auto it = trace.cbegin() + TRACE_MAGIC.size() + 1;
+    uint64_t timeUs = 0;
+    while (it != trace.cend()) {
+        TraceRecord record;
+        const uint8_t direction = *it++;
+        uint64_t deltaUs;
+        uint64_t size;
+        if (direction > TRACE_FROM_DEVICE || !readNumber(it, trace.cend(), deltaUs) || !readNumber(it, trace.cend(), size)
+            || size > static_cast<uint64_t>(std::distance(it, trace.cend()))) {
+            return false;
+        }
+        timeUs += deltaUs;
+        record.direction = static_cast<TraceDirection>(direction);
+        record.timeUs = timeUs;
+        record.data.assign(it, it + size);
+        it += size;
+        records.push_back(record);
+    }
+    return true;
+}
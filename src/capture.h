@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <chrono>
+
+#include <stdint.h>
+#include <stddef.h>
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+//A trace records all bytes sent to and received from a device with their time, so field issues can be replayed.
+//A trace file starts with TRACE_MAGIC and TRACE_VERSION. Then follow records of: direction byte, time since the previous
+//record in microseconds, data length, data. Times and lengths are unsigned LEB128 numbers, so most records have a 3-byte header.
+const std::string TRACE_MAGIC = "MAMEtrc"; //!<First bytes of a trace file.
+const uint8_t TRACE_VERSION = 1; //!<Trace format version after TRACE_MAGIC.
+
+enum TraceDirection {TRACE_TO_DEVICE = 0, TRACE_FROM_DEVICE = 1};
+
+struct TraceRecord
+{
+    TraceDirection direction = TRACE_TO_DEVICE;
+    uint64_t timeUs = 0; //!<Time since the start of the capture.
+    std::vector<uint8_t> data; //!<Bytes written or read at once.
+};
+
+/*!
+Writes the traffic of one device to a trace file.
+*/
+class TrafficCapture
+{
+public:
+    /*!
+    Create the trace file. A file already open is closed first.
+    \return Returns false if the file could not be created.
+    */
+    bool open(const std::string & fileName);
+
+    /*!
+    Write the rest of the trace and close the file.
+    */
+    void close();
+
+    bool isOpen() const;
+
+    /*!
+    Add a record for data written to or read from the device now.
+    */
+    void record(TraceDirection direction, const void * data, size_t size);
+
+private:
+    std::ofstream m_file;
+    std::chrono::steady_clock::time_point m_lastTime;
+};
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+/*!
+Read all records of a trace file. Record times are converted to the time since the start of the capture.
+\return Returns false if the file could not be read or is not a trace. records holds the records up to the error.
+*/
+bool readTrace(const std::string & fileName, std::vector<TraceRecord> & records);
@@ -0,0 +1,376 @@
+#include <string>
+#include <map>
+#include <vector>
+#include <iostream>
+#include <chrono>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "MAMEduino.h"
+#include "consolestyle.h"
+#include "serialport.h"
+#include "daemonsocket.h"
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+const int RECONNECT_INTERVAL_MS = 1000; //!<How often to try to reopen the serial port after it was lost.
+const int RESPONSE_TIMEOUT_MS = 1000; //!<How long to wait for a response from the Arduino.
+
+struct Client
+{
+    int socketHandle; //!<Connected client socket.
+    std::string input; //!<Data received from the client, but not yet processed.
+};
+std::vector<Client> clients; //!<Currently connected clients.
+
+std::string serialPortName = ""; //!<Serial port device name.
+bool autodetectPort = false; //!<Set to true to autodetect the port upon start and after it was lost.
+bool beVerbose = false; //!<Set to true to display more output.
+bool runInBackground = false; //!<Set to true to detach from the terminal.
+
+int portHandle = -1; //!<Handle of the open serial port or -1 if the port is not open.
+termios oldOptions; //!<Options of the serial port before it was opened.
+std::chrono::steady_clock::time_point lastConnectAttempt; //!<Last time we tried to open the serial port.
+std::map<std::string, std::string> lastConfig; //!<Last successful setting command for every button/coin/reject, re-applied after reconnecting.
+
+volatile sig_atomic_t keepRunning = 1; //!<Set to 0 by SIGINT/SIGTERM to shut down.
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+void printVersion()
+{
+	std::cout << ConsoleStyle(ConsoleStyle::GREEN) << "mameduinod " << MAMEDUINO_VERSION_STRING << ConsoleStyle() << " - The Arduino Leonardo MAME interface daemon" << std::endl;
+}
+
+void printUsage()
+{
+    std::cout << "Usage:" << ConsoleStyle(ConsoleStyle::CYAN) << " mameduinod <SERIAL_DEVICE> [-v] [-b]" << ConsoleStyle() << std::endl;
+    std::cout << "SERIAL_DEVICE should be e.g. " << ConsoleStyle(ConsoleStyle::CYAN) << "/dev/ttyACM0" << ConsoleStyle() <<
+                 ", or use " << ConsoleStyle(ConsoleStyle::CYAN) << "-a" << ConsoleStyle() << " to auto-detect it." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-v" << ConsoleStyle() << " - Verbose output." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-b" << ConsoleStyle() << " - Run in background." << std::endl;
+    std::cout << ConsoleStyle(ConsoleStyle::CYAN) << "-h/-?/--help" << ConsoleStyle() << " - Show this help." << std::endl;
+    std::cout << "The daemon keeps the serial port open and listens on " << ConsoleStyle(ConsoleStyle::CYAN) << getDaemonSocketName() << ConsoleStyle() << "." << std::endl;
+    std::cout << "mameduino uses the daemon automatically when it is running. Set MAMEDUINO_SOCKET to use a different socket." << std::endl;
+}
+
+bool readArguments(int argc, const char * argv[])
+{
+    //first argument must be device, autodetect or help command
+    std::string argument = argv[1];
+    if (argument.length() > 5 && argument.substr(0, 5) == "/dev/") {
+        serialPortName = argument;
+    }
+    else if (argument == "-a") {
+        autodetectPort = true;
+    }
+    else if (argument == "-?" || argument == "-h" || argument == "--help") {
+        printUsage();
+        exit(0);
+    }
+    else {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: First argument must be a serial port device string." << ConsoleStyle() << std::endl;
+        return false;
+    }
+    for (int i = 2; i < argc; ++i) {
+        argument = argv[i];
+        if (argument == "-v") {
+            beVerbose = true;
+        }
+        else if (argument == "-b") {
+            runInBackground = true;
+        }
+        else {
+            std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Unknown option \"" << argument << "\"!" << ConsoleStyle() << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void signalHandler(int /*signal*/)
+{
+    keepRunning = 0;
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+void disconnectSerialPort()
+{
+    if (portHandle >= 0) {
+        std::cout << ConsoleStyle(ConsoleStyle::YELLOW) << "Lost connection to serial port " << serialPortName << "." << ConsoleStyle() << std::endl;
+        closeSerialPort(portHandle, &oldOptions);
+        portHandle = -1;
+    }
+}
+
+ResponseResult sendToSerialPort(const std::string & command, std::string & response)
+{
+    //throw away anything the Arduino sent on its own
+    tcflush(portHandle, TCIFLUSH);
+    const std::string data = command + COMMAND_TERMINATOR;
+    if (write(portHandle, data.data(), data.size()) != static_cast<ssize_t>(data.size())) {
+        disconnectSerialPort();
+        return RESPONSE_ERROR;
+    }
+    const ResponseResult result = readResponseFromSerial(portHandle, response, RESPONSE_TIMEOUT_MS);
+    if (result == RESPONSE_ERROR) {
+        disconnectSerialPort();
+    }
+    return result;
+}
+
+bool connectSerialPort()
+{
+    lastConnectAttempt = std::chrono::steady_clock::now();
+    if (autodetectPort) {
+        std::string detectedPortName;
+        if (!detectSerialPort(detectedPortName, beVerbose)) {
+            return false;
+        }
+        serialPortName = detectedPortName;
+    }
+    else if (!serialPortExists(serialPortName)) {
+        return false;
+    }
+    if (!openSerialPort(portHandle, serialPortName, &oldOptions, beVerbose)) {
+        portHandle = -1;
+        return false;
+    }
+    //keep other programs from opening the port while we use it
+    ioctl(portHandle, TIOCEXCL);
+    std::cout << ConsoleStyle(ConsoleStyle::GREEN) << "Connected to serial port " << serialPortName << "." << ConsoleStyle() << std::endl;
+    //re-apply the configuration the device had before it was lost
+    for (const auto & setting : lastConfig) {
+        std::string response;
+        if (sendToSerialPort(setting.second, response) != RESPONSE_OK) {
+            std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to re-apply configuration!" << ConsoleStyle() << std::endl;
+            return portHandle >= 0;
+        }
+    }
+    if (beVerbose && !lastConfig.empty()) {
+        std::cout << "Re-applied " << lastConfig.size() << " setting(s)." << std::endl;
+    }
+    return true;
+}
+
+/*!
+Get the key under which a setting command is stored in lastConfig.
+\return Returns an empty string if the command does not change a setting.
+*/
+std::string getSettingKey(const std::string & command)
+{
+    const uint8_t commandByte = command.empty() ? 0 : static_cast<uint8_t>(command.at(0));
+    if (commandByte == COMMAND_SET_COIN_REJECT) {
+        return command.substr(0, 1);
+    }
+    else if (command.length() >= 2 && (commandByte == COMMAND_SET_BUTTON_SHORT || commandByte == COMMAND_SET_BUTTON_LONG || commandByte == COMMAND_SET_COIN)) {
+        return command.substr(0, 2);
+    }
+    return "";
+}
+
+/*!
+Find the terminator of the first command in the input of a client. Like the device, the byte after a command that
+takes an argument is never a terminator, because e.g. button 10 is the same byte as '\n'.
+\return Returns std::string::npos if the command is not complete yet.
+*/
+size_t findCommandEnd(const std::string & input)
+{
+    if (input.empty()) {
+        return std::string::npos;
+    }
+    switch (static_cast<uint8_t>(input.at(0))) {
+        case COMMAND_SET_COIN_REJECT:
+        case COMMAND_READ_TELEMETRY:
+        case COMMAND_READ_COIN_COUNTERS:
+        case COMMAND_SET_BRIDGE:
+        case COMMAND_SET_BUTTON_SHORT:
+        case COMMAND_SET_BUTTON_LONG:
+        case COMMAND_SET_COIN:
+            return input.find(COMMAND_TERMINATOR, 2);
+        default:
+            return input.find(COMMAND_TERMINATOR);
+    }
+}
+
+std::string executeCommand(const std::string & command)
+{
+    std::string response;
+    if (command == std::string(1, DAEMON_GET_PORT)) {
+        return serialPortName + COMMAND_OK;
+    }
+    if (portHandle < 0 && !connectSerialPort()) {
+        return COMMAND_NOK;
+    }
+    const ResponseResult result = sendToSerialPort(command, response);
+    if (beVerbose) {
+        std::cout << "Command '" << command.at(0) << "' -> " << (result == RESPONSE_OK ? "OK" : (result == RESPONSE_NOK ? "NK" : "failed")) << std::endl;
+    }
+    if (result == RESPONSE_OK) {
+        const std::string settingKey = getSettingKey(command);
+        if (!settingKey.empty()) {
+            lastConfig[settingKey] = command;
+        }
+        return response + COMMAND_OK;
+    }
+    return response + COMMAND_NOK;
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+int createListenSocket(const std::string & socketName)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketName.length() >= sizeof(address.sun_path)) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Socket name " << socketName << " is too long!" << ConsoleStyle() << std::endl;
+        return -1;
+    }
+    strncpy(address.sun_path, socketName.c_str(), sizeof(address.sun_path) - 1);
+    //check if another daemon is already listening
+    int socketHandle;
+    std::string otherPortName;
+    if (connectToDaemon(socketHandle, otherPortName)) {
+        close(socketHandle);
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Another daemon is already using " << socketName << "!" << ConsoleStyle() << std::endl;
+        return -1;
+    }
+    //remove stale socket file and listen
+    unlink(socketName.c_str());
+    socketHandle = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socketHandle < 0 || bind(socketHandle, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 || listen(socketHandle, 16) != 0) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to listen on " << socketName << " (" << strerror(errno) << ")!" << ConsoleStyle() << std::endl;
+        if (socketHandle >= 0) {
+            close(socketHandle);
+        }
+        return -1;
+    }
+    return socketHandle;
+}
+
+void removeClient(size_t index)
+{
+    close(clients.at(index).socketHandle);
+    clients.erase(clients.begin() + index);
+}
+
+int main(int argc, const char * argv[])
+{
+    printVersion();
+
+    if (argc < 2 || !readArguments(argc, argv)) {
+        std::cout << std::endl;
+        printUsage();
+        return -1;
+    }
+
+    const std::string socketName = getDaemonSocketName();
+    const int listenHandle = createListenSocket(socketName);
+    if (listenHandle < 0) {
+        return -2;
+    }
+    if (runInBackground && daemon(0, 1) != 0) {
+        std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to run in background!" << ConsoleStyle() << std::endl;
+        return -2;
+    }
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+    signal(SIGPIPE, SIG_IGN);
+    std::cout << "Listening on " << socketName << "." << std::endl;
+
+    if (!connectSerialPort()) {
+        std::cout << ConsoleStyle(ConsoleStyle::YELLOW) << "No MAMEduino found yet. Retrying every " << RECONNECT_INTERVAL_MS << "ms." << ConsoleStyle() << std::endl;
+    }
+
+    while (keepRunning) {
+        //wait for new clients, client commands or the serial port going away
+        std::vector<pollfd> pollInfos;
+        pollInfos.push_back({listenHandle, POLLIN, 0});
+        for (const auto & client : clients) {
+            pollInfos.push_back({client.socketHandle, POLLIN, 0});
+        }
+        if (portHandle >= 0) {
+            pollInfos.push_back({portHandle, POLLIN, 0});
+        }
+        if (poll(pollInfos.data(), pollInfos.size(), portHandle >= 0 ? -1 : RECONNECT_INTERVAL_MS) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to wait for events (" << strerror(errno) << ")!" << ConsoleStyle() << std::endl;
+            break;
+        }
+        //check serial port for disconnection. data the Arduino sends on its own is thrown away
+        if (portHandle >= 0) {
+            const short portEvents = pollInfos.back().revents;
+            char buffer[256];
+            if ((portEvents & (POLLERR | POLLHUP | POLLNVAL)) || ((portEvents & POLLIN) && read(portHandle, buffer, sizeof(buffer)) <= 0)) {
+                disconnectSerialPort();
+            }
+        }
+        else if (std::chrono::steady_clock::now() - lastConnectAttempt >= std::chrono::milliseconds(RECONNECT_INTERVAL_MS)) {
+            connectSerialPort();
+        }
+        //read data from clients
+        for (size_t i = clients.size(); i > 0; --i) {
+            const short clientEvents = pollInfos.at(i).revents;
+            if (clientEvents & (POLLIN | POLLERR | POLLHUP)) {
+                char buffer[256];
+                const ssize_t bytesRead = read(clients.at(i - 1).socketHandle, buffer, sizeof(buffer));
+                if (bytesRead <= 0) {
+                    removeClient(i - 1);
+                    continue;
+                }
+                clients.at(i - 1).input.append(buffer, bytesRead);
+            }
+        }
+        //accept new clients
+        if (pollInfos.front().revents & POLLIN) {
+            const int clientHandle = accept(listenHandle, nullptr, nullptr);
+            if (clientHandle >= 0) {
+                clients.push_back({clientHandle, ""});
+            }
+        }
+        //execute one command per client and round, so no client can block the others
+        bool commandsPending = true;
+        while (commandsPending && keepRunning) {
+            commandsPending = false;
+            for (size_t i = 0; i < clients.size(); ++i) {
+                std::string & input = clients.at(i).input;
+                const size_t terminatorIndex = findCommandEnd(input);
+                if (terminatorIndex == std::string::npos) {
+                    continue;
+                }
+                const std::string command = input.substr(0, terminatorIndex);
+                input.erase(0, terminatorIndex + 1);
+                commandsPending = commandsPending || findCommandEnd(input) != std::string::npos;
+                const std::string reply = command.empty() ? COMMAND_NOK : executeCommand(command);
+                if (send(clients.at(i).socketHandle, reply.data(), reply.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(reply.size())) {
+                    removeClient(i--);
+                }
+            }
+        }
+    }
+
+    //clean up
+    std::cout << "Shutting down." << std::endl;
+    for (size_t i = clients.size(); i > 0; --i) {
+        removeClient(i - 1);
+    }
+    close(listenHandle);
+    unlink(socketName.c_str());
+    if (portHandle >= 0) {
+        closeSerialPort(portHandle, &oldOptions);
+    }
+    return 0;
+}
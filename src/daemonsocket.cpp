@@ -0,0 +1,51 @@
+#include "daemonsocket.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "serialport.h"
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+std::string getDaemonSocketName()
+{
+    const char * socketName = getenv("MAMEDUINO_SOCKET");
+    if (socketName != nullptr && socketName[0] != '\0') {
+        return socketName;
+    }
+    const char * runtimeDirectory = getenv("XDG_RUNTIME_DIR");
+    if (runtimeDirectory != nullptr && runtimeDirectory[0] != '\0') {
+        return std::string(runtimeDirectory) + "/mameduino.sock";
+    }
+    return "/tmp/mameduino-" + std::to_string(getuid()) + ".sock";
+}
+
+bool connectToDaemon(int & socketHandle, std::string & portName)
+{
+    const std::string socketName = getDaemonSocketName();
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketName.length() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    strncpy(address.sun_path, socketName.c_str(), sizeof(address.sun_path) - 1);
+    socketHandle = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socketHandle < 0) {
+        return false;
+    }
+    if (connect(socketHandle, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+        close(socketHandle);
+        return false;
+    }
+    //ask daemon for its serial port
+    const unsigned char portCommand[] = {DAEMON_GET_PORT, COMMAND_TERMINATOR};
+    if (write(socketHandle, portCommand, sizeof(portCommand)) != sizeof(portCommand) || readResponseFromSerial(socketHandle, portName) != RESPONSE_OK) {
+        close(socketHandle);
+        return false;
+    }
+    return true;
+}
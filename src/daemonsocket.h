@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+//Clients talk to mameduinod over a Unix domain stream socket using the same commands and OK/NK responses as over the serial port.
+//Commands from all clients are sent to the serial port one after another.
+const char DAEMON_GET_PORT = '@'; //!<Command handled by the daemon itself. Responds with the serial port device name.
+const int DAEMON_RESPONSE_TIME_MS = 5000; //!<How long clients wait for a response. The daemon might be busy with commands from other clients.
+
+/*!
+Get the name of the Unix domain socket mameduinod listens on.
+This is $MAMEDUINO_SOCKET if set, else $XDG_RUNTIME_DIR/mameduino.sock or /tmp/mameduino-UID.sock.
+*/
+std::string getDaemonSocketName();
+
+/*!
+Connect to a running mameduinod and ask it for the serial port it is using. Does not print anything.
+\param[out] socketHandle Receives the handle of the connected socket.
+\param[out] portName Receives the serial port device name the daemon is using.
+\return Returns true if a daemon is running and answered.
+*/
+bool connectToDaemon(int & socketHandle, std::string & portName);
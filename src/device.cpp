@@ -0,0 +1,261 @@
+#include "device.h"
+
+#include <chrono>
+#include <memory>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "framedprotocol.h"
+#include "daemonsocket.h"
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+MAMEduinoDevice::MAMEduinoDevice()
+    : m_thread(&MAMEduinoDevice::run, this)
+{
+}
+
+MAMEduinoDevice::~MAMEduinoDevice()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_callsQueued.notify_one();
+    m_thread.join();
+}
+
+std::future<DeviceInfo> MAMEduinoDevice::open(const DeviceOptions & options)
+{
+    auto promise = std::make_shared<std::promise<DeviceInfo>>();
+    std::future<DeviceInfo> result = promise->get_future();
+    open(options, [promise](const DeviceInfo & info) { promise->set_value(info); });
+    return result;
+}
+
+void MAMEduinoDevice::open(const DeviceOptions & options, OpenCallback callback)
+{
+    Call call;
+    call.task = [this, options, callback]() {
+        closePort();
+        const DeviceInfo info = openPort(options);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_info = info;
+        }
+        callback(info);
+    };
+    enqueue(std::move(call));
+}
+
+std::future<void> MAMEduinoDevice::close()
+{
+    auto promise = std::make_shared<std::promise<void>>();
+    std::future<void> result = promise->get_future();
+    Call call;
+    call.task = [this, promise]() {
+        closePort();
+        promise->set_value();
+    };
+    enqueue(std::move(call));
+    return result;
+}
+
+DeviceInfo MAMEduinoDevice::info() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_info;
+}
+
+std::future<CommandResult> MAMEduinoDevice::send(const std::vector<uint8_t> & command)
+{
+    auto promise = std::make_shared<std::promise<CommandResult>>();
+    std::future<CommandResult> result = promise->get_future();
+    send(command, [promise](const CommandResult & commandResult) { promise->set_value(commandResult); });
+    return result;
+}
+
+void MAMEduinoDevice::send(const std::vector<uint8_t> & command, CommandCallback callback)
+{
+    Call call;
+    call.command = command;
+    call.callback = callback;
+    enqueue(std::move(call));
+}
+
+std::future<bool> MAMEduinoDevice::runBridge(const DeviceConfig & config, KeyInjector & injector, bool verbose)
+{
+    auto promise = std::make_shared<std::promise<bool>>();
+    std::future<bool> result = promise->get_future();
+    Call call;
+    call.task = [this, promise, &config, &injector, verbose]() {
+        //events can't be passed through the daemon
+        promise->set_value(m_portHandle >= 0 && !m_usesDaemon && ::runBridge(m_portHandle, config, injector, verbose, &m_capture));
+    };
+    enqueue(std::move(call));
+    return result;
+}
+
+void MAMEduinoDevice::enqueue(Call && call)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_calls.push_back(std::move(call));
+    }
+    m_callsQueued.notify_one();
+}
+
+void MAMEduinoDevice::run()
+{
+    while (true) {
+        //take the next task or all commands queued before the next task
+        std::vector<Call> calls;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_callsQueued.wait(lock, [this]() { return !m_calls.empty() || m_stopping; });
+            if (m_calls.empty()) {
+                break;
+            }
+            do {
+                calls.push_back(std::move(m_calls.front()));
+                m_calls.pop_front();
+            } while (!calls.front().task && !m_calls.empty() && !m_calls.front().task);
+        }
+        if (calls.front().task) {
+            calls.front().task();
+        }
+        else {
+            sendCommands(calls);
+        }
+    }
+    closePort();
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+DeviceInfo MAMEduinoDevice::openPort(const DeviceOptions & options)
+{
+    DeviceInfo info;
+    //use the daemon if one is running for the same port, else open the port ourselves
+    int socketHandle;
+    std::string daemonPortName;
+    if (options.useDaemon && connectToDaemon(socketHandle, daemonPortName)) {
+        if (options.portName.empty() || daemonPortName == options.portName) {
+            m_portHandle = socketHandle;
+            info.portName = daemonPortName;
+            info.usesDaemon = true;
+        }
+        else {
+            ::close(socketHandle);
+        }
+    }
+    if (!info.usesDaemon) {
+        info.portName = options.portName;
+        if (info.portName.empty() && !detectSerialPort(info.portName)) {
+            info.result = OPEN_NOT_FOUND;
+            return info;
+        }
+        m_portHandle = ::open(info.portName.c_str(), O_RDWR | O_NOCTTY | O_NDELAY);
+        if (m_portHandle < 0) {
+            return info;
+        }
+        if (!setSerialPortOptions(m_portHandle, &m_oldOptions)) {
+            ::close(m_portHandle);
+            m_portHandle = -1;
+            return info;
+        }
+    }
+    m_usesDaemon = info.usesDaemon;
+    //record everything from the version check on
+    if (!options.captureFileName.empty() && !m_capture.open(options.captureFileName)) {
+        info.result = OPEN_CAPTURE_FAILED;
+        closePort();
+        return info;
+    }
+    m_responseTimeMs = info.usesDaemon ? DAEMON_RESPONSE_TIME_MS : options.responseTimeMs;
+    //check what the device supports and how many inputs it has
+    const unsigned char versionCommand[] = {COMMAND_CHECK_VERSION, COMMAND_TERMINATOR};
+    if (!writeToPort(m_portHandle, versionCommand, sizeof(versionCommand), &m_capture) || readResponseFromSerial(m_portHandle, info.versionString, m_responseTimeMs, &m_capture) != RESPONSE_OK) {
+        info.versionString.clear();
+    }
+    info.reportsLayout = parseDeviceLimits(info.versionString, info.limits);
+    info.usesFramedProtocol = !info.usesDaemon && !options.forceTextProtocol && supportsFramedProtocol(info.versionString);
+    m_usesFramedProtocol = info.usesFramedProtocol;
+    info.result = OPEN_OK;
+    return info;
+}
+
+void MAMEduinoDevice::closePort()
+{
+    m_capture.close();
+    if (m_portHandle < 0) {
+        return;
+    }
+    if (m_usesDaemon) {
+        ::close(m_portHandle);
+    }
+    else {
+        closeSerialPort(m_portHandle, &m_oldOptions);
+    }
+    m_portHandle = -1;
+}
+
+void MAMEduinoDevice::sendCommands(std::vector<Call> & calls)
+{
+    if (m_portHandle < 0) {
+        for (auto & call : calls) {
+            call.callback(CommandResult());
+        }
+    }
+    else if (m_usesFramedProtocol) {
+        sendCommandsFramed(calls);
+    }
+    else {
+        sendCommandsText(calls);
+    }
+}
+
+void MAMEduinoDevice::sendCommandsFramed(std::vector<Call> & calls)
+{
+    //send all commands as frames without waiting for every response
+    std::vector<FramedCommand> framedCommands(calls.size());
+    for (size_t i = 0; i < calls.size(); ++i) {
+        framedCommands.at(i).payload = calls.at(i).command;
+        framedCommands.at(i).result = RESPONSE_ERROR;
+        framedCommands.at(i).roundTripMs = 0;
+    }
+    const bool portOk = sendFramedCommands(m_portHandle, framedCommands, m_nextSequence, m_responseTimeMs, &m_capture);
+    for (size_t i = 0; i < calls.size(); ++i) {
+        const FramedCommand & framedCommand = framedCommands.at(i);
+        CommandResult result;
+        //commands that did not finish before the port failed failed with it
+        result.result = portOk || framedCommand.result == RESPONSE_OK || framedCommand.result == RESPONSE_NOK ? framedCommand.result : RESPONSE_ERROR;
+        result.response = framedCommand.response;
+        result.roundTripMs = framedCommand.roundTripMs;
+        calls.at(i).callback(result);
+    }
+}
+
+void MAMEduinoDevice::sendCommandsText(std::vector<Call> & calls)
+{
+    //send commands one after another, waiting for the response every time
+    for (auto & call : calls) {
+        CommandResult result;
+        const auto startTime = std::chrono::steady_clock::now();
+        std::vector<uint8_t> data = call.command;
+        data.push_back(COMMAND_TERMINATOR);
+        if (writeToPort(m_portHandle, data.data(), data.size(), &m_capture)) {
+            result.result = readResponseFromSerial(m_portHandle, result.response, m_responseTimeMs, &m_capture);
+        }
+        //binary data is sent as hex digits in text responses
+        const uint8_t command = call.command.empty() ? 0 : call.command.front();
+        if (result.result == RESPONSE_OK && (command == COMMAND_READ_CONFIG || command == COMMAND_READ_TELEMETRY || command == COMMAND_READ_COIN_COUNTERS)) {
+            std::string binary;
+            result.result = decodeHex(result.response, binary) ? RESPONSE_OK : RESPONSE_NOK;
+            result.response = binary;
+        }
+        result.roundTripMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        call.callback(result);
+    }
+}
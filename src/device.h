@@ -0,0 +1,143 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <stdint.h>
+#include <termios.h>
+
+#include "serialport.h"
+#include "deviceconfig.h"
+#include "bridge.h"
+#include "capture.h"
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+//A MAMEduinoDevice talks to one device on a thread of its own. All calls return right away and deliver their result
+//through a future or a callback. Callbacks are called on the device thread, so they should not block.
+//Calls are done in the order they were made. Commands made one after another are sent together and, with the framed
+//protocol, kept in flight at the same time. Several devices can be used at once, nothing is shared between them.
+
+/*!
+How to connect to a device.
+*/
+struct DeviceOptions
+{
+    std::string portName; //!<Serial port device name, e.g. "/dev/ttyACM0". Empty to auto-detect the port.
+    bool useDaemon = true; //!<Send commands through mameduinod if it is running for the port.
+    bool forceTextProtocol = false; //!<Send plain text commands even if the device supports the framed protocol.
+    int responseTimeMs = 200; //!<How long to wait for a response. DAEMON_RESPONSE_TIME_MS is used with the daemon.
+    std::string captureFileName; //!<Record all traffic with the device to this trace file. Empty to not record anything.
+};
+
+enum OpenResult {OPEN_OK, OPEN_NOT_FOUND, OPEN_FAILED, OPEN_CAPTURE_FAILED};
+
+/*!
+What is known about a device after opening it.
+*/
+struct DeviceInfo
+{
+    OpenResult result = OPEN_FAILED; //!<OPEN_NOT_FOUND if auto-detection found no device, OPEN_FAILED if the port could not be opened, OPEN_CAPTURE_FAILED if the trace file could not be created.
+    std::string portName; //!<Serial port device name.
+    std::string versionString; //!<Response to CHECK_VERSION. Empty if the device did not answer.
+    bool reportsLayout = false; //!<False if the device did not report its layout and limits has the default layout.
+    DeviceLimits limits; //!<Number of inputs and keys per binding.
+    bool usesDaemon = false; //!<Commands are sent through mameduinod.
+    bool usesFramedProtocol = false; //!<Commands are sent as frames.
+};
+
+/*!
+Result of a command.
+*/
+struct CommandResult
+{
+    ResponseResult result = RESPONSE_ERROR; //!<How the command ended.
+    std::string response; //!<Response data without OK/NK or status byte. Binary data is decoded from hex digits for text commands.
+    double roundTripMs = 0; //!<Time from sending the command until its response arrived.
+};
+
+class MAMEduinoDevice
+{
+public:
+    typedef std::function<void(const DeviceInfo &)> OpenCallback;
+    typedef std::function<void(const CommandResult &)> CommandCallback;
+
+    MAMEduinoDevice();
+    /*!
+    Finish all calls made so far and close the device.
+    */
+    ~MAMEduinoDevice();
+
+    MAMEduinoDevice(const MAMEduinoDevice &) = delete;
+    MAMEduinoDevice & operator=(const MAMEduinoDevice &) = delete;
+
+    /*!
+    Open the device, or the daemon using it, and read its version and layout. A device already open is closed first.
+    */
+    std::future<DeviceInfo> open(const DeviceOptions & options);
+    void open(const DeviceOptions & options, OpenCallback callback);
+
+    /*!
+    Close the device.
+    */
+    std::future<void> close();
+
+    /*!
+    What is known about the device. Updated when open() finishes.
+    */
+    DeviceInfo info() const;
+
+    /*!
+    Send a command.
+    \param[in] command Command byte and arguments, without terminator. See the COMMAND_* constants.
+    */
+    std::future<CommandResult> send(const std::vector<uint8_t> & command);
+    void send(const std::vector<uint8_t> & command, CommandCallback callback);
+
+    /*!
+    Switch the device to bridge mode and inject the keys for its events until SIGINT or SIGTERM arrive.
+    Block these signals in all threads of the program, else they end it. config and injector must stay valid until the
+    future is ready. Calls made meanwhile wait for bridge mode to end.
+    \return The future returns false if the device is not open directly, bridge mode could not be started or the port failed.
+    */
+    std::future<bool> runBridge(const DeviceConfig & config, KeyInjector & injector, bool verbose = false);
+
+private:
+    struct Call
+    {
+        std::vector<uint8_t> command; //!<Command to send if task is empty.
+        CommandCallback callback;
+        std::function<void()> task; //!<Anything else to do on the device thread.
+    };
+
+    void enqueue(Call && call);
+    void run();
+
+    DeviceInfo openPort(const DeviceOptions & options);
+    void closePort();
+    void sendCommands(std::vector<Call> & calls);
+    void sendCommandsFramed(std::vector<Call> & calls);
+    void sendCommandsText(std::vector<Call> & calls);
+
+    //only used on the device thread
+    int m_portHandle = -1;
+    termios m_oldOptions;
+    int m_responseTimeMs = 200;
+    bool m_usesDaemon = false;
+    bool m_usesFramedProtocol = false;
+    uint8_t m_nextSequence = 0; //!<Kept for the lifetime of the device, so responses can't be matched to the wrong frame.
+    TrafficCapture m_capture;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_callsQueued;
+    std::deque<Call> m_calls;
+    bool m_stopping = false;
+    DeviceInfo m_info;
+    std::thread m_thread; //!<Started last, when everything else is set up.
+};
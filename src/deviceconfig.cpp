@@ -0,0 +1,121 @@
+#include "deviceconfig.h"
+
+#include <sstream>
+#include <algorithm>
+
+#include "serialport.h"
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+bool parseDeviceLimits(const std::string & versionString, DeviceLimits & limits)
+{
+    //layout entries are a letter followed by a number: B = buttons, C = coins, K = keys per binding
+    std::istringstream versionStream(versionString);
+    std::string token;
+    bool found = false;
+    while (versionStream >> token) {
+        if (token.size() < 2 || token.find_first_not_of("0123456789", 1) != std::string::npos || token.size() > 4) {
+            continue;
+        }
+        const size_t value = std::stoul(token.substr(1));
+        switch (token.at(0)) {
+            case 'B': limits.nrOfButtons = value; found = true; break;
+            case 'C': limits.nrOfCoins = value; found = true; break;
+            case 'K': limits.nrOfKeys = value; found = true; break;
+        }
+    }
+    return found;
+}
+
+/*!
+Keys of a binding without the unused keys at the end. Keys end at the first 0.
+*/
+template <typename ITERATOR>
+std::vector<uint8_t> usedKeys(ITERATOR begin, ITERATOR end)
+{
+    std::vector<uint8_t> keys(begin, end);
+    keys.erase(std::find(keys.begin(), keys.end(), 0), keys.end());
+    return keys;
+}
+
+bool decodeDeviceConfig(const std::string & data, DeviceConfig & config)
+{
+    const uint8_t formatVersion = data.size() >= 4 ? static_cast<uint8_t>(data.at(0)) : 0;
+    if (formatVersion != 1 && formatVersion != CONFIG_SNAPSHOT_FORMAT_VERSION) {
+        return false;
+    }
+    const size_t nrOfButtons = static_cast<uint8_t>(data.at(1));
+    const size_t nrOfCoins = static_cast<uint8_t>(data.at(2));
+    config.nrOfKeys = static_cast<uint8_t>(data.at(3));
+    //keys are stored one binding after another. format 1 has nrOfKeys bytes per binding, format 2 a length byte first
+    size_t index = 4;
+    auto readBindings = [&](size_t nrOfBindings, std::vector<std::vector<uint8_t>> & bindings) -> bool {
+        bindings.clear();
+        for (size_t i = 0; i < nrOfBindings; ++i) {
+            const size_t length = formatVersion == 1 ? config.nrOfKeys : (index < data.size() ? static_cast<uint8_t>(data.at(index++)) : 0);
+            if (index + length >= data.size()) {
+                return false;
+            }
+            bindings.push_back(usedKeys(data.cbegin() + index, data.cbegin() + index + length));
+            index += length;
+        }
+        return true;
+    };
+    if (!readBindings(nrOfButtons, config.buttonShort) || !readBindings(nrOfButtons, config.buttonLong) || !readBindings(nrOfCoins, config.coin) || index + 1 != data.size()) {
+        return false;
+    }
+    config.coinReject = data.at(index) != 0;
+    return true;
+}
+
+std::vector<uint8_t> encodeDeviceConfig(const DeviceConfig & config)
+{
+    std::vector<uint8_t> data = {CONFIG_SNAPSHOT_FORMAT_VERSION, static_cast<uint8_t>(config.buttonShort.size()), static_cast<uint8_t>(config.coin.size()), static_cast<uint8_t>(config.nrOfKeys)};
+    for (const auto bindings : {&config.buttonShort, &config.buttonLong, &config.coin}) {
+        for (const auto & keys : *bindings) {
+            data.push_back(static_cast<uint8_t>(keys.size()));
+            data.insert(data.end(), keys.cbegin(), keys.cend());
+        }
+    }
+    data.push_back(config.coinReject ? 1 : 0);
+    return data;
+}
+
+bool supportsConfigWrite(const std::string & versionString)
+{
+    return versionString.find(CONFIG_WRITE_CAPABILITY) != std::string::npos;
+}
+
+bool supportsConfigSave(const std::string & versionString)
+{
+    return versionString.find(CONFIG_SAVE_CAPABILITY) != std::string::npos;
+}
+
+bool applyToDeviceConfig(DeviceConfig & config, const std::vector<uint8_t> & command)
+{
+    if (command.size() == 2 && command.at(0) == COMMAND_SET_COIN_REJECT) {
+        const bool coinReject = command.at(1) > 0;
+        const bool changes = config.coinReject != coinReject;
+        config.coinReject = coinReject;
+        return changes;
+    }
+    if (command.size() < 3 || command.size() > 2 + config.nrOfKeys) {
+        return true;
+    }
+    std::vector<std::vector<uint8_t>> * bindings = nullptr;
+    switch (command.at(0)) {
+        case COMMAND_SET_BUTTON_SHORT: bindings = &config.buttonShort; break;
+        case COMMAND_SET_BUTTON_LONG: bindings = &config.buttonLong; break;
+        case COMMAND_SET_COIN: bindings = &config.coin; break;
+        default: return true;
+    }
+    const size_t index = command.at(1);
+    if (index >= bindings->size()) {
+        return true;
+    }
+    //the device only keeps the keys up to the first 0
+    const std::vector<uint8_t> keys = usedKeys(command.cbegin() + 2, command.cend());
+    const bool changes = bindings->at(index) != keys;
+    bindings->at(index) = keys;
+    return changes;
+}
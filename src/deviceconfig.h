@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include "../MAMEduino/layout.h"
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+//The READ_CONFIG command returns a snapshot of all bindings and the coin rejection state.
+//It is sent as binary data in response frames and as hex digits in text responses.
+//Format 1 has a fixed number of keys per binding, format 2 the length of every binding before its keys.
+const uint8_t CONFIG_SNAPSHOT_FORMAT_VERSION = 2; //!<First byte of the snapshot.
+const size_t LEGACY_NR_OF_KEYS = 6; //!<Keys per binding of firmware that does not report its layout.
+//The WRITE_CONFIG command takes a format 2 snapshot for the layout of the device and swaps it in at once or not at all.
+const std::string CONFIG_WRITE_CAPABILITY = " W1"; //!<Capability token in the version string.
+//Firmware with the SAVE_CONFIG command only saves the config to EEPROM when told to. Older firmware saves it by itself.
+const std::string CONFIG_SAVE_CAPABILITY = " V1"; //!<Capability token in the version string.
+
+/*!
+Bindings and coin rejection state of a device.
+*/
+struct DeviceConfig
+{
+    size_t nrOfKeys = 0; //!<Maximum number of keys per binding.
+    std::vector<std::vector<uint8_t>> buttonShort; //!<Keys sent on short button presses. Unused keys at the end are left out.
+    std::vector<std::vector<uint8_t>> buttonLong; //!<Keys sent on long button presses.
+    std::vector<std::vector<uint8_t>> coin; //!<Keys sent on coin insertion.
+    bool coinReject = false; //!<True if coins are rejected.
+};
+
+/*!
+Number of inputs and keys per binding of a device. Devices report them after the capabilities in the version string,
+e.g. "MAMEduino 0.9.9.3 P1 B21 C3 K24". Older devices don't and have the default layout with 6 keys per binding.
+*/
+struct DeviceLimits
+{
+    size_t nrOfButtons = Layout::buttons; //!<Button indices are 0 to nrOfButtons - 1.
+    size_t nrOfCoins = Layout::coins; //!<Coin indices are 0 to nrOfCoins - 1.
+    size_t nrOfKeys = LEGACY_NR_OF_KEYS; //!<Maximum number of key bytes per binding.
+};
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+/*!
+Read the input layout from the version string of a device.
+\param[in] versionString Response to the CHECK_VERSION command.
+\param[out] limits Receives the layout. Values the device does not report are left unchanged.
+\return Returns false if the device does not report its layout.
+*/
+bool parseDeviceLimits(const std::string & versionString, DeviceLimits & limits);
+
+/*!
+Decode a binary config snapshot.
+Format 1 and 2 snapshots are supported.
+\return Returns false if the snapshot is too short or has an unknown format version.
+*/
+bool decodeDeviceConfig(const std::string & data, DeviceConfig & config);
+
+/*!
+Encode a config as format 2 snapshot for the WRITE_CONFIG command.
+*/
+std::vector<uint8_t> encodeDeviceConfig(const DeviceConfig & config);
+
+/*!
+Check if a CHECK_VERSION response advertises the WRITE_CONFIG command.
+*/
+bool supportsConfigWrite(const std::string & versionString);
+
+/*!
+Check if a CHECK_VERSION response advertises the SAVE_CONFIG command.
+*/
+bool supportsConfigSave(const std::string & versionString);
+
+/*!
+Check if a set command would change the config and apply it to the config.
+\param[in,out] config Config to check against and update.
+\param[in] command Command byte and arguments of a SET_* command.
+\return Returns true if the command changes the config or can't be checked, false if the device already has this setting.
+*/
+bool applyToDeviceConfig(DeviceConfig & config, const std::vector<uint8_t> & command);
@@ -0,0 +1,188 @@
+#include "framedprotocol.h"
+
+#include <chrono>
+#include <map>
+#include <algorithm>
+
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+uint16_t crc16(const uint8_t * data, size_t size, uint16_t crc)
+{
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= static_cast<uint16_t>(data[i]) << 8;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+std::vector<uint8_t> buildFrame(uint8_t sequence, const std::vector<uint8_t> & payload)
+{
+    std::vector<uint8_t> frame;
+    frame.reserve(payload.size() + 6);
+    frame.push_back(FRAME_START);
+    frame.push_back(static_cast<uint8_t>(payload.size() & 0xFF));
+    frame.push_back(static_cast<uint8_t>(payload.size() >> 8));
+    frame.push_back(sequence);
+    frame.insert(frame.end(), payload.cbegin(), payload.cend());
+    const uint16_t crc = crc16(frame.data() + 1, frame.size() - 1);
+    frame.push_back(static_cast<uint8_t>(crc & 0xFF));
+    frame.push_back(static_cast<uint8_t>(crc >> 8));
+    return frame;
+}
+
+bool extractFrame(std::vector<uint8_t> & buffer, Frame & frame)
+{
+    while (true) {
+        //skip to next frame start
+        auto frameStart = std::find(buffer.begin(), buffer.end(), FRAME_START);
+        buffer.erase(buffer.begin(), frameStart);
+        if (buffer.size() < 6) {
+            return false;
+        }
+        const size_t length = buffer.at(1) | (static_cast<size_t>(buffer.at(2)) << 8);
+        if (length <= FRAME_MAX_RESPONSE) {
+            if (buffer.size() < length + 6) {
+                return false;
+            }
+            const uint16_t crc = crc16(buffer.data() + 1, length + 3);
+            if (crc == (buffer.at(length + 4) | (static_cast<uint16_t>(buffer.at(length + 5)) << 8))) {
+                frame.sequence = buffer.at(3);
+                frame.payload.assign(buffer.begin() + 4, buffer.begin() + 4 + length);
+                buffer.erase(buffer.begin(), buffer.begin() + length + 6);
+                return true;
+            }
+        }
+        //not a valid frame. skip this frame start
+        buffer.erase(buffer.begin());
+    }
+}
+
+bool supportsFramedProtocol(const std::string & versionString)
+{
+    return versionString.compare(0, VERSION_RESPONSE_START.length(), VERSION_RESPONSE_START) == 0 && versionString.find(FRAMED_PROTOCOL_CAPABILITY) != std::string::npos;
+}
+
+bool isRepeatableCommand(const std::vector<uint8_t> & payload)
+{
+    return payload.size() < 2 || (payload.front() != COMMAND_READ_TELEMETRY && payload.front() != COMMAND_READ_COIN_COUNTERS) || payload.at(1) == 0;
+}
+
+bool sendFramedCommands(const int portHandle, std::vector<FramedCommand> & commands, uint8_t & nextSequence, int waitTimeMs, TrafficCapture * capture)
+{
+    typedef std::chrono::steady_clock Clock;
+    struct PendingFrame
+    {
+        size_t commandIndex;
+        std::vector<uint8_t> frame;
+        Clock::time_point firstSendTime;
+        Clock::time_point deadline;
+        int retries;
+    };
+    std::map<uint8_t, PendingFrame> pendingFrames;
+    size_t bytesInFlight = 0;
+    size_t nextCommand = 0;
+    size_t nrOfFinished = 0;
+    std::vector<uint8_t> receiveBuffer;
+    auto finishCommand = [&](std::map<uint8_t, PendingFrame>::iterator pendingIt, ResponseResult result) {
+        FramedCommand & command = commands.at(pendingIt->second.commandIndex);
+        command.result = result;
+        command.roundTripMs = std::chrono::duration<double, std::milli>(Clock::now() - pendingIt->second.firstSendTime).count();
+        bytesInFlight -= pendingIt->second.frame.size();
+        pendingFrames.erase(pendingIt);
+        nrOfFinished++;
+    };
+    auto sendFrame = [&](PendingFrame & pending) {
+        pending.deadline = Clock::now() + std::chrono::milliseconds(waitTimeMs);
+        return writeToPort(portHandle, pending.frame.data(), pending.frame.size(), capture);
+    };
+    while (nrOfFinished < commands.size()) {
+        //send new frames as long as the device can buffer them
+        while (nextCommand < commands.size()) {
+            FramedCommand & command = commands.at(nextCommand);
+            PendingFrame pending = {nextCommand, buildFrame(nextSequence, command.payload), Clock::now(), Clock::now(), 0};
+            if (!pendingFrames.empty() && (bytesInFlight + pending.frame.size()) > FRAME_MAX_BYTES_IN_FLIGHT) {
+                break;
+            }
+            //the device only recognizes frames sent again within its history
+            const auto oldestPending = std::min_element(pendingFrames.cbegin(), pendingFrames.cend(), [](const std::pair<const uint8_t, PendingFrame> & a, const std::pair<const uint8_t, PendingFrame> & b) {
+                return a.second.commandIndex < b.second.commandIndex;
+            });
+            if (oldestPending != pendingFrames.cend() && (nextCommand - oldestPending->second.commandIndex) >= FRAME_HISTORY_SIZE) {
+                break;
+            }
+            command.result = RESPONSE_TIMEOUT;
+            command.response.clear();
+            if (!sendFrame(pending)) {
+                return false;
+            }
+            bytesInFlight += pending.frame.size();
+            pendingFrames[nextSequence++] = pending;
+            nextCommand++;
+        }
+        //wait for responses until the earliest deadline
+        auto deadline = Clock::time_point::max();
+        for (const auto & pending : pendingFrames) {
+            deadline = std::min(deadline, pending.second.deadline);
+        }
+        const auto remainingTime = std::chrono::duration_cast<std::chrono::microseconds>(deadline - Clock::now());
+        pollfd pollInfo = {portHandle, POLLIN, 0};
+        const int pollResult = remainingTime.count() > 0 ? poll(&pollInfo, 1, static_cast<int>((remainingTime.count() + 999) / 1000)) : 0;
+        if (pollResult < 0 && errno != EINTR) {
+            return false;
+        }
+        if (pollResult > 0) {
+            if (pollInfo.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                return false;
+            }
+            uint8_t buffer[256];
+            const ssize_t bytesRead = readFromPort(portHandle, buffer, sizeof(buffer), capture);
+            if (bytesRead < 0 && errno != EAGAIN && errno != EINTR) {
+                return false;
+            }
+            if (bytesRead > 0) {
+                receiveBuffer.insert(receiveBuffer.end(), buffer, buffer + bytesRead);
+            }
+            //match responses to pending frames by sequence number
+            Frame frame;
+            while (extractFrame(receiveBuffer, frame)) {
+                auto pendingIt = pendingFrames.find(frame.sequence);
+                if (pendingIt == pendingFrames.end() || frame.payload.empty()) {
+                    continue;
+                }
+                if (frame.payload.front() == FRAME_STATUS_BAD_FRAME && pendingIt->second.retries < FRAME_MAX_RETRIES) {
+                    //frame was damaged on the way. send again
+                    pendingIt->second.retries++;
+                    if (!sendFrame(pendingIt->second)) {
+                        return false;
+                    }
+                    continue;
+                }
+                commands.at(pendingIt->second.commandIndex).response.assign(frame.payload.begin() + 1, frame.payload.end());
+                finishCommand(pendingIt, frame.payload.front() == FRAME_STATUS_OK ? RESPONSE_OK : RESPONSE_NOK);
+            }
+        }
+        //resend frames that timed out or give up on them
+        const auto now = Clock::now();
+        for (auto pendingIt = pendingFrames.begin(); pendingIt != pendingFrames.end();) {
+            auto currentIt = pendingIt++;
+            if (currentIt->second.deadline <= now) {
+                if (currentIt->second.retries < FRAME_MAX_RETRIES && isRepeatableCommand(commands.at(currentIt->second.commandIndex).payload)) {
+                    currentIt->second.retries++;
+                    if (!sendFrame(currentIt->second)) {
+                        return false;
+                    }
+                }
+                else {
+                    finishCommand(currentIt, RESPONSE_TIMEOUT);
+                }
+            }
+        }
+    }
+    return true;
+}
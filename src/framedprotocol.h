@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "serialport.h"
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+//Framed protocol version 1. Firmware supporting it appends FRAMED_PROTOCOL_CAPABILITY to its CHECK_VERSION response.
+//A frame is: FRAME_START, 16-bit payload length (LSB first), sequence number, payload, 16-bit CRC (LSB first).
+//The CRC is CRC-16/CCITT (polynomial 0x1021, start value 0xFFFF) over length, sequence number and payload.
+//Command frames carry a command byte and its arguments without terminator. Response frames carry the sequence number
+//of the command and a status byte followed by the response data. The host can send several frames without waiting.
+//The device remembers the last FRAME_HISTORY_SIZE frames and answers a frame sent again without executing it twice.
+const uint8_t FRAME_START = 0xA5; //!<First byte of every frame.
+const std::string FRAMED_PROTOCOL_CAPABILITY = " P1"; //!<Capability token in the version string.
+const size_t FRAME_MAX_RESPONSE = 4096; //!<Maximum payload length of a response frame we accept.
+const size_t FRAME_MAX_BYTES_IN_FLIGHT = 48; //!<Maximum number of command bytes not yet acknowledged. The Leonardo receive buffer is 64 bytes.
+const int FRAME_MAX_RETRIES = 2; //!<How often to resend a command frame that was not acknowledged.
+const size_t FRAME_HISTORY_SIZE = 8; //!<Number of frames the device remembers. At most this many sequence numbers are in flight.
+
+enum FrameStatus {FRAME_STATUS_OK = 0, FRAME_STATUS_NOK = 1, FRAME_STATUS_BAD_FRAME = 2};
+
+struct Frame
+{
+    uint8_t sequence; //!<Sequence number of the command frame.
+    std::vector<uint8_t> payload; //!<Frame payload.
+};
+
+struct FramedCommand
+{
+    std::vector<uint8_t> payload; //!<Command byte and arguments.
+    ResponseResult result; //!<How the command ended.
+    std::string response; //!<Response data without status byte.
+    double roundTripMs; //!<Time from sending the command until its response arrived.
+};
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+/*!
+Update a CRC-16/CCITT with data.
+*/
+uint16_t crc16(const uint8_t * data, size_t size, uint16_t crc = 0xFFFF);
+
+/*!
+Build a frame from a sequence number and payload.
+*/
+std::vector<uint8_t> buildFrame(uint8_t sequence, const std::vector<uint8_t> & payload);
+
+/*!
+Remove the first complete frame from the start of a receive buffer. Garbage and broken frames are dropped.
+\param[in,out] buffer Data received so far.
+\param[out] frame Receives the frame.
+\return Returns true if a frame with a correct CRC was found.
+*/
+bool extractFrame(std::vector<uint8_t> & buffer, Frame & frame);
+
+/*!
+Check if a CHECK_VERSION response advertises the framed protocol.
+*/
+bool supportsFramedProtocol(const std::string & versionString);
+
+/*!
+Check if a command can be sent again when its response got lost. Reading counters and resetting them can't.
+*/
+bool isRepeatableCommand(const std::vector<uint8_t> & payload);
+
+/*!
+Send commands as frames, keeping as many in flight as the device can buffer. Frames that are not acknowledged in time are
+resent if isRepeatableCommand() allows it.
+\param[in] portHandle Handle of the open serial port.
+\param[in,out] commands Commands to send. Receives the results.
+\param[in,out] nextSequence Sequence number of the next frame. Keep it for the next call, so a late response to an
+earlier call can not be mistaken for the response to a new frame.
+\param[in] waitTimeMs Maximum time to wait for a response to a frame.
+\param[in] capture Records the frames sent and the data received if not nullptr.
+\return Returns false if writing to or reading from the port failed.
+*/
+bool sendFramedCommands(const int portHandle, std::vector<FramedCommand> & commands, uint8_t & nextSequence, int waitTimeMs = 200, TrafficCapture * capture = nullptr);
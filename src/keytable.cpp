@@ -0,0 +1,44 @@
+#include "keytable.h"
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+std::string keysToString(const std::vector<uint8_t> & keys)
+{
+    std::string result;
+    for (size_t i = 0; i < keys.size() && keys.at(i) != 0; ++i) {
+        uint16_t code = keys.at(i);
+        if (code == CHAR_CHORD) {
+            //held together with the previous key
+            result += "+";
+            continue;
+        }
+        if ((code == CHAR_DELAY || code == CHAR_HOLD || code == CHAR_REPEAT) && (i + 1) < keys.size()) {
+            const int operand = keys.at(++i) & ~MACRO_OPERAND;
+            if (code == CHAR_REPEAT) {
+                //shown as the total number of times after the repeated key
+                result += "*" + std::to_string(operand + 1);
+            }
+            else {
+                result += (result.empty() ? "" : " ") + std::string(code == CHAR_DELAY ? "DELAY:" : "HOLD:") + std::to_string(operand * MACRO_TIME_UNIT);
+            }
+            continue;
+        }
+        if (code == CHAR_MEDIA && (i + 1) < keys.size()) {
+            code = (CHAR_MEDIA << 8) | keys.at(++i);
+        }
+        if (!result.empty() && result.back() != '+') {
+            result += " ";
+        }
+        const char * name = keyNameFromCode(code);
+        if (name != nullptr) {
+            result += name;
+        }
+        else if (code > ' ' && code < 127) {
+            result += static_cast<char>(code);
+        }
+        else {
+            result += std::to_string(code);
+        }
+    }
+    return result.empty() ? "CLEAR" : result;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "../MAMEduino/keycodes.h"
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+//The key name table is generated from the MAMEDUINO_KEYS list shared with the Arduino code.
+//Names are looked up with a perfect hash that is built at compile time, so nothing is allocated or filled in at startup.
+
+/*!
+Name and code of a key. Codes > 255 are CHAR_MEDIA in the high byte and the HID consumer usage in the low byte.
+*/
+struct KeyTableEntry
+{
+    const char * name;
+    uint16_t code;
+};
+
+#define MAMEDUINO_KEY_TABLE_ENTRY(name, code) {#name, code},
+constexpr KeyTableEntry KEY_TABLE[] = {MAMEDUINO_KEYS(MAMEDUINO_KEY_TABLE_ENTRY)};
+#undef MAMEDUINO_KEY_TABLE_ENTRY
+constexpr size_t KEY_TABLE_SIZE = sizeof(KEY_TABLE) / sizeof(KEY_TABLE[0]);
+constexpr uint8_t KEY_TABLE_NONE = 0xFF; //!<Hash slot or key code without table entry.
+static_assert(KEY_TABLE_SIZE < KEY_TABLE_NONE, "Too many keys for 8-bit table indices.");
+
+constexpr size_t KEY_HASH_SLOTS = 512; //!<Number of hash slots. Must be a power of two.
+constexpr uint32_t KEY_HASH_SEED = 3; //!<FNV-1a offset basis, chosen so that no two names share a slot.
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+/*!
+FNV-1a hash of a key name.
+*/
+constexpr uint32_t keyNameHash(const char * name, uint32_t hash = KEY_HASH_SEED)
+{
+    return *name == 0 ? hash : keyNameHash(name + 1, (hash ^ static_cast<uint8_t>(*name)) * 16777619u);
+}
+
+constexpr size_t keyNameSlot(const char * name)
+{
+    return keyNameHash(name) & (KEY_HASH_SLOTS - 1);
+}
+
+constexpr bool keyNamesEqual(const char * a, const char * b)
+{
+    return *a == *b && (*a == 0 || keyNamesEqual(a + 1, b + 1));
+}
+
+/*!
+Index of the first table entry that hashes to a slot, starting at entry i.
+*/
+constexpr uint8_t keyEntryForSlot(size_t slot, size_t i = 0)
+{
+    return i >= KEY_TABLE_SIZE ? KEY_TABLE_NONE : (keyNameSlot(KEY_TABLE[i].name) == slot ? static_cast<uint8_t>(i) : keyEntryForSlot(slot, i + 1));
+}
+
+/*!
+Index of the first table entry with a code, starting at entry i.
+*/
+constexpr uint8_t keyEntryForCode(size_t code, size_t i = 0)
+{
+    return i >= KEY_TABLE_SIZE ? KEY_TABLE_NONE : (KEY_TABLE[i].code == code ? static_cast<uint8_t>(i) : keyEntryForCode(code, i + 1));
+}
+
+//Compile-time index lists used to fill the lookup tables below
+template <size_t... I> struct KeyIndices { typedef KeyIndices type; };
+template <typename A, typename B> struct KeyIndicesJoin;
+template <size_t... A, size_t... B> struct KeyIndicesJoin<KeyIndices<A...>, KeyIndices<B...>> : KeyIndices<A..., (sizeof...(A) + B)...> {};
+template <size_t N> struct MakeKeyIndices : KeyIndicesJoin<typename MakeKeyIndices<N / 2>::type, typename MakeKeyIndices<N - N / 2>::type> {};
+template <> struct MakeKeyIndices<0> : KeyIndices<> {};
+template <> struct MakeKeyIndices<1> : KeyIndices<0> {};
+
+template <size_t N>
+struct KeyLookupTable
+{
+    uint8_t entries[N]; //!<Index into KEY_TABLE or KEY_TABLE_NONE.
+};
+
+template <size_t... I>
+constexpr KeyLookupTable<sizeof...(I)> makeKeySlotTable(KeyIndices<I...>)
+{
+    return {{keyEntryForSlot(I)...}};
+}
+
+template <size_t... I>
+constexpr KeyLookupTable<sizeof...(I)> makeKeyCodeTable(KeyIndices<I...>)
+{
+    return {{keyEntryForCode(I)...}};
+}
+
+constexpr KeyLookupTable<KEY_HASH_SLOTS> KEY_SLOT_TABLE = makeKeySlotTable(MakeKeyIndices<KEY_HASH_SLOTS>::type()); //!<Hash slot -> table entry.
+constexpr KeyLookupTable<256> KEY_CODE_TABLE = makeKeyCodeTable(MakeKeyIndices<256>::type()); //!<Single-byte key code -> table entry.
+
+constexpr bool keyHashIsPerfect(size_t i = 0)
+{
+    return i >= KEY_TABLE_SIZE || (KEY_SLOT_TABLE.entries[keyNameSlot(KEY_TABLE[i].name)] == i && keyHashIsPerfect(i + 1));
+}
+static_assert(keyHashIsPerfect(), "Two key names share a hash slot. Change KEY_HASH_SEED.");
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+constexpr int keyCodeFromEntry(uint8_t entry, const char * name)
+{
+    return entry != KEY_TABLE_NONE && keyNamesEqual(KEY_TABLE[entry].name, name) ? KEY_TABLE[entry].code : -1;
+}
+
+/*!
+Find the code of a key name.
+\return Returns the key code or -1 if the name is unknown.
+*/
+constexpr int keyCodeFromName(const char * name)
+{
+    return keyCodeFromEntry(KEY_SLOT_TABLE.entries[keyNameSlot(name)], name);
+}
+
+/*!
+Find the name of a key code. Media keys are found by a linear search.
+\return Returns the key name or nullptr if the code has no name.
+*/
+constexpr const char * keyNameFromCode(uint16_t code)
+{
+    return code < 256 ? (KEY_CODE_TABLE.entries[code] != KEY_TABLE_NONE ? KEY_TABLE[KEY_CODE_TABLE.entries[code]].name : nullptr)
+                      : (keyEntryForCode(code) != KEY_TABLE_NONE ? KEY_TABLE[keyEntryForCode(code)].name : nullptr);
+}
+
+static_assert(keyCodeFromName("PIN_POWER") == CHAR_PIN_POWER && keyCodeFromName("LCTRL") == 0x80, "Key table lookup broken.");
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+/*!
+Convert key bytes of a binding to readable names, e.g. "LCTRL+c F1 DELAY:200 DOWN*3". Unused (0) keys at the end are left out.
+\return Returns "CLEAR" if the binding is empty.
+*/
+std::string keysToString(const std::vector<uint8_t> & keys);
@@ -0,0 +1,428 @@
+#include "serialport.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <algorithm>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <limits.h>
+#include <ctype.h>
+
+#include "consolestyle.h"
+#include "capture.h"
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+/*!
+USB vendor and product id of a device.
+*/
+struct UsbId
+{
+    uint16_t vendorId;
+    uint16_t productId;
+};
+
+/*!
+USB ids of ATmega32U4 boards running a sketch: Arduino Leonardo and Micro, Arduino.org Leonardo, SparkFun Pro Micro
+and Adafruit Feather and ItsyBitsy 32u4. Terminated by a zero entry.
+*/
+const UsbId arduinoUsbIds[] = {
+    {0x2341, 0x8036}, {0x2341, 0x8037}, {0x2a03, 0x8036}, {0x1b4f, 0x9204}, {0x1b4f, 0x9206}, {0x239a, 0x800c}, {0x239a, 0x800e}, {0, 0}
+};
+const std::string sysfsTtyPath = "/sys/class/tty/"; //!<Where Linux lists tty devices.
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+bool serialPortExists(const std::string & portName)
+{
+    int portHandle = open(portName.c_str(), O_RDWR | O_NOCTTY | O_NDELAY);
+    if (portHandle <= 0) {
+        return false;
+    }
+    close(portHandle);
+    return true;
+}
+
+bool setSerialPortOptions(const int portHandle, termios * oldOptions)
+{
+	//store current terminal options
+	tcgetattr(portHandle, oldOptions);
+	//clear new terminal options
+	termios options;
+	memset(&options, 0, sizeof(termios));
+	//set baud rate to 38400 Baud
+	cfsetispeed(&options, B38400);
+    cfsetospeed(&options, B38400);
+    //set mode to 8N1
+    options.c_cflag |= (CLOCAL | CREAD); //Enable the receiver and set local mode
+    options.c_cflag &= ~PARENB; //no parity
+    options.c_cflag &= ~CSTOPB; //one stop bit
+    options.c_cflag &= ~CSIZE; //size mask flag
+    options.c_cflag |= CS8; //8 bit
+    //set raw output
+    options.c_oflag &= ~OPOST;
+    //set input mode (non-canonical, no echo)
+    options.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
+    //turn parity off
+    //options.c_iflag = IGNPAR;
+    //flush serial port
+    //tcflush(serialPort, TCIFLUSH);
+	//set terminal options
+	return tcsetattr(portHandle, TCSANOW, &options) == 0;
+}
+
+bool openSerialPort(int & portHandle, const std::string & portName, termios * oldOptions, bool verbose)
+{
+    //try opening serial port
+    if (verbose) {
+        std::cout << "Opening serial port " << portName << " ..." << std::endl;
+    }
+    portHandle = open(portName.c_str(), O_RDWR | O_NOCTTY | O_NDELAY);
+    if (portHandle <= 0) {
+		std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed to open serial port " << portName << "!" << ConsoleStyle() << std::endl;
+		return false;
+	}
+	//no set serial port to proper settings
+	if (verbose) {
+    	std::cout << "Setting serial port to 38400bps, 8N1 mode..." << std::endl;
+    }
+	if (!setSerialPortOptions(portHandle, oldOptions)) {
+		std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed set serial port options!" << ConsoleStyle() << std::endl;
+		close(portHandle);
+		return false;
+	}
+	return true;
+}
+
+void closeSerialPort(const int portHandle, const termios * oldOptions)
+{
+	//restore old port settings
+	tcsetattr(portHandle, TCSAFLUSH, oldOptions);
+	//close port and terminate
+	close(portHandle);
+}
+
+bool writeToSerialPort(const int portHandle, const unsigned char * data, const ssize_t size, TrafficCapture * capture)
+{
+	//write bytes to the port
+	if (!writeToPort(portHandle, data, size, capture)) {
+		std::cout << ConsoleStyle(ConsoleStyle::RED) << "Error: Failed write to serial port!" << ConsoleStyle() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool writeToPort(const int portHandle, const void * data, size_t size, TrafficCapture * capture)
+{
+    const ssize_t bytesWritten = write(portHandle, data, size);
+    if (capture != nullptr && bytesWritten > 0) {
+        capture->record(TRACE_TO_DEVICE, data, bytesWritten);
+    }
+    return bytesWritten == static_cast<ssize_t>(size);
+}
+
+ssize_t readFromPort(const int portHandle, void * buffer, size_t size, TrafficCapture * capture)
+{
+    const ssize_t bytesRead = read(portHandle, buffer, size);
+    if (capture != nullptr && bytesRead > 0) {
+        capture->record(TRACE_FROM_DEVICE, buffer, bytesRead);
+    }
+    return bytesRead;
+}
+
+bool removeResponseTerminator(std::string & response, ResponseResult & result)
+{
+    if (response.length() >= COMMAND_OK.length()) {
+        const size_t terminatorStart = response.length() - COMMAND_OK.length();
+        const bool isOk = response.compare(terminatorStart, COMMAND_OK.length(), COMMAND_OK) == 0;
+        if (isOk || response.compare(terminatorStart, COMMAND_NOK.length(), COMMAND_NOK) == 0) {
+            response.resize(terminatorStart);
+            result = isOk ? RESPONSE_OK : RESPONSE_NOK;
+            return true;
+        }
+    }
+    return false;
+}
+
+ResponseResult readResponseFromSerial(const int portHandle, std::string & response, int waitTimeMs, TrafficCapture * capture)
+{
+    //clear response string
+    response.clear();
+    //read until the response terminator arrives or the deadline has passed
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(waitTimeMs);
+    char buffer[256];
+    while (true) {
+        //wait for data or until the deadline has passed. round up to not spin on sub-millisecond remainders
+        const auto remainingTime = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+        if (remainingTime.count() <= 0) {
+            return RESPONSE_TIMEOUT;
+        }
+        pollfd pollInfo = {portHandle, POLLIN, 0};
+        const int pollResult = poll(&pollInfo, 1, static_cast<int>((remainingTime.count() + 999) / 1000));
+        if (pollResult < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return RESPONSE_ERROR;
+        }
+        else if (pollResult == 0) {
+            return RESPONSE_TIMEOUT;
+        }
+        if (pollInfo.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            return RESPONSE_ERROR;
+        }
+        const ssize_t bytesRead = readFromPort(portHandle, buffer, sizeof(buffer), capture);
+        if (bytesRead < 0 && errno != EAGAIN && errno != EINTR) {
+            return RESPONSE_ERROR;
+        }
+        else if (bytesRead <= 0) {
+            continue;
+        }
+        //append only the new data. the terminator can only be at the end of the data received so far
+        response.append(buffer, bytesRead);
+        ResponseResult result;
+        if (removeResponseTerminator(response, result)) {
+            return result;
+        }
+    }
+}
+
+bool decodeHex(const std::string & hex, std::string & data)
+{
+    if (hex.length() % 2 != 0) {
+        return false;
+    }
+    data.clear();
+    for (size_t i = 0; i < hex.length(); i += 2) {
+        unsigned int value;
+        std::istringstream digits(hex.substr(i, 2));
+        if (!isxdigit(hex.at(i)) || !isxdigit(hex.at(i + 1)) || !(digits >> std::hex >> value)) {
+            return false;
+        }
+        data.push_back(static_cast<char>(value));
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+bool readHexFile(const std::string & fileName, uint16_t & value)
+{
+    std::ifstream file(fileName);
+    return file.is_open() && (file >> std::hex >> value);
+}
+
+/*!
+Find the USB vendor and product id of a tty device by walking up its sysfs device path to the USB device.
+\return Returns false if the tty is not a USB device.
+*/
+bool getUsbId(const std::string & ttyName, UsbId & usbId)
+{
+    char devicePath[PATH_MAX];
+    if (realpath((sysfsTtyPath + ttyName + "/device").c_str(), devicePath) == nullptr) {
+        //virtual terminal or similar
+        return false;
+    }
+    std::string path = devicePath;
+    while (path.length() > 1 && path.find("/usb") != std::string::npos) {
+        if (readHexFile(path + "/idVendor", usbId.vendorId)) {
+            return readHexFile(path + "/idProduct", usbId.productId);
+        }
+        path = path.substr(0, path.find_last_of('/'));
+    }
+    return false;
+}
+
+bool isArduinoUsbId(const UsbId & usbId)
+{
+    for (int i = 0; arduinoUsbIds[i].vendorId != 0; ++i) {
+        if (arduinoUsbIds[i].vendorId == usbId.vendorId && arduinoUsbIds[i].productId == usbId.productId) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<std::string> listDirectory(const std::string & path)
+{
+    std::vector<std::string> entries;
+    DIR * directory = opendir(path.c_str());
+    if (directory != nullptr) {
+        while (dirent * entry = readdir(directory)) {
+            if (entry->d_name[0] != '.') {
+                entries.push_back(entry->d_name);
+            }
+        }
+        closedir(directory);
+    }
+    std::sort(entries.begin(), entries.end());
+    return entries;
+}
+
+std::vector<std::string> findSerialPortCandidates(std::vector<std::string> & otherPorts)
+{
+    std::vector<std::string> arduinoPorts;
+    otherPorts.clear();
+    //check all ttys for USB devices
+    for (const auto & ttyName : listDirectory(sysfsTtyPath)) {
+        UsbId usbId = {0, 0};
+        if (getUsbId(ttyName, usbId)) {
+            (isArduinoUsbId(usbId) ? arduinoPorts : otherPorts).push_back("/dev/" + ttyName);
+        }
+    }
+    if (arduinoPorts.empty() && otherPorts.empty()) {
+        //no sysfs information. use all USB and ACM ports in /dev
+        for (const auto & deviceName : listDirectory("/dev")) {
+            if (deviceName.compare(0, 6, "ttyUSB") == 0 || deviceName.compare(0, 6, "ttyACM") == 0) {
+                otherPorts.push_back("/dev/" + deviceName);
+            }
+        }
+    }
+    return arduinoPorts;
+}
+
+bool probeSerialPort(const std::string & portName, std::string & versionString)
+{
+    int portHandle = open(portName.c_str(), O_RDWR | O_NOCTTY | O_NDELAY);
+    if (portHandle <= 0) {
+        return false;
+    }
+    termios oldOptions;
+    if (!setSerialPortOptions(portHandle, &oldOptions)) {
+        close(portHandle);
+        return false;
+    }
+    //send version command and check the response
+    const unsigned char versionCommand[] = {COMMAND_CHECK_VERSION, COMMAND_TERMINATOR};
+    bool found = false;
+    if (write(portHandle, versionCommand, sizeof(versionCommand)) == sizeof(versionCommand)) {
+        found = readResponseFromSerial(portHandle, versionString) == RESPONSE_OK && versionString.compare(0, VERSION_RESPONSE_START.length(), VERSION_RESPONSE_START) == 0;
+    }
+    closeSerialPort(portHandle, &oldOptions);
+    return found;
+}
+
+/*!
+Probe serial ports at the same time and return as soon as one of them answers. Probes still running go on in the
+background until their response times out.
+\return Returns false if no MAMEduino answered.
+*/
+bool probeSerialPorts(const std::vector<std::string> & portNames, std::string & portName, std::string & versionString)
+{
+    struct ProbeState
+    {
+        std::mutex mutex;
+        std::condition_variable finished;
+        size_t nrOfFinished = 0;
+        std::string portName;
+        std::string versionString;
+    };
+    auto state = std::make_shared<ProbeState>();
+    for (const auto & candidate : portNames) {
+        std::thread([state, candidate]() {
+            std::string candidateVersion;
+            const bool found = probeSerialPort(candidate, candidateVersion);
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (found && state->portName.empty()) {
+                state->portName = candidate;
+                state->versionString = candidateVersion;
+            }
+            ++state->nrOfFinished;
+            state->finished.notify_one();
+        }).detach();
+    }
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&]() { return !state->portName.empty() || state->nrOfFinished == portNames.size(); });
+    portName = state->portName;
+    versionString = state->versionString;
+    return !portName.empty();
+}
+
+/*!
+Create a directory and its missing parents like "mkdir -p".
+\return Returns false if the directory does not exist afterwards.
+*/
+bool createDirectories(const std::string & path)
+{
+    const size_t separator = path.find_last_of('/');
+    if (separator != std::string::npos && separator > 0 && !createDirectories(path.substr(0, separator))) {
+        return false;
+    }
+    return mkdir(path.c_str(), 0700) == 0 || errno == EEXIST;
+}
+
+std::string getDetectionCacheFileName()
+{
+    //store in $XDG_CACHE_HOME or ~/.cache
+    const char * cacheDirectory = getenv("XDG_CACHE_HOME");
+    if (cacheDirectory != nullptr && cacheDirectory[0] != '\0') {
+        return std::string(cacheDirectory) + "/mameduino.port";
+    }
+    const char * homeDirectory = getenv("HOME");
+    if (homeDirectory != nullptr && homeDirectory[0] != '\0') {
+        return std::string(homeDirectory) + "/.cache/mameduino.port";
+    }
+    return "";
+}
+
+bool detectSerialPort(std::string & portName, bool verbose)
+{
+    std::string versionString;
+    //check the port we found last time first
+    const std::string cacheFileName = getDetectionCacheFileName();
+    std::string cachedPortName;
+    std::ifstream cacheFile(cacheFileName);
+    if (cacheFile.is_open() && std::getline(cacheFile, cachedPortName) && !cachedPortName.empty()) {
+        if (probeSerialPort(cachedPortName, versionString)) {
+            if (verbose) {
+                std::cout << ConsoleStyle(ConsoleStyle::GREEN) << versionString << " found at cached port " << cachedPortName << "." << ConsoleStyle() << std::endl;
+            }
+            portName = cachedPortName;
+            return true;
+        }
+    }
+    //probe the Arduino boards at the same time. other USB serial ports are only probed if none of them answers
+    std::vector<std::string> otherPorts;
+    std::vector<std::string> arduinoPorts = findSerialPortCandidates(otherPorts);
+    arduinoPorts.erase(std::remove(arduinoPorts.begin(), arduinoPorts.end(), cachedPortName), arduinoPorts.end());
+    otherPorts.erase(std::remove(otherPorts.begin(), otherPorts.end(), cachedPortName), otherPorts.end());
+    if (verbose) {
+        std::cout << "Probing " << arduinoPorts.size() << " Arduino serial port(s)..." << std::endl;
+    }
+    if (!probeSerialPorts(arduinoPorts, portName, versionString)) {
+        if (verbose) {
+            std::cout << "Probing " << otherPorts.size() << " other serial port(s)..." << std::endl;
+        }
+        if (!probeSerialPorts(otherPorts, portName, versionString)) {
+            return false;
+        }
+    }
+    if (verbose) {
+        std::cout << ConsoleStyle(ConsoleStyle::GREEN) << versionString << " found at " << portName << "." << ConsoleStyle() << std::endl;
+    }
+    //store port for next time
+    if (!cacheFileName.empty()) {
+        std::ofstream cacheOut;
+        if (createDirectories(cacheFileName.substr(0, cacheFileName.find_last_of('/')))) {
+            cacheOut.open(cacheFileName);
+        }
+        if (!(cacheOut << portName << std::endl)) {
+            std::cout << ConsoleStyle(ConsoleStyle::YELLOW) << "Warning: Failed to store the serial port in " << cacheFileName << "." << ConsoleStyle() << std::endl;
+        }
+    }
+    return true;
+}
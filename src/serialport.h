@@ -0,0 +1,137 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <termios.h>
+
+class TrafficCapture;
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+const std::string COMMAND_OK = "OK\n"; //!<Response sent when a command is detected.
+const std::string COMMAND_NOK = "NK\n"; //!<Response sent when the command or its arguments are not ok.
+const char COMMAND_TERMINATOR = 10; //!<Command terminator is LF aka '\n'
+const std::string VERSION_RESPONSE_START = "MAMEduino "; //!<Start of the response to the CHECK_VERSION command.
+
+//Command bytes. See the serial commands section of MAMEduino/MAMEduino.ino for their arguments.
+const uint8_t COMMAND_SET_COIN_REJECT = 'R'; //!<Set coin rejection off (0b) or on (> 0b).
+const uint8_t COMMAND_SET_BUTTON_SHORT = 'S'; //!<Set keys sent on short button press. Followed by button number and keys.
+const uint8_t COMMAND_SET_BUTTON_LONG = 'L'; //!<Set keys sent on long button press. Followed by button number and keys.
+const uint8_t COMMAND_SET_COIN = 'C'; //!<Set keys sent on coin insertion. Followed by coin number and keys.
+const uint8_t COMMAND_DUMP_CONFIG = 'D'; //!<Dump version and configuration as text.
+const uint8_t COMMAND_CHECK_VERSION = '?'; //!<Send version string, capabilities and input layout.
+const uint8_t COMMAND_SET_BRIDGE = 'E'; //!<Switch bridge mode off (0b) or on (> 0b).
+const uint8_t COMMAND_READ_CONFIG = 'B'; //!<Send a binary config snapshot.
+const uint8_t COMMAND_READ_TELEMETRY = 'T'; //!<Send binary performance counters. Followed by reset (> 0b) or not (0b).
+const uint8_t COMMAND_READ_COIN_COUNTERS = 'M'; //!<Send binary coin counters. Followed by reset (> 0b) or not (0b).
+const uint8_t COMMAND_SAVE_CONFIG = 'V'; //!<Save bindings and coin rejection to EEPROM, so the device boots with them.
+const uint8_t COMMAND_WRITE_CONFIG = 'W'; //!<Replace all bindings and the coin rejection state at once. Followed by a config snapshot. Frames only.
+
+/*!
+Result of reading a response from the serial port.
+*/
+enum ResponseResult {RESPONSE_OK, RESPONSE_NOK, RESPONSE_TIMEOUT, RESPONSE_ERROR};
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+/*!
+Check if a serial port can be opened.
+\param[in] portName Serial port device name, e.g. "/dev/ttyACM0".
+\return Returns true if the port could be opened.
+*/
+bool serialPortExists(const std::string & portName);
+
+/*!
+Set a serial port to 38400bps, 8N1, raw mode without printing anything.
+\param[in] portHandle Handle of the open serial port.
+\param[out] oldOptions Receives the port options before the change.
+\return Returns true if the options could be set.
+*/
+bool setSerialPortOptions(const int portHandle, termios * oldOptions);
+
+/*!
+Open a serial port and set it to 38400bps, 8N1, raw mode.
+\param[out] portHandle Receives the handle of the open port.
+\param[in] portName Serial port device name, e.g. "/dev/ttyACM0".
+\param[out] oldOptions Receives the port options before the change.
+\param[in] verbose Print what is done, not only errors.
+\return Returns true if the port could be opened and set up.
+*/
+bool openSerialPort(int & portHandle, const std::string & portName, termios * oldOptions, bool verbose = false);
+
+/*!
+Restore the old port options and close a serial port.
+*/
+void closeSerialPort(const int portHandle, const termios * oldOptions);
+
+/*!
+Write data to a serial port.
+\param[in] capture Records the data if not nullptr.
+\return Returns true if all bytes could be written.
+*/
+bool writeToSerialPort(const int portHandle, const unsigned char * data, const ssize_t size, TrafficCapture * capture = nullptr);
+
+/*!
+Write data to a port without printing anything.
+\param[in] capture Records the data if not nullptr.
+\return Returns true if all bytes could be written.
+*/
+bool writeToPort(const int portHandle, const void * data, size_t size, TrafficCapture * capture = nullptr);
+
+/*!
+Read the data available on a port.
+\param[in] capture Records the data if not nullptr.
+\return Returns the number of bytes read or -1 like read().
+*/
+ssize_t readFromPort(const int portHandle, void * buffer, size_t size, TrafficCapture * capture = nullptr);
+
+/*!
+Check if a response ends with the OK/NK terminator and remove it.
+\param[in,out] response Response received so far.
+\param[out] result Receives RESPONSE_OK or RESPONSE_NOK if the terminator was found.
+\return Returns true if the response is complete.
+*/
+bool removeResponseTerminator(std::string & response, ResponseResult & result);
+
+/*!
+Read a response from the serial port until the OK/NK terminator arrives or the time is up. Does not print anything.
+\param[in] portHandle Handle of the open serial port.
+\param[out] response Receives the response without terminator.
+\param[in] waitTimeMs Maximum time to wait for the terminator.
+\param[in] capture Records the data read if not nullptr.
+\return Returns how reading the response ended.
+*/
+ResponseResult readResponseFromSerial(const int portHandle, std::string & response, int waitTimeMs = 200, TrafficCapture * capture = nullptr);
+
+/*!
+Convert a string of hex digit pairs to bytes. Binary response data is sent as hex digits in text responses.
+\return Returns false if the string has an odd length or non-hex characters.
+*/
+bool decodeHex(const std::string & hex, std::string & data);
+
+/*!
+Get the names of the USB serial port devices of known Arduino boards by their USB vendor and product id, e.g. "/dev/ttyACM0".
+Uses the information in /sys/class/tty. Without it, all ttyUSB* and ttyACM* entries in /dev are other ports.
+\param[out] otherPorts Receives the names of all other USB serial port devices.
+*/
+std::vector<std::string> findSerialPortCandidates(std::vector<std::string> & otherPorts);
+
+/*!
+Check if a MAMEduino is connected to a serial port by sending the CHECK_VERSION command. Does not print anything.
+\param[in] portName Serial port device name, e.g. "/dev/ttyACM0".
+\param[out] versionString Receives the version string of the MAMEduino.
+\return Returns true if a MAMEduino answered.
+*/
+bool probeSerialPort(const std::string & portName, std::string & versionString);
+
+/*!
+Find the serial port a MAMEduino is connected to. The port found last time is checked first, then known Arduino boards
+are probed at the same time, then all other USB serial ports. The first port that answers is used and stored for the next call.
+\param[out] portName Receives the serial port device name.
+\param[in] verbose Print the ports probed and the port found.
+\return Returns true if a MAMEduino was found.
+*/
+bool detectSerialPort(std::string & portName, bool verbose = false);
@@ -0,0 +1,136 @@
+#include "telemetry.h"
+
+#include <iomanip>
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+/*!
+Reads little-endian values from telemetry data.
+*/
+class TelemetryReader
+{
+public:
+    TelemetryReader(const std::string & data) : m_data(data) {}
+
+    bool read(uint8_t & value)
+    {
+        if (m_index + 1 > m_data.size()) {
+            return false;
+        }
+        value = byteAt(m_index++);
+        return true;
+    }
+
+    bool read(uint16_t & value)
+    {
+        if (m_index + 2 > m_data.size()) {
+            return false;
+        }
+        value = static_cast<uint16_t>(byteAt(m_index) | (byteAt(m_index + 1) << 8));
+        m_index += 2;
+        return true;
+    }
+
+    bool read(uint32_t & value)
+    {
+        uint16_t low;
+        uint16_t high;
+        if (!read(low) || !read(high)) {
+            return false;
+        }
+        value = low | (static_cast<uint32_t>(high) << 16);
+        return true;
+    }
+
+    bool read(TelemetryTimer & timer)
+    {
+        return read(timer.totalUs) && read(timer.maxUs);
+    }
+
+private:
+    uint8_t byteAt(size_t index) const { return static_cast<uint8_t>(m_data.at(index)); }
+
+    const std::string & m_data;
+    size_t m_index = 1; //skip format version
+};
+
+bool decodeTelemetry(const std::string & data, Telemetry & telemetry)
+{
+    if (data.empty() || static_cast<uint8_t>(data.at(0)) != TELEMETRY_FORMAT_VERSION) {
+        return false;
+    }
+    TelemetryReader reader(data);
+    bool ok = reader.read(telemetry.loops) && reader.read(telemetry.loopMinUs) && reader.read(telemetry.loopMaxUs);
+    for (size_t i = 0; i < TELEMETRY_HISTOGRAM_SIZE && ok; ++i) {
+        ok = reader.read(telemetry.loopHistogram[i]);
+    }
+    return ok && reader.read(telemetry.keyboard) && reader.read(telemetry.ledShow) && reader.read(telemetry.serial)
+        && reader.read(telemetry.buttonPressesRejected) && reader.read(telemetry.coinPulsesRejected) && reader.read(telemetry.coinEdgesLost)
+        && reader.read(telemetry.keyQueueFull) && reader.read(telemetry.badFrames) && reader.read(telemetry.serialBytesDropped)
+        && reader.read(telemetry.uptimeMs);
+}
+
+void printTelemetry(std::ostream & out, const Telemetry & telemetry)
+{
+    const char * bucketNames[TELEMETRY_HISTOGRAM_SIZE] = {"<64us", "<128us", "<256us", "<512us", "<1ms", "<2ms", "<4ms", ">=4ms"};
+    out << "Uptime: " << telemetry.uptimeMs / 1000 << "." << std::setw(3) << std::setfill('0') << telemetry.uptimeMs % 1000 << std::setfill(' ') << "s" << std::endl;
+    out << "Loops: " << telemetry.loops;
+    if (telemetry.loops > 1) {
+        out << ", period min " << telemetry.loopMinUs << "us, max " << telemetry.loopMaxUs << (telemetry.loopMaxUs == 0xFFFF ? "+" : "") << "us";
+    }
+    out << std::endl;
+    out << "Loop periods:";
+    for (size_t i = 0; i < TELEMETRY_HISTOGRAM_SIZE; ++i) {
+        out << " " << bucketNames[i] << " " << telemetry.loopHistogram[i];
+    }
+    out << std::endl;
+    auto printTimer = [&](const char * name, const TelemetryTimer & timer) {
+        out << name << ": total " << std::fixed << std::setprecision(1) << timer.totalUs / 1000.0 << "ms, max " << timer.maxUs << "us";
+        if (telemetry.loops > 0) {
+            out << ", " << std::setprecision(2) << static_cast<double>(timer.totalUs) / telemetry.loops << "us/loop";
+        }
+        out << std::endl;
+    };
+    printTimer("Keyboard", telemetry.keyboard);
+    printTimer("LED show", telemetry.ledShow);
+    printTimer("Serial", telemetry.serial);
+    out << "Rejected button presses: " << telemetry.buttonPressesRejected << ", coin pulses: " << telemetry.coinPulsesRejected << std::endl;
+    out << "Lost coin edges: " << telemetry.coinEdgesLost << ", key queue full: " << telemetry.keyQueueFull << std::endl;
+    out << "Bad frames: " << telemetry.badFrames << ", serial bytes dropped: " << telemetry.serialBytesDropped << std::endl;
+}
+
+bool decodeCoinCounters(const std::string & data, std::vector<CoinCounter> & counters)
+{
+    if (data.empty() || static_cast<uint8_t>(data.at(0)) != COIN_COUNTERS_FORMAT_VERSION) {
+        return false;
+    }
+    TelemetryReader reader(data);
+    uint8_t nrOfCoins = 0;
+    if (!reader.read(nrOfCoins)) {
+        return false;
+    }
+    counters.resize(nrOfCoins);
+    for (auto & counter : counters) {
+        if (!reader.read(counter.coins) || !reader.read(counter.credits) || !reader.read(counter.pulsesRejected) || !reader.read(counter.creditsPending)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void printCoinCounters(std::ostream & out, const std::vector<CoinCounter> & counters)
+{
+    uint32_t totalCoins = 0;
+    uint32_t totalCredits = 0;
+    for (size_t i = 0; i < counters.size(); ++i) {
+        const CoinCounter & counter = counters.at(i);
+        out << "Coin #" << i << ": " << counter.coins << " coins, " << counter.credits << " credits, " << counter.pulsesRejected << " pulses rejected";
+        if (counter.creditsPending > 0) {
+            out << ", " << counter.creditsPending << " credits not sent yet";
+        }
+        out << std::endl;
+        totalCoins += counter.coins;
+        totalCredits += counter.credits;
+    }
+    out << "Total: " << totalCoins << " coins, " << totalCredits << " credits" << std::endl;
+}
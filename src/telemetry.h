@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <stdint.h>
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+//The READ_TELEMETRY command returns the performance counters of the firmware. Its argument byte resets the counters
+//afterwards if > 0. The counters are sent as binary data in response frames and as hex digits in text responses.
+const uint8_t TELEMETRY_FORMAT_VERSION = 1; //!<First byte of the telemetry data.
+const size_t TELEMETRY_HISTOGRAM_SIZE = 8; //!<Number of loop period histogram buckets.
+
+struct TelemetryTimer
+{
+    uint32_t totalUs = 0; //!<Total time spent.
+    uint16_t maxUs = 0; //!<Longest single call. Saturates at 65535.
+};
+
+struct Telemetry
+{
+    uint32_t loops = 0; //!<Number of loop() runs.
+    uint16_t loopMinUs = 0; //!<Shortest loop period.
+    uint16_t loopMaxUs = 0; //!<Longest loop period. Saturates at 65535.
+    uint16_t loopHistogram[TELEMETRY_HISTOGRAM_SIZE] = {}; //!<Loop periods < 64us, < 128us, ... < 4ms, >= 4ms.
+    TelemetryTimer keyboard; //!<Time spent sending keys.
+    TelemetryTimer ledShow; //!<Time spent sending LED frames. Interrupts are off meanwhile.
+    TelemetryTimer serial; //!<Time spent handling serial commands.
+    uint16_t buttonPressesRejected = 0; //!<Button presses too short to count.
+    uint16_t coinPulsesRejected = 0; //!<Coin pulses too short to count.
+    uint16_t coinEdgesLost = 0; //!<Coin edges lost because the capture buffer was full.
+    uint16_t keyQueueFull = 0; //!<How often keys had to wait for space in the key queue.
+    uint16_t badFrames = 0; //!<Frames with wrong CRC, too long or incomplete.
+    uint16_t serialBytesDropped = 0; //!<Bytes thrown away by the serial command parser.
+    uint32_t uptimeMs = 0; //!<Time since the device started.
+};
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+//The READ_COIN_COUNTERS command returns the coin audit counters of the firmware. Its argument byte resets the counters
+//afterwards if > 0. Credits not sent yet are not reset.
+const uint8_t COIN_COUNTERS_FORMAT_VERSION = 1; //!<First byte of the coin counter data.
+
+struct CoinCounter
+{
+    uint32_t coins = 0; //!<Coins accepted. A coin is a complete pulse train.
+    uint32_t credits = 0; //!<Credits of the accepted coins.
+    uint16_t pulsesRejected = 0; //!<Pulses too short to count.
+    uint16_t creditsPending = 0; //!<Credits not sent as keys yet.
+};
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+/*!
+Decode binary telemetry data.
+\return Returns false if the data is too short or has an unknown format version.
+*/
+bool decodeTelemetry(const std::string & data, Telemetry & telemetry);
+
+/*!
+Print telemetry in human-readable form.
+*/
+void printTelemetry(std::ostream & out, const Telemetry & telemetry);
+
+/*!
+Decode binary coin counter data.
+\return Returns false if the data is too short or has an unknown format version.
+*/
+bool decodeCoinCounters(const std::string & data, std::vector<CoinCounter> & counters);
+
+/*!
+Print coin counters in human-readable form.
+*/
+void printCoinCounters(std::ostream & out, const std::vector<CoinCounter> & counters);